@@ -0,0 +1,263 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define ALLOC_STATS_IMPL
+
+#include "alloc_stats.h"
+
+const char *ALLOC_TAG_NAMES[ALLOC_TAGS] = {"parser", "vec", "exec", "state"};
+
+bool is_alloc_stats_enabled = false;
+pthread_mutex_t alloc_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Live allocations by address, open addressing with linear probing
+AllocEntry *alloc_table = NULL;
+size_t alloc_table_size = 0;
+size_t alloc_table_len = 0;
+size_t live_bytes = 0;
+AllocCounters line_counters[ALLOC_TAGS];
+unsigned long alloc_budget = 0;
+unsigned long lines_over_budget = 0;
+
+void lock_alloc_stats() { pthread_mutex_lock(&alloc_mutex); }
+
+void unlock_alloc_stats() { pthread_mutex_unlock(&alloc_mutex); }
+
+void init_alloc_stats() {
+    char *enabled = getenv("VSH_ALLOC_STATS");
+    if (enabled == NULL || strcmp(enabled, "1") != 0) {
+        return;
+    }
+    char *budget = getenv("VSH_ALLOC_BUDGET");
+    alloc_budget = budget != NULL ? strtoul(budget, NULL, 10) : 0;
+    alloc_table_size = ALLOC_TABLE_INITIAL_SIZE;
+    alloc_table = calloc(alloc_table_size, sizeof(AllocEntry));
+    // Another thread may hold the lock while forking
+    pthread_atfork(lock_alloc_stats, unlock_alloc_stats, unlock_alloc_stats);
+    is_alloc_stats_enabled = true;
+}
+
+bool alloc_stats_enabled() { return is_alloc_stats_enabled; }
+
+size_t alloc_slot(void *ptr) {
+    uint64_t hash = (uintptr_t) ptr;
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    return hash & (alloc_table_size - 1);
+}
+
+void insert_alloc_entry(AllocEntry *entry) {
+    size_t slot = alloc_slot(entry->ptr);
+    while (alloc_table[slot].ptr != NULL) {
+        slot = (slot + 1) & (alloc_table_size - 1);
+    }
+    alloc_table[slot] = *entry;
+}
+
+void grow_alloc_table() {
+    AllocEntry *old_table = alloc_table;
+    size_t old_size = alloc_table_size, i;
+    alloc_table_size *= 2;
+    alloc_table = calloc(alloc_table_size, sizeof(AllocEntry));
+    for (i = 0; i < old_size; i++) {
+        if (old_table[i].ptr != NULL) {
+            insert_alloc_entry(&old_table[i]);
+        }
+    }
+    free(old_table);
+}
+
+void track_alloc(void *ptr, size_t size, enum AllocTag tag, const char *file, int line) {
+    if (ptr == NULL) {
+        return;
+    }
+    lock_alloc_stats();
+    if ((alloc_table_len + 1) * 2 > alloc_table_size) {
+        grow_alloc_table();
+    }
+    AllocEntry entry = {ptr, size, file, line, tag};
+    insert_alloc_entry(&entry);
+    alloc_table_len++;
+    live_bytes += size;
+    line_counters[tag].allocs++;
+    line_counters[tag].bytes += size;
+    unlock_alloc_stats();
+}
+
+/*
+ * Takes the entry of the allocation out of the table, with the lock held.
+ * Returns false for the ones made before the mode was enabled or by libc,
+ * they aren't in the table.
+ */
+bool remove_alloc_entry(void *ptr, AllocEntry *removed) {
+    size_t slot = alloc_slot(ptr), mask = alloc_table_size - 1;
+    while (alloc_table[slot].ptr != NULL && alloc_table[slot].ptr != ptr) {
+        slot = (slot + 1) & mask;
+    }
+    if (alloc_table[slot].ptr == NULL) {
+        return false;
+    }
+    *removed = alloc_table[slot];
+    line_counters[alloc_table[slot].tag].frees++;
+    live_bytes -= alloc_table[slot].size;
+    alloc_table_len--;
+    // Backward shift deletion, so lookups never need tombstones
+    size_t hole = slot, next = (slot + 1) & mask;
+    while (alloc_table[next].ptr != NULL) {
+        size_t home = alloc_slot(alloc_table[next].ptr);
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            alloc_table[hole] = alloc_table[next];
+            hole = next;
+        }
+        next = (next + 1) & mask;
+    }
+    alloc_table[hole].ptr = NULL;
+    return true;
+}
+
+void untrack_alloc(void *ptr) {
+    AllocEntry removed;
+    lock_alloc_stats();
+    remove_alloc_entry(ptr, &removed);
+    unlock_alloc_stats();
+}
+
+void *alloc_stats_malloc(size_t size, enum AllocTag tag, const char *file, int line) {
+    void *ptr = malloc(size);
+    if (is_alloc_stats_enabled) {
+        track_alloc(ptr, size, tag, file, line);
+    }
+    return ptr;
+}
+
+void *alloc_stats_calloc(size_t count, size_t size, enum AllocTag tag, const char *file,
+                         int line) {
+    void *ptr = calloc(count, size);
+    if (is_alloc_stats_enabled) {
+        track_alloc(ptr, count * size, tag, file, line);
+    }
+    return ptr;
+}
+
+void *alloc_stats_realloc(void *ptr, size_t size, enum AllocTag tag, const char *file,
+                          int line) {
+    if (!is_alloc_stats_enabled) {
+        return realloc(ptr, size);
+    }
+    // A realloc counts as a free of the old block and an allocation of the new
+    // one. The old block is forgotten first, another thread may be given its
+    // address as soon as it's freed.
+    AllocEntry old;
+    bool was_tracked = false;
+    if (ptr != NULL) {
+        lock_alloc_stats();
+        was_tracked = remove_alloc_entry(ptr, &old);
+        unlock_alloc_stats();
+    }
+    void *new_ptr = realloc(ptr, size);
+    if (new_ptr == NULL && size) {
+        // The old block is left as it was
+        if (was_tracked) {
+            lock_alloc_stats();
+            insert_alloc_entry(&old);
+            alloc_table_len++;
+            live_bytes += old.size;
+            line_counters[old.tag].frees--;
+            unlock_alloc_stats();
+        }
+        return NULL;
+    }
+    track_alloc(new_ptr, size, tag, file, line);
+    return new_ptr;
+}
+
+char *alloc_stats_strdup(const char *str, enum AllocTag tag, const char *file, int line) {
+    char *copy = strdup(str);
+    if (is_alloc_stats_enabled) {
+        track_alloc(copy, strlen(str) + 1, tag, file, line);
+    }
+    return copy;
+}
+
+char *alloc_stats_strndup(const char *str, size_t len, enum AllocTag tag, const char *file,
+                          int line) {
+    char *copy = strndup(str, len);
+    if (is_alloc_stats_enabled && copy != NULL) {
+        track_alloc(copy, strlen(copy) + 1, tag, file, line);
+    }
+    return copy;
+}
+
+void alloc_stats_free(void *ptr) {
+    if (is_alloc_stats_enabled && ptr != NULL) {
+        untrack_alloc(ptr);
+    }
+    free(ptr);
+}
+
+void report_line_allocs() {
+    if (!is_alloc_stats_enabled) {
+        return;
+    }
+    lock_alloc_stats();
+    AllocCounters total = {0, 0, 0};
+    char tags[256];
+    size_t len = 0;
+    unsigned int i;
+    for (i = 0; i < ALLOC_TAGS; i++) {
+        total.allocs += line_counters[i].allocs;
+        total.frees += line_counters[i].frees;
+        total.bytes += line_counters[i].bytes;
+        len += snprintf(tags + len, sizeof(tags) - len, " %s %lu/%lu", ALLOC_TAG_NAMES[i],
+                        line_counters[i].allocs, line_counters[i].frees);
+    }
+    bool over_budget = alloc_budget && total.allocs > alloc_budget;
+    lines_over_budget += over_budget;
+    fprintf(stderr, "alloc: %lu allocs, %lu frees, %zu bytes, %zu live |%s%s\n", total.allocs,
+            total.frees, total.bytes, live_bytes, tags, over_budget ? " | over budget" : "");
+    memset(line_counters, 0, sizeof(line_counters));
+    unlock_alloc_stats();
+}
+
+int compare_alloc_entries(const void *a, const void *b) {
+    const AllocEntry *first = a, *second = b;
+    int res = strcmp(first->file, second->file);
+    return res ? res : first->line - second->line;
+}
+
+bool report_outstanding_allocs() {
+    if (!is_alloc_stats_enabled) {
+        return false;
+    }
+    lock_alloc_stats();
+    AllocEntry *entries = malloc(sizeof(AllocEntry) * (alloc_table_len + 1));
+    size_t len = 0, i, sites = 0;
+    for (i = 0; i < alloc_table_size; i++) {
+        if (alloc_table[i].ptr != NULL) {
+            entries[len++] = alloc_table[i];
+        }
+    }
+    fprintf(stderr, "alloc: %zu allocations (%zu bytes) still live at exit\n", len, live_bytes);
+    qsort(entries, len, sizeof(AllocEntry), compare_alloc_entries);
+    for (i = 0; i < len && sites < ALLOC_REPORT_MAX_SITES;) {
+        size_t j, bytes = 0;
+        for (j = i; j < len && !compare_alloc_entries(&entries[i], &entries[j]); j++) {
+            bytes += entries[j].size;
+        }
+        fprintf(stderr, "  %-6s %s:%d %zu allocations, %zu bytes\n",
+                ALLOC_TAG_NAMES[entries[i].tag], entries[i].file, entries[i].line, j - i, bytes);
+        sites++;
+        i = j;
+    }
+    if (i < len) {
+        fprintf(stderr, "  ...\n");
+    }
+    if (lines_over_budget) {
+        fprintf(stderr, "alloc: %lu lines over the budget of %lu allocations\n",
+                lines_over_budget, alloc_budget);
+    }
+    free(entries);
+    unlock_alloc_stats();
+    return lines_over_budget > 0;
+}
@@ -0,0 +1,86 @@
+#ifndef LIB_ALLOC_STATS_H
+#define LIB_ALLOC_STATS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * With VSH_ALLOC_STATS=1 every allocation of the shell is accounted to the
+ * subsystem of the file making it. The allocs, frees and bytes of each line
+ * are reported on stderr after it ran, and the allocations still live at exit
+ * are listed by call site. With VSH_ALLOC_BUDGET=N a line making more than N
+ * allocations is reported as over budget, and the shell then exits with 1
+ * instead of 0.
+ *
+ * Each file includes this header and defines ALLOC_TAG after its includes,
+ * the macros below then route malloc and friends through the wrappers. When
+ * the mode is off they cost a branch.
+ */
+#define ALLOC_TABLE_INITIAL_SIZE 1024
+#define ALLOC_REPORT_MAX_SITES 20
+
+enum AllocTag {
+    ParserAlloc,
+    VecAlloc,
+    ExecAlloc,
+    StateAlloc,
+    ALLOC_TAGS,
+};
+
+typedef struct allocEntry {
+    void *ptr;
+    size_t size;
+    const char *file;
+    int line;
+    enum AllocTag tag;
+} AllocEntry;
+
+typedef struct allocCounters {
+    unsigned long allocs;
+    unsigned long frees;
+    size_t bytes;
+} AllocCounters;
+
+void init_alloc_stats();
+
+bool alloc_stats_enabled();
+
+void *alloc_stats_malloc(size_t size, enum AllocTag tag, const char *file, int line);
+
+void *alloc_stats_calloc(size_t count, size_t size, enum AllocTag tag, const char *file,
+                         int line);
+
+void *alloc_stats_realloc(void *ptr, size_t size, enum AllocTag tag, const char *file,
+                          int line);
+
+char *alloc_stats_strdup(const char *str, enum AllocTag tag, const char *file, int line);
+
+char *alloc_stats_strndup(const char *str, size_t len, enum AllocTag tag, const char *file,
+                          int line);
+
+void alloc_stats_free(void *ptr);
+
+/*
+ * Reports the allocations made since the previous report.
+ */
+void report_line_allocs();
+
+/*
+ * Lists the allocations still live, returns whether the budget was exceeded.
+ */
+bool report_outstanding_allocs();
+
+#ifndef ALLOC_STATS_IMPL
+#undef strdup
+#undef strndup
+#define malloc(size) alloc_stats_malloc(size, ALLOC_TAG, __FILE__, __LINE__)
+#define calloc(count, size) alloc_stats_calloc(count, size, ALLOC_TAG, __FILE__, __LINE__)
+#define realloc(ptr, size) alloc_stats_realloc(ptr, size, ALLOC_TAG, __FILE__, __LINE__)
+#define strdup(str) alloc_stats_strdup(str, ALLOC_TAG, __FILE__, __LINE__)
+#define strndup(str, len) alloc_stats_strndup(str, len, ALLOC_TAG, __FILE__, __LINE__)
+#define free(ptr) alloc_stats_free(ptr)
+#endif
+
+#endif
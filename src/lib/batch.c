@@ -0,0 +1,187 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "alloc_stats.h"
+#include "batch.h"
+#include "jobserver.h"
+#include "process.h"
+#include "util/string_util/string_util.h"
+
+#define ALLOC_TAG ExecAlloc
+
+extern char **environ;
+
+size_t arg_cost(char *arg) { return strlen(arg) + 1 + sizeof(char *); }
+
+size_t env_cost() {
+    size_t cost = sizeof(char *);
+    char **env;
+    for (env = environ; *env != NULL; env++) {
+        cost += arg_cost(*env);
+    }
+    return cost;
+}
+
+void batch_usage() {
+    fprintf(stderr, "usage: batch [-j N] [-q] cmd [fixed args...] [--] args...\n");
+}
+
+pid_t spawn_batch_chunk(char **fixed, unsigned int fixed_len, char **items,
+                        unsigned int items_len) {
+    char **argv = malloc(sizeof(char *) * (fixed_len + items_len + 1));
+    memcpy(argv, fixed, sizeof(char *) * fixed_len);
+    memcpy(argv + fixed_len, items, sizeof(char *) * items_len);
+    argv[fixed_len + items_len] = NULL;
+    pid_t pid = fork();
+    if (pid == 0) {
+        execvp(argv[0], argv);
+        fprintf(stderr, "batch: %s: %s\n", argv[0], strerror(errno));
+        _exit(errno == ENOENT ? 127 : 126);
+    } else if (pid == -1) {
+        perror("batch: fork failed");
+    }
+    free(argv);
+    return pid;
+}
+
+int batch_builtin(ShellState *state, ExecArgs *exec_args) {
+    (void) state;
+    char **argv = exec_args->argv;
+    unsigned int argc = exec_args->argc, i = 1, parallelism = 1;
+    bool quiet = false;
+    for (; i < argc && argv[i][0] == '-'; i++) {
+        if (str_equals(argv[i], "-q")) {
+            quiet = true;
+        } else if (!strncmp(argv[i], "-j", 2)) {
+            char *value = argv[i][2] ? argv[i] + 2 : (i + 1 < argc ? argv[++i] : "");
+            parallelism = strtoul(value, NULL, 10);
+            if (!parallelism) {
+                batch_usage();
+                return 2;
+            }
+        } else {
+            break;
+        }
+    }
+    if (i >= argc) {
+        batch_usage();
+        return 2;
+    }
+    char **fixed = argv + i;
+    unsigned int fixed_len = 1, j;
+    for (j = i + 1; j < argc; j++) {
+        if (str_equals(argv[j], "--")) {
+            fixed_len = j - i;
+            break;
+        }
+    }
+    unsigned int items_start = i + fixed_len + (j < argc);
+    char **items = argv + items_start;
+    unsigned int items_len = argc - items_start;
+
+    long arg_max = sysconf(_SC_ARG_MAX);
+    long available = (arg_max > 0 ? arg_max : 128 * 1024) - ARG_MAX_HEADROOM - (long) env_cost();
+    for (j = 0; j < fixed_len; j++) {
+        available -= (long) arg_cost(fixed[j]);
+    }
+    if (available <= 0) {
+        fprintf(stderr, "batch: the environment and fixed arguments already exceed ARG_MAX\n");
+        return 1;
+    }
+    // Chunk boundaries, chunk k holds items [starts[k], starts[k + 1])
+    unsigned int *starts = malloc(sizeof(unsigned int) * (items_len + 2));
+    unsigned int chunks = 0;
+    long used = available;
+    for (j = 0; j < items_len; j++) {
+        size_t cost = arg_cost(items[j]);
+        if ((long) cost > available || strlen(items[j]) + 1 > ARG_STRLEN_MAX) {
+            fprintf(stderr, "batch: argument %u is too long (%zu bytes)\n", j + 1,
+                    strlen(items[j]));
+            free(starts);
+            return 1;
+        }
+        if (used + (long) cost > available) {
+            starts[chunks++] = j;
+            used = 0;
+        }
+        used += (long) cost;
+    }
+    if (!chunks) {
+        // Without arguments the command still runs once, as xargs does
+        starts[chunks++] = 0;
+    }
+    starts[chunks] = items_len;
+
+    pid_t running[parallelism];
+    unsigned int running_chunk[parallelism];
+    int running_token[parallelism];
+    unsigned int next = 0, done = 0, failed = 0, running_count = 0;
+    int status = 0;
+    bool interrupted = false;
+    memset(running, 0, sizeof(running));
+    while ((next < chunks && !interrupted) || running_count) {
+        while (next < chunks && !interrupted && running_count < parallelism) {
+            // Each chunk takes a jobserver slot, without a free one the next
+            // chunk waits for a running one to finish. With none running, it
+            // waits for a slot.
+            int token = JOBSERVER_NO_TOKEN;
+            if (running_count && !jobserver_try_acquire(&token)) {
+                break;
+            }
+            if (!running_count && !jobserver_acquire(&token)) {
+                interrupted = true;
+                status = status ? status : 130;
+                break;
+            }
+            pid_t pid = spawn_batch_chunk(fixed, fixed_len, items + starts[next],
+                                          starts[next + 1] - starts[next]);
+            if (pid == -1) {
+                jobserver_release(token);
+                interrupted = true;
+                status = status ? status : 1;
+                break;
+            }
+            for (j = 0; j < parallelism && running[j]; j++);
+            running[j] = pid;
+            running_chunk[j] = next++;
+            running_token[j] = token;
+            running_count++;
+        }
+        if (!running_count) {
+            break;
+        }
+        int wait_status;
+        pid_t finished = 0;
+        unsigned int slot;
+        pid_t before[parallelism];
+        memcpy(before, running, sizeof(running));
+        finished = wait_any_child(running, parallelism, &wait_status);
+        for (slot = 0; slot < parallelism && before[slot] != finished; slot++);
+        jobserver_release(running_token[slot]);
+        running_count--;
+        done++;
+        unsigned int chunk = running_chunk[slot];
+        int code = exit_code_from_wait_status(wait_status);
+        if (code) {
+            failed++;
+            status = status ? status : code;
+        }
+        if (WIFSIGNALED(wait_status) && WTERMSIG(wait_status) == SIGINT) {
+            interrupted = true;
+        }
+        if (!quiet) {
+            fprintf(stderr, "batch: [%u/%u] chunk %u (%u args) exited %d\n", done, chunks,
+                    chunk + 1, starts[chunk + 1] - starts[chunk], code);
+        }
+    }
+    if (!quiet || interrupted) {
+        fprintf(stderr, "batch: %u/%u chunks run for %u args, %u failed%s\n", done, chunks,
+                items_len, failed, interrupted ? " (interrupted)" : "");
+    }
+    free(starts);
+    return status;
+}
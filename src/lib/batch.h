@@ -0,0 +1,18 @@
+#ifndef LIB_BATCH_H
+#define LIB_BATCH_H
+
+#include "lib.h"
+
+// Bytes kept free from ARG_MAX, as POSIX recommends for xargs
+#define ARG_MAX_HEADROOM 2048
+// Linux limit for a single argument (MAX_ARG_STRLEN)
+#define ARG_STRLEN_MAX (32 * 4096)
+
+/*
+ * batch [-j N] [-q] cmd [fixed args...] [--] args...
+ * Runs `cmd` as many times as needed so each invocation fits in ARG_MAX,
+ * counting both the argv and the environment bytes.
+ */
+int batch_builtin(ShellState *state, ExecArgs *exec_args);
+
+#endif
@@ -0,0 +1,176 @@
+#include <errno.h>
+#include <math.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#include "alloc_stats.h"
+#include "bench.h"
+#include "builtins.h"
+#include "path_cache.h"
+#include "process.h"
+#include "util/string_util/string_util.h"
+
+#define ALLOC_TAG ExecAlloc
+
+extern char **environ;
+
+bool parse_count(char *str, unsigned int *count) {
+    char *end;
+    unsigned long value = strtoul(str, &end, 10);
+    if (!*str || *end || str[0] == '-' || value > 1000000) {
+        return false;
+    }
+    *count = (unsigned int) value;
+    return true;
+}
+
+bool take_bench_prefix(ExecArgs *exec_args, BenchSpec *spec) {
+    char **argv = exec_args->argv;
+    unsigned int argc = exec_args->argc, i = 1;
+    if (!argc || !str_equals(argv[0], "bench")) {
+        return false;
+    }
+    BenchSpec parsed = {BENCH_DEFAULT_RUNS, BENCH_DEFAULT_WARMUP};
+    for (; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+        if (str_equals(argv[i], "-n")) {
+            if (!parse_count(argv[i + 1], &parsed.runs) || !parsed.runs) {
+                return false;
+            }
+        } else if (!str_equals(argv[i], "-w") || !parse_count(argv[i + 1], &parsed.warmup)) {
+            return false;
+        }
+    }
+    if (i >= argc) {
+        return false;
+    }
+    *spec = parsed;
+    unsigned int j;
+    for (j = 0; j < i; j++) {
+        free(argv[j]);
+    }
+    memmove(argv, argv + i, sizeof(char *) * (argc - i + 1));
+    exec_args->argc -= i;
+    take_launch_prefixes(&exec_args->attrs, exec_args->argv, &exec_args->argc);
+    return true;
+}
+
+bool can_bench_spawn(ExecArgs *exec_args) {
+    LaunchAttrs *attrs = &exec_args->attrs;
+    return exec_args->argc && exec_args->stdin_fd == -1 && exec_args->stdout_fd == -1 && find_builtin(exec_args) == NULL &&
+           !str_equals(exec_args->argv[0], "cd") && !str_equals(exec_args->argv[0], "exit") &&
+           !attrs->has_cpus && !attrs->has_nice && attrs->ioprio == -1 && !attrs->rlimits_len;
+}
+
+double timespec_diff_ns(struct timespec *start, struct timespec *end) {
+    return (double) (end->tv_sec - start->tv_sec) * 1e9 + (double) (end->tv_nsec - start->tv_nsec);
+}
+
+double timeval_ns(struct timeval *time) {
+    return (double) time->tv_sec * 1e9 + (double) time->tv_usec * 1e3;
+}
+
+bool bench_spawn_run(ExecArgs *exec_args, BenchRun *run) {
+    char *path = resolve_command_path(exec_args->argv[0]);
+    struct timespec start, end;
+    pid_t pid;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int error = path != NULL
+                ? posix_spawn(&pid, path, NULL, NULL, exec_args->argv, environ)
+                : posix_spawnp(&pid, exec_args->argv[0], NULL, NULL, exec_args->argv, environ);
+    if (error) {
+        fprintf(stderr, "bench: %s: %s\n", exec_args->argv[0], strerror(error));
+        run->exit_code = error == ENOENT ? UNKNOWN_COMMAND_EXIT_STATUS : 126;
+        return false;
+    }
+    int wait_status;
+    struct rusage usage;
+    if (wait_child_usage(pid, &wait_status, &usage) == -1) {
+        run->exit_code = LOST_CHILD_EXIT_STATUS;
+        return false;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    run->elapsed_ns = timespec_diff_ns(&start, &end);
+    run->user_ns = timeval_ns(&usage.ru_utime);
+    run->sys_ns = timeval_ns(&usage.ru_stime);
+    run->max_rss = usage.ru_maxrss;
+    run->exit_code = exit_code_from_wait_status(wait_status);
+    return true;
+}
+
+int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Nearest rank percentile of the sorted samples.
+ */
+double percentile(double *sorted, unsigned int len, double p) {
+    unsigned int rank = (unsigned int) ceil(p / 100 * len);
+    return sorted[rank ? rank - 1 : 0];
+}
+
+char *format_ns(double ns, char *buf, size_t size) {
+    if (ns < 1e3) {
+        snprintf(buf, size, "%.0f ns", ns);
+    } else if (ns < 1e6) {
+        snprintf(buf, size, "%.2f us", ns / 1e3);
+    } else if (ns < 1e9) {
+        snprintf(buf, size, "%.3f ms", ns / 1e6);
+    } else {
+        snprintf(buf, size, "%.3f s", ns / 1e9);
+    }
+    return buf;
+}
+
+void print_bench_report(char *name, BenchRun *runs, unsigned int len, unsigned int warmup) {
+    double *sorted = malloc(sizeof(double) * len);
+    double sum = 0, user = 0, sys = 0, variance = 0;
+    long max_rss = 0;
+    unsigned int i, failed = 0;
+    for (i = 0; i < len; i++) {
+        sorted[i] = runs[i].elapsed_ns;
+        sum += runs[i].elapsed_ns;
+        user += runs[i].user_ns;
+        sys += runs[i].sys_ns;
+        max_rss = runs[i].max_rss > max_rss ? runs[i].max_rss : max_rss;
+        failed += runs[i].exit_code != 0;
+    }
+    double mean = sum / len;
+    for (i = 0; i < len; i++) {
+        variance += (runs[i].elapsed_ns - mean) * (runs[i].elapsed_ns - mean);
+    }
+    double stddev = len > 1 ? sqrt(variance / (len - 1)) : 0;
+    qsort(sorted, len, sizeof(double), compare_doubles);
+    // Tukey's fences, beyond 1.5 interquartile ranges from the quartiles
+    double q1 = percentile(sorted, len, 25), q3 = percentile(sorted, len, 75);
+    double low_fence = q1 - 1.5 * (q3 - q1), high_fence = q3 + 1.5 * (q3 - q1);
+    unsigned int low_outliers = 0, high_outliers = 0;
+    for (i = 0; i < len; i++) {
+        low_outliers += sorted[i] < low_fence;
+        high_outliers += sorted[i] > high_fence;
+    }
+    char a[32], b[32], c[32], d[32], e[32];
+    printf("bench: %s (%u runs, %u warmup)\n", name, len, warmup);
+    printf("  mean   %s +- %s\n", format_ns(mean, a, 32), format_ns(stddev, b, 32));
+    printf("  min    %s  p50 %s  p95 %s  p99 %s  max %s\n", format_ns(sorted[0], a, 32),
+           format_ns(percentile(sorted, len, 50), b, 32),
+           format_ns(percentile(sorted, len, 95), c, 32),
+           format_ns(percentile(sorted, len, 99), d, 32),
+           format_ns(sorted[len - 1], e, 32));
+    printf("  user   %s  sys %s  max rss %ld KB\n", format_ns(user / len, a, 32),
+           format_ns(sys / len, b, 32), max_rss);
+    if (low_outliers || high_outliers) {
+        printf("  %u outliers (%u low, %u high), %.0f%% of the runs\n",
+               low_outliers + high_outliers, low_outliers, high_outliers,
+               100.0 * (low_outliers + high_outliers) / len);
+    }
+    if (failed) {
+        printf("  %u runs exited with a non zero status\n", failed);
+    }
+    free(sorted);
+}
@@ -0,0 +1,54 @@
+#ifndef LIB_BENCH_H
+#define LIB_BENCH_H
+
+#include <stdbool.h>
+#include <sys/resource.h>
+#include "lib.h"
+
+#define BENCH_DEFAULT_RUNS 10
+#define BENCH_DEFAULT_WARMUP 1
+
+/*
+ * `bench [-n RUNS] [-w WARMUP]` before the first command of a group runs the
+ * whole group WARMUP + RUNS times, only the last RUNS are measured.
+ */
+typedef struct benchSpec {
+    unsigned int runs;
+    unsigned int warmup;
+} BenchSpec;
+
+/*
+ * Time and resource usage of a single measured run.
+ */
+typedef struct benchRun {
+    double elapsed_ns;
+    double user_ns;
+    double sys_ns;
+    long max_rss;
+    int exit_code;
+} BenchRun;
+
+bool take_bench_prefix(ExecArgs *exec_args, BenchSpec *spec);
+
+/*
+ * Whether the command can be launched with posix_spawn instead of the
+ * handlers, which fork a full copy of the shell.
+ */
+bool can_bench_spawn(ExecArgs *exec_args);
+
+/*
+ * Spawns the command and waits for it, filling the run. Returns false when
+ * it couldn't be started (or waited), only the exit code of the run is set
+ * then.
+ */
+bool bench_spawn_run(ExecArgs *exec_args, BenchRun *run);
+
+double timespec_diff_ns(struct timespec *start, struct timespec *end);
+
+double timeval_ns(struct timeval *time);
+
+char *format_ns(double ns, char *buf, size_t size);
+
+void print_bench_report(char *name, BenchRun *runs, unsigned int len, unsigned int warmup);
+
+#endif
@@ -0,0 +1,36 @@
+#include <stddef.h>
+
+#include "batch.h"
+#include "builtins.h"
+#include "coproc.h"
+#include "jobs.h"
+#include "memo.h"
+#include "on_change.h"
+#include "options.h"
+#include "rlimits.h"
+#include "stats.h"
+#include "util/string_util/string_util.h"
+
+Builtin BUILTINS[] = {
+        {"batch",     batch_builtin},
+        {"coproc",    coproc_builtin},
+        {"jobs",      jobs_builtin},
+        {"memo",      memo_builtin},
+        {"on-change", on_change_builtin},
+        {"set",       set_builtin},
+        {"stats",     stats_builtin},
+        {"ulimit",    ulimit_builtin},
+};
+
+Builtin *find_builtin(ExecArgs *exec_args) {
+    if (exec_args->argc == 0) {
+        return NULL;
+    }
+    unsigned int i;
+    for (i = 0; i < sizeof(BUILTINS) / sizeof(Builtin); i++) {
+        if (str_equals(BUILTINS[i].name, exec_args->argv[0])) {
+            return &BUILTINS[i];
+        }
+    }
+    return NULL;
+}
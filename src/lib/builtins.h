@@ -0,0 +1,18 @@
+#ifndef LIB_BUILTINS_H
+#define LIB_BUILTINS_H
+
+#include "lib.h"
+
+/*
+ * Commands run by the shell itself, they receive the already expanded
+ * arguments and return their exit status.
+ */
+typedef struct builtin {
+    char *name;
+
+    int (*call)(ShellState *state, ExecArgs *exec_args);
+} Builtin;
+
+Builtin *find_builtin(ExecArgs *exec_args);
+
+#endif
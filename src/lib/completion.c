@@ -0,0 +1,518 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "alloc_stats.h"
+#include "completion.h"
+#include "util/string_util/string_util.h"
+#include "util/trie/trie.h"
+
+#define ALLOC_TAG StateAlloc
+
+/*
+ * Index of every executable available on PATH, built in background at startup
+ * (or on the first completion) and kept up to date by inotify events on the PATH directories.
+ */
+typedef struct pathIndex {
+    char *path_env;
+    Vec *dirs;
+    int *watches;
+    struct timespec *mtimes;
+    int inotify_fd;
+    Trie *trie;
+} PathIndex;
+
+/*
+ * Sorted entries of a directory, reused while the directory mtime doesn't
+ * change.
+ */
+typedef struct dirListing {
+    char *path;
+    struct timespec mtime;
+    unsigned long last_use;
+    unsigned int len;
+    char **names;
+    bool *is_dir;
+} DirListing;
+
+PathIndex *path_index = NULL;
+pthread_t path_index_thread;
+bool has_path_index_thread = false;
+DirListing *dir_cache[DIR_CACHE_SIZE];
+unsigned long dir_cache_clock = 0;
+
+bool is_dir_entry(int dir_fd, struct dirent *entry) {
+    if (entry->d_type == DT_DIR) {
+        return true;
+    }
+    if (entry->d_type != DT_LNK && entry->d_type != DT_UNKNOWN) {
+        return false;
+    }
+    struct stat st;
+    return fstatat(dir_fd, entry->d_name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+}
+
+bool is_executable_entry(int dir_fd, struct dirent *entry) {
+    if (entry->d_type == DT_DIR || is_dir_entry(dir_fd, entry)) {
+        return false;
+    }
+    return faccessat(dir_fd, entry->d_name, X_OK, 0) == 0;
+}
+
+bool is_executable_path(char *dir, char *name) {
+    char path[PATH_MAX];
+    struct stat st;
+    if (snprintf(path, sizeof(path), "%s/%s", dir, name) >= (int) sizeof(path)) {
+        return false;
+    }
+    return stat(path, &st) == 0 && !S_ISDIR(st.st_mode) && access(path, X_OK) == 0;
+}
+
+void path_index_scan_dir(PathIndex *self, unsigned int idx) {
+    char *dir_path = self->dirs->get(self->dirs, idx);
+    DIR *dir = opendir(dir_path);
+    if (dir == NULL) {
+        return;
+    }
+    int dir_fd = dirfd(dir);
+    struct stat st;
+    if (fstat(dir_fd, &st) == 0) {
+        self->mtimes[idx] = st.st_mtim;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.' &&
+            (entry->d_name[1] == '\0' || (entry->d_name[1] == '.' && entry->d_name[2] == '\0'))) {
+            continue;
+        }
+        if (is_executable_entry(dir_fd, entry)) {
+            self->trie->insert(self->trie, entry->d_name, idx);
+        }
+    }
+    closedir(dir);
+}
+
+void drop_path_index(PathIndex *self) {
+    unsigned int i;
+    for (i = 0; i < self->dirs->length; i++) {
+        free(self->dirs->get(self->dirs, i));
+    }
+    self->dirs->drop(self->dirs);
+    if (self->inotify_fd >= 0) {
+        close(self->inotify_fd);
+    }
+    free(self->watches);
+    free(self->mtimes);
+    free(self->path_env);
+    self->trie->drop(self->trie);
+    free(self);
+}
+
+PathIndex *new_path_index(char *path_env) {
+    PathIndex *self = malloc(sizeof(PathIndex));
+    self->path_env = strdup(path_env);
+    self->dirs = new_vec(sizeof(char *));
+    self->trie = new_trie();
+    char *path_copy = strdup(path_env);
+    char *save_ptr = NULL;
+    char *dir = strtok_r(path_copy, ":", &save_ptr);
+    while (dir != NULL) {
+        self->dirs->push(self->dirs, strdup(dir));
+        dir = strtok_r(NULL, ":", &save_ptr);
+    }
+    free(path_copy);
+    unsigned int len = self->dirs->length;
+    self->watches = malloc(sizeof(int) * (len ? len : 1));
+    self->mtimes = calloc(len ? len : 1, sizeof(struct timespec));
+    self->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    unsigned int i;
+    for (i = 0; i < len; i++) {
+        self->watches[i] = -1;
+        if (self->inotify_fd >= 0) {
+            self->watches[i] = inotify_add_watch(
+                    self->inotify_fd, self->dirs->get(self->dirs, i),
+                    IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB |
+                    IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+        }
+        path_index_scan_dir(self, i);
+    }
+    return self;
+}
+
+int path_index_dir_of_watch(PathIndex *self, int wd) {
+    unsigned int i;
+    for (i = 0; i < self->dirs->length; i++) {
+        if (self->watches[i] == wd) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void path_index_update_name(PathIndex *self, unsigned int idx, char *name) {
+    char *dir = self->dirs->get(self->dirs, idx);
+    if (is_executable_path(dir, name)) {
+        self->trie->insert(self->trie, name, idx);
+        return;
+    }
+    if (idx >= TRIE_MAX_SOURCE) {
+        // Directories past the mask width share a single bit
+        unsigned int i;
+        for (i = TRIE_MAX_SOURCE; i < self->dirs->length; i++) {
+            if (i != idx && is_executable_path(self->dirs->get(self->dirs, i), name)) {
+                return;
+            }
+        }
+    }
+    self->trie->remove(self->trie, name, idx);
+}
+
+/*
+ * Applies the pending inotify events, returning false when the index must be
+ * rebuilt (a PATH directory was removed/moved or the event queue overflowed).
+ */
+bool path_index_apply_events(PathIndex *self) {
+    char buffer[16 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+    while ((len = read(self->inotify_fd, buffer, sizeof(buffer))) > 0) {
+        char *ptr;
+        for (ptr = buffer; ptr < buffer + len;) {
+            struct inotify_event *event = (struct inotify_event *) ptr;
+            ptr += sizeof(struct inotify_event) + event->len;
+            if (event->mask & (IN_Q_OVERFLOW | IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+                return false;
+            }
+            int idx = path_index_dir_of_watch(self, event->wd);
+            if (idx < 0 || !event->len || (event->mask & IN_ISDIR)) {
+                continue;
+            }
+            path_index_update_name(self, idx, event->name);
+        }
+    }
+    return true;
+}
+
+/*
+ * Without inotify the directories are checked by mtime and the index is
+ * rebuilt when any of them changed.
+ */
+void path_index_check_mtimes(PathIndex *self) {
+    unsigned int i;
+    bool changed = false;
+    struct stat st;
+    for (i = 0; i < self->dirs->length; i++) {
+        if (stat(self->dirs->get(self->dirs, i), &st) == 0 &&
+            (st.st_mtim.tv_sec != self->mtimes[i].tv_sec ||
+             st.st_mtim.tv_nsec != self->mtimes[i].tv_nsec)) {
+            changed = true;
+            break;
+        }
+    }
+    if (changed) {
+        char *path_env = strdup(self->path_env);
+        drop_path_index(path_index);
+        path_index = new_path_index(path_env);
+        free(path_env);
+    }
+}
+
+void *build_path_index(void *path_env) {
+    PathIndex *index = new_path_index(path_env);
+    free(path_env);
+    return index;
+}
+
+void start_path_index() {
+    char *path_env = getenv("PATH");
+    if (has_path_index_thread || path_index != NULL) {
+        return;
+    }
+    char *path_copy = strdup(path_env != NULL ? path_env : "");
+    if (pthread_create(&path_index_thread, NULL, build_path_index, path_copy) != 0) {
+        free(path_copy);
+        return;
+    }
+    has_path_index_thread = true;
+}
+
+/*
+ * Takes the index built in background, waiting for it if it's not done yet.
+ */
+void join_path_index() {
+    if (has_path_index_thread) {
+        void *built = NULL;
+        pthread_join(path_index_thread, &built);
+        has_path_index_thread = false;
+        path_index = built;
+    }
+}
+
+Trie *path_executables() {
+    char *path_env = getenv("PATH");
+    if (path_env == NULL) {
+        path_env = "";
+    }
+    join_path_index();
+    if (path_index != NULL && !str_equals(path_index->path_env, path_env)) {
+        drop_path_index(path_index);
+        path_index = NULL;
+    }
+    if (path_index == NULL) {
+        path_index = new_path_index(path_env);
+    } else if (path_index->inotify_fd < 0) {
+        path_index_check_mtimes(path_index);
+    } else if (!path_index_apply_events(path_index)) {
+        drop_path_index(path_index);
+        path_index = new_path_index(path_env);
+    }
+    return path_index->trie;
+}
+
+void drop_dir_listing(DirListing *self) {
+    unsigned int i;
+    for (i = 0; i < self->len; i++) {
+        free(self->names[i]);
+    }
+    free(self->names);
+    free(self->is_dir);
+    free(self->path);
+    free(self);
+}
+
+int cmp_str_ptr(const void *a, const void *b) {
+    return strcmp(*(char **) a, *(char **) b);
+}
+
+DirListing *new_dir_listing(char *path, struct timespec mtime) {
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        return NULL;
+    }
+    int dir_fd = dirfd(dir);
+    Vec *names = new_vec(sizeof(char *));
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (str_equals(entry->d_name, ".") || str_equals(entry->d_name, "..")) {
+            continue;
+        }
+        size_t name_len = strlen(entry->d_name);
+        // The directory flag is stored right after the name terminator
+        char *name = malloc(name_len + 2);
+        memcpy(name, entry->d_name, name_len + 1);
+        name[name_len + 1] = (char) is_dir_entry(dir_fd, entry);
+        names->push(names, name);
+    }
+    closedir(dir);
+    DirListing *self = malloc(sizeof(DirListing));
+    self->path = strdup(path);
+    self->mtime = mtime;
+    self->last_use = 0;
+    self->len = names->length;
+    self->names = (char **) names->take_arr(names);
+    self->is_dir = malloc(sizeof(bool) * (self->len ? self->len : 1));
+    qsort(self->names, self->len, sizeof(char *), cmp_str_ptr);
+    unsigned int i;
+    for (i = 0; i < self->len; i++) {
+        self->is_dir[i] = self->names[i][strlen(self->names[i]) + 1];
+    }
+    return self;
+}
+
+DirListing *dir_listing(char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        return NULL;
+    }
+    int i, free_slot = -1, lru_slot = -1;
+    for (i = 0; i < DIR_CACHE_SIZE; i++) {
+        DirListing *listing = dir_cache[i];
+        if (listing == NULL) {
+            free_slot = free_slot < 0 ? i : free_slot;
+            continue;
+        }
+        if (str_equals(listing->path, path)) {
+            if (listing->mtime.tv_sec == st.st_mtim.tv_sec &&
+                listing->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+                listing->last_use = ++dir_cache_clock;
+                return listing;
+            }
+            drop_dir_listing(listing);
+            dir_cache[i] = NULL;
+            free_slot = i;
+            break;
+        }
+        if (lru_slot < 0 || listing->last_use < dir_cache[lru_slot]->last_use) {
+            lru_slot = i;
+        }
+    }
+    if (free_slot < 0) {
+        drop_dir_listing(dir_cache[lru_slot]);
+        dir_cache[lru_slot] = NULL;
+        free_slot = lru_slot;
+    }
+    DirListing *listing = new_dir_listing(path, st.st_mtim);
+    if (listing != NULL) {
+        listing->last_use = ++dir_cache_clock;
+        dir_cache[free_slot] = listing;
+    }
+    return listing;
+}
+
+void drop_completion_cache() {
+    int i;
+    for (i = 0; i < DIR_CACHE_SIZE; i++) {
+        if (dir_cache[i] != NULL) {
+            drop_dir_listing(dir_cache[i]);
+            dir_cache[i] = NULL;
+        }
+    }
+    join_path_index();
+    if (path_index != NULL) {
+        drop_path_index(path_index);
+        path_index = NULL;
+    }
+}
+
+void drop_completion_res(CompletionRes *self) {
+    unsigned int i;
+    for (i = 0; i < self->matches->length; i++) {
+        free(self->matches->get(self->matches, i));
+    }
+    self->matches->drop(self->matches);
+    free(self->insertion);
+    free(self);
+}
+
+CompletionRes *new_completion_res() {
+    CompletionRes *self = malloc(sizeof(CompletionRes));
+    self->insertion = NULL;
+    self->matches = new_vec(sizeof(char *));
+    self->total = 0;
+    self->drop = drop_completion_res;
+    return self;
+}
+
+char *str_common_prefix(char *common, char *other) {
+    size_t i = 0;
+    while (common[i] && common[i] == other[i]) {
+        i++;
+    }
+    common[i] = '\0';
+    return common;
+}
+
+void complete_command(CompletionRes *res, char *word) {
+    Trie *trie = path_executables();
+    TrieNode *node = trie->find(trie, word);
+    if (node == NULL) {
+        res->insertion = strdup("");
+        return;
+    }
+    res->total = trie_node_collect(node, word, res->matches, COMPLETION_LIST_LIMIT);
+    char *suffix = trie_node_common_suffix(node);
+    if (res->total == 1) {
+        size_t len = strlen(suffix);
+        suffix = realloc(suffix, len + 2);
+        suffix[len] = ' ';
+        suffix[len + 1] = '\0';
+    }
+    res->insertion = suffix;
+}
+
+void complete_path(CompletionRes *res, char *word, bool only_executables) {
+    char dir_path[PATH_MAX];
+    char *base = strrchr(word, '/');
+    char *prefix = base != NULL ? base + 1 : word;
+    size_t dir_len = base != NULL ? base - word + 1 : 0;
+    char *home = getenv("HOME");
+    if (dir_len == 0) {
+        strcpy(dir_path, ".");
+    } else if (word[0] == '~' && word[1] == '/' && home != NULL) {
+        snprintf(dir_path, sizeof(dir_path), "%s/%.*s", home, (int) dir_len - 2, word + 2);
+    } else {
+        snprintf(dir_path, sizeof(dir_path), "%.*s", (int) dir_len, word);
+    }
+    DirListing *listing = dir_listing(dir_path);
+    if (listing == NULL) {
+        res->insertion = strdup("");
+        return;
+    }
+    size_t prefix_len = strlen(prefix);
+    // Binary search the first entry that is not lower than the prefix
+    unsigned int low = 0, high = listing->len;
+    while (low < high) {
+        unsigned int mid = (low + high) >> 1;
+        if (strncmp(listing->names[mid], prefix, prefix_len) < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    char *common = NULL;
+    bool last_is_dir = false;
+    unsigned int i;
+    for (i = low; i < listing->len && !strncmp(listing->names[i], prefix, prefix_len); i++) {
+        char *name = listing->names[i];
+        if (name[0] == '.' && prefix[0] != '.') {
+            continue;
+        }
+        if (only_executables && !listing->is_dir[i] && !is_executable_path(dir_path, name)) {
+            continue;
+        }
+        res->total += 1;
+        if (res->matches->length < COMPLETION_LIST_LIMIT) {
+            size_t len = strlen(name);
+            char *match = malloc(len + 2);
+            memcpy(match, name, len);
+            match[len] = listing->is_dir[i] ? '/' : '\0';
+            match[len + 1] = '\0';
+            res->matches->push(res->matches, match);
+        }
+        common = common == NULL ? strdup(name + prefix_len) : str_common_prefix(common, name + prefix_len);
+        last_is_dir = listing->is_dir[i];
+    }
+    if (common == NULL) {
+        res->insertion = strdup("");
+        return;
+    }
+    if (res->total == 1) {
+        size_t len = strlen(common);
+        common = realloc(common, len + 2);
+        common[len] = last_is_dir ? '/' : ' ';
+        common[len + 1] = '\0';
+    }
+    res->insertion = common;
+}
+
+/*
+ * Completes the word that ends at the cursor, the first word of a command is
+ * completed with the PATH executables and the others with directory entries.
+ */
+CompletionRes *complete_line(char *line, unsigned int cursor) {
+    CompletionRes *res = new_completion_res();
+    unsigned int start = cursor;
+    while (start > 0 && line[start - 1] != ' ' && line[start - 1] != '"') {
+        start--;
+    }
+    unsigned int before = start;
+    while (before > 0 && line[before - 1] == ' ') {
+        before--;
+    }
+    bool is_command = before == 0 || line[before - 1] == '|' || line[before - 1] == '&';
+    char word[PATH_MAX];
+    snprintf(word, sizeof(word), "%.*s", cursor - start, line + start);
+    if (is_command && strchr(word, '/') == NULL) {
+        complete_command(res, word);
+    } else {
+        complete_path(res, word, is_command);
+    }
+    return res;
+}
@@ -0,0 +1,36 @@
+#ifndef LIB_COMPLETION_H
+#define LIB_COMPLETION_H
+
+#include <stdbool.h>
+#include "util/vec/vec.h"
+
+/*
+ * Maximum amount of candidates gathered to be listed, the total amount of
+ * candidates is still reported so huge listings don't cost anything.
+ */
+#define COMPLETION_LIST_LIMIT 256
+#define DIR_CACHE_SIZE 16
+
+typedef struct completionRes {
+    // Text that should be inserted at the cursor position
+    char *insertion;
+    // Candidates (without the already typed prefix) when it's ambiguous
+    Vec *matches;
+    unsigned int total;
+
+    void (*drop)(struct completionRes *self);
+} CompletionRes;
+
+CompletionRes *complete_line(char *line, unsigned int cursor);
+
+void drop_completion_res(CompletionRes *self);
+
+/*
+ * Starts building the index of the PATH executables in background, so the
+ * first completion doesn't scan every PATH directory.
+ */
+void start_path_index();
+
+void drop_completion_cache();
+
+#endif
@@ -0,0 +1,171 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "alloc_stats.h"
+#include "coproc.h"
+#include "util/string_util/string_util.h"
+
+#define ALLOC_TAG ExecAlloc
+
+Coproc *find_coproc(ShellState *state, char *name) {
+    unsigned int i;
+    for (i = 0; i < state->coprocs->length; i++) {
+        Coproc *coproc = state->coprocs->get(state->coprocs, i);
+        if (str_equals(coproc->name, name)) {
+            return coproc;
+        }
+    }
+    return NULL;
+}
+
+int coproc_fd(ShellState *state, char *name, unsigned int index) {
+    Coproc *coproc = state != NULL ? find_coproc(state, name) : NULL;
+    if (coproc == NULL || index > 1) {
+        return -1;
+    }
+    return index ? coproc->write_fd : coproc->read_fd;
+}
+
+/*
+ * Waits for the coproc up to the grace time, returns whether it was reaped.
+ */
+bool reap_coproc(Coproc *coproc) {
+    unsigned int waited;
+    for (waited = 0; waited < COPROC_EXIT_GRACE_MS; waited += 10) {
+        pid_t reaped = waitpid(coproc->pid, NULL, WNOHANG);
+        if (reaped == coproc->pid || (reaped == -1 && errno != EINTR)) {
+            return true;
+        }
+        usleep(10000);
+    }
+    return false;
+}
+
+void close_coproc(Coproc *coproc) {
+    // The helper reads EOF, most of them leave then
+    close(coproc->write_fd);
+    close(coproc->read_fd);
+    if (!reap_coproc(coproc)) {
+        kill(coproc->pid, SIGTERM);
+        if (!reap_coproc(coproc)) {
+            kill(coproc->pid, SIGKILL);
+            waitpid(coproc->pid, NULL, 0);
+        }
+    }
+    free(coproc->name);
+    free(coproc);
+}
+
+void drop_coprocs(ShellState *state) {
+    unsigned int i;
+    for (i = 0; i < state->coprocs->length; i++) {
+        close_coproc(state->coprocs->get(state->coprocs, i));
+    }
+    state->coprocs->drop(state->coprocs);
+    state->coprocs = NULL;
+}
+
+void list_coprocs(ShellState *state) {
+    unsigned int i;
+    for (i = 0; i < state->coprocs->length; i++) {
+        Coproc *coproc = state->coprocs->get(state->coprocs, i);
+        bool is_running = waitpid(coproc->pid, NULL, WNOHANG) == 0;
+        printf("%s\t%d\t%s\tread %d write %d\n", coproc->name, coproc->pid,
+               is_running ? "running" : "done", coproc->read_fd, coproc->write_fd);
+    }
+}
+
+int coproc_builtin(ShellState *state, ExecArgs *exec_args) {
+    char **argv = exec_args->argv;
+    if (exec_args->argc == 1) {
+        list_coprocs(state);
+        return 0;
+    }
+    if (exec_args->argc < 3) {
+        fprintf(stderr, "usage: coproc [NAME cmd [args...]]\n");
+        return 2;
+    }
+    char *name = argv[1];
+    Coproc *previous = find_coproc(state, name);
+    if (previous != NULL && waitpid(previous->pid, NULL, WNOHANG) == 0) {
+        fprintf(stderr, "coproc: %s is still running (pid %d)\n", name, previous->pid);
+        return 1;
+    }
+    int to_coproc[2], from_coproc[2];
+    if (pipe2(to_coproc, O_CLOEXEC) == -1) {
+        perror("coproc: pipe failed");
+        return 1;
+    }
+    // The errno of a failed exec, the pipe is closed without a byte otherwise
+    int exec_status[2];
+    if (pipe2(from_coproc, O_CLOEXEC) == -1) {
+        perror("coproc: pipe failed");
+        close(to_coproc[0]);
+        close(to_coproc[1]);
+        return 1;
+    }
+    if (pipe2(exec_status, O_CLOEXEC) == -1) {
+        perror("coproc: pipe failed");
+        close(to_coproc[0]);
+        close(to_coproc[1]);
+        close(from_coproc[0]);
+        close(from_coproc[1]);
+        return 1;
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        setpgid(0, 0);
+        dup2(to_coproc[0], STDIN_FILENO);
+        dup2(from_coproc[1], STDOUT_FILENO);
+        execvp(argv[2], argv + 2);
+        int error = errno;
+        write(exec_status[1], &error, sizeof(error));
+        _exit(error == ENOENT ? 127 : 126);
+    }
+    close(to_coproc[0]);
+    close(from_coproc[1]);
+    close(exec_status[1]);
+    int error = 0;
+    if (pid != -1) {
+        while (read(exec_status[0], &error, sizeof(error)) == -1 && errno == EINTR);
+    }
+    close(exec_status[0]);
+    if (pid == -1 || error) {
+        if (pid == -1) {
+            perror("coproc: fork failed");
+        } else {
+            fprintf(stderr, "coproc: %s: %s\n", argv[2], strerror(error));
+            while (waitpid(pid, NULL, 0) == -1 && errno == EINTR);
+        }
+        close(to_coproc[1]);
+        close(from_coproc[0]);
+        return pid == -1 ? 1 : error == ENOENT ? 127 : 126;
+    }
+    setpgid(pid, pid);
+    Coproc *coproc = previous;
+    if (coproc != NULL) {
+        // Its last run already exited, only the pipes are left
+        close(coproc->write_fd);
+        close(coproc->read_fd);
+        waitpid(coproc->pid, NULL, WNOHANG);
+    } else {
+        coproc = malloc(sizeof(Coproc));
+        coproc->name = strdup(name);
+        state->coprocs->push(state->coprocs, coproc);
+    }
+    coproc->pid = pid;
+    coproc->read_fd = from_coproc[0];
+    coproc->write_fd = to_coproc[1];
+    char pid_name[strlen(name) + 5], pid_value[16];
+    sprintf(pid_name, "%s_PID", name);
+    sprintf(pid_value, "%d", pid);
+    setenv(pid_name, pid_value, 1);
+    printf("[coproc %s] %d\n", name, pid);
+    return 0;
+}
@@ -0,0 +1,38 @@
+#ifndef LIB_COPROC_H
+#define LIB_COPROC_H
+
+#include "lib.h"
+
+// Time a coproc gets to exit once its stdin is closed, then after SIGTERM
+#define COPROC_EXIT_GRACE_MS 1000
+
+/*
+ * `coproc NAME cmd` starts a helper once, talking to it through a pair of
+ * pipes the shell keeps open: `${NAME[0]}` reads what it writes and
+ * `${NAME[1]}` writes to its stdin, so later lines use it with
+ * `cmd >&${NAME[1]}` and `cmd <&${NAME[0]}`. Its pid is exported as
+ * NAME_PID. It runs in its own process group, away from the interrupts of
+ * the foreground commands, until the shell exits.
+ */
+typedef struct coproc {
+    char *name;
+    pid_t pid;
+    // The helper's stdout and stdin, both close-on-exec in the shell
+    int read_fd;
+    int write_fd;
+} Coproc;
+
+int coproc_builtin(ShellState *state, ExecArgs *exec_args);
+
+/*
+ * The file descriptor `${NAME[index]}` stands for, -1 when there is none.
+ */
+int coproc_fd(ShellState *state, char *name, unsigned int index);
+
+/*
+ * Closes the pipes of every coproc and reaps them, the ones still running
+ * after COPROC_EXIT_GRACE_MS are sent SIGTERM and then SIGKILL.
+ */
+void drop_coprocs(ShellState *state);
+
+#endif
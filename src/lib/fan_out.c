@@ -0,0 +1,126 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "alloc_stats.h"
+#include "fan_out.h"
+
+#define ALLOC_TAG ExecAlloc
+
+void drop_sink(int *sinks, bool *is_open, int staging_fd, int devnull, unsigned int k) {
+    // Whatever the consumer didn't take is discarded
+    while (splice(staging_fd, NULL, devnull, NULL, FAN_OUT_CHUNK, SPLICE_F_NONBLOCK) > 0);
+    close(sinks[k]);
+    is_open[k] = false;
+}
+
+/*
+ * Splices the staged round into every open sink, waiting on the full ones.
+ */
+unsigned int drain_staging(int *sinks, int (*staging)[2], bool *is_open, size_t *pending,
+                           unsigned int len, int devnull) {
+    unsigned int open_count = 0, k;
+    struct pollfd fds[len];
+    for (;;) {
+        unsigned int waiting = 0;
+        for (k = 0; k < len; k++) {
+            if (!is_open[k] || !pending[k]) {
+                continue;
+            }
+            ssize_t moved = splice(staging[k][0], NULL, sinks[k], NULL, pending[k],
+                                   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (moved > 0) {
+                pending[k] -= moved;
+            } else if (moved == -1 && errno != EAGAIN && errno != EINTR) {
+                drop_sink(sinks, is_open, staging[k][0], devnull, k);
+                continue;
+            }
+            if (pending[k]) {
+                fds[waiting++] = (struct pollfd) {sinks[k], POLLOUT, 0};
+            }
+        }
+        if (!waiting) {
+            break;
+        }
+        poll(fds, waiting, -1);
+    }
+    for (k = 0; k < len; k++) {
+        open_count += is_open[k];
+    }
+    return open_count;
+}
+
+void fan_out(int source, int *sinks, unsigned int len) {
+    int staging[len][2], devnull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    bool is_open[len];
+    size_t pending[len];
+    unsigned int open_count = len, k;
+    int source_size = fcntl(source, F_GETPIPE_SZ);
+    // Splicing into a consumer that exited has to fail with EPIPE instead
+    void (*previous_handler)(int) = signal(SIGPIPE, SIG_IGN);
+    for (k = 0; k < len; k++) {
+        if (pipe2(staging[k], O_CLOEXEC) == -1) {
+            perror("fan-out: pipe failed");
+            staging[k][0] = staging[k][1] = -1;
+            close(sinks[k]);
+            is_open[k] = false;
+            open_count--;
+            continue;
+        }
+        if (source_size > 0) {
+            fcntl(staging[k][1], F_SETPIPE_SZ, source_size);
+        }
+        fcntl(sinks[k], F_SETFL, fcntl(sinks[k], F_GETFL) | O_NONBLOCK);
+        is_open[k] = true;
+    }
+    while (open_count) {
+        unsigned int first;
+        for (first = 0; !is_open[first]; first++);
+        // Blocks until the producer wrote something, without consuming it
+        ssize_t round = tee(source, staging[first][1], FAN_OUT_CHUNK, 0);
+        if (round == -1 && errno == EINTR) {
+            continue;
+        }
+        if (round <= 0) {
+            break;
+        }
+        for (k = 0; k < len; k++) {
+            pending[k] = 0;
+            if (!is_open[k]) {
+                continue;
+            }
+            // The staging pipe is empty and as large as the source, the round always fits
+            ssize_t copied = k == first ? round : tee(source, staging[k][1], round, 0);
+            if (copied != round) {
+                fprintf(stderr, "fan-out: consumer %u dropped, its copy was cut short\n", k + 1);
+                drop_sink(sinks, is_open, staging[k][0], devnull, k);
+                continue;
+            }
+            pending[k] = round;
+        }
+        ssize_t consumed = 0;
+        while (consumed < round) {
+            ssize_t moved = splice(source, NULL, devnull, NULL, round - consumed, SPLICE_F_MOVE);
+            if (moved <= 0 && errno != EINTR) {
+                break;
+            }
+            consumed += moved > 0 ? moved : 0;
+        }
+        open_count = drain_staging(sinks, staging, is_open, pending, len, devnull);
+    }
+    for (k = 0; k < len; k++) {
+        if (is_open[k]) {
+            close(sinks[k]);
+        }
+        if (staging[k][0] != -1) {
+            close(staging[k][0]);
+            close(staging[k][1]);
+        }
+    }
+    close(devnull);
+    signal(SIGPIPE, previous_handler);
+}
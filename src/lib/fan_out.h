@@ -0,0 +1,22 @@
+#ifndef LIB_FAN_OUT_H
+#define LIB_FAN_OUT_H
+
+// Most the source is duplicated per round
+#define FAN_OUT_CHUNK (64 * 1024)
+
+/*
+ * `producer |& { c1, c2, c3 }` gives each consumer a copy of the producer's
+ * output. Each round the data waiting in the source pipe is duplicated with
+ * tee(2) into one staging pipe per consumer (all empty and as large as the
+ * source, so the whole round fits), consumed from the source by a splice(2)
+ * to /dev/null, and spliced from each staging pipe into its consumer. Only
+ * page references move, the bytes never reach user space.
+ *
+ * The next round starts once every consumer took the current one, so the
+ * slowest consumer holds the producer back. A consumer that exits is dropped,
+ * and the source is only closed (the producer getting SIGPIPE) once all of
+ * them are gone.
+ */
+void fan_out(int source, int *sinks, unsigned int len);
+
+#endif
@@ -0,0 +1,437 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "alloc_stats.h"
+#include "glob_expand.h"
+#include "util/string_util/string_util.h"
+
+#define ALLOC_TAG ParserAlloc
+
+struct linuxDirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+/*
+ * Whether a `]` closes the class opened at `open` within the same word, a
+ * lone `[` as in `[ -f file ]` is taken literally.
+ */
+bool is_glob_class(char *str, size_t open, size_t len) {
+    size_t i;
+    bool negated = open + 1 < len && (str[open + 1] == '!' || str[open + 1] == '^');
+    for (i = open + 1; i < len && str[i] != ' ' && str[i] != '\t'; i++) {
+        // The first member can be `]` itself, as in `[]a]`
+        if (str[i] == ']' && i > open + 1 + negated) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool has_glob_chars_len(char *str, size_t len) {
+    size_t i;
+    for (i = 0; i < len; i++) {
+        if (str[i] == '\\' && i + 1 < len) {
+            i++;
+        } else if (str[i] == '*' || str[i] == '?' || (str[i] == '[' && is_glob_class(str, i, len))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool has_glob_chars(char *str) { return has_glob_chars_len(str, strlen(str)); }
+
+void glob_class_set(GlobOp *op, unsigned char c) { op->class_bits[c >> 3] |= 1 << (c & 7); }
+
+bool glob_class_has(GlobOp *op, unsigned char c) {
+    return ((op->class_bits[c >> 3] >> (c & 7)) & 1) != op->negated;
+}
+
+/*
+ * Parses a bracket expression starting at `pattern[*i] == '['`, returning
+ * false when it isn't closed (the '[' is then a literal).
+ */
+bool compile_glob_class(GlobOp *op, char *pattern, size_t len, size_t *i) {
+    size_t j = *i + 1;
+    memset(op->class_bits, 0, sizeof(op->class_bits));
+    op->negated = false;
+    if (j < len && (pattern[j] == '!' || pattern[j] == '^')) {
+        op->negated = true;
+        j++;
+    }
+    size_t first = j;
+    for (; j < len && (pattern[j] != ']' || j == first); j++) {
+        unsigned char c = (unsigned char) pattern[j];
+        if (c == '\\' && j + 1 < len) {
+            c = (unsigned char) pattern[++j];
+        }
+        if (j + 2 < len && pattern[j + 1] == '-' && pattern[j + 2] != ']') {
+            unsigned char end = (unsigned char) pattern[j + 2];
+            unsigned int k;
+            for (k = c; k <= end; k++) {
+                glob_class_set(op, (unsigned char) k);
+            }
+            j += 2;
+        } else {
+            glob_class_set(op, c);
+        }
+    }
+    if (j >= len) {
+        return false;
+    }
+    op->type = GlobClass;
+    *i = j;
+    return true;
+}
+
+GlobPattern *compile_glob_pattern(char *pattern, size_t len) {
+    GlobPattern *self = malloc(sizeof(GlobPattern));
+    self->ops = malloc(sizeof(GlobOp) * (len ? len : 1));
+    self->len = 0;
+    self->match_hidden = len && pattern[0] == '.';
+    self->match = glob_pattern_match;
+    self->drop = drop_glob_pattern;
+    char *literal = malloc(len + 1);
+    size_t literal_len = 0, i;
+    for (i = 0; i < len; i++) {
+        char c = pattern[i];
+        GlobOp op;
+        op.literal = NULL;
+        op.literal_len = 0;
+        bool is_special = true;
+        if (c == '*') {
+            op.type = GlobAnyString;
+        } else if (c == '?') {
+            op.type = GlobAnyChar;
+        } else if (c != '[' || !compile_glob_class(&op, pattern, len, &i)) {
+            is_special = false;
+            if (c == '\\' && i + 1 < len) {
+                c = pattern[++i];
+            }
+            literal[literal_len++] = c;
+        }
+        if (!is_special) {
+            continue;
+        }
+        if (literal_len) {
+            GlobOp *literal_op = &self->ops[self->len++];
+            literal_op->type = GlobLiteral;
+            literal_op->literal = strndup(literal, literal_len);
+            literal_op->literal_len = literal_len;
+            literal_len = 0;
+        }
+        // Consecutive stars are the same as a single one
+        if (op.type == GlobAnyString && self->len &&
+            self->ops[self->len - 1].type == GlobAnyString) {
+            continue;
+        }
+        self->ops[self->len++] = op;
+    }
+    if (literal_len) {
+        GlobOp *literal_op = &self->ops[self->len++];
+        literal_op->type = GlobLiteral;
+        literal_op->literal = strndup(literal, literal_len);
+        literal_op->literal_len = literal_len;
+    }
+    free(literal);
+    return self;
+}
+
+void drop_glob_pattern(GlobPattern *self) {
+    unsigned int i;
+    for (i = 0; i < self->len; i++) {
+        free(self->ops[i].literal);
+    }
+    free(self->ops);
+    free(self);
+}
+
+/*
+ * Iterative matching that only backtracks to the last star seen, so it never
+ * goes exponential on patterns like `*a*a*a*b`.
+ */
+bool glob_pattern_match(GlobPattern *self, const char *str) {
+    if (str[0] == '.' && !self->match_hidden) {
+        return false;
+    }
+    unsigned int op_idx = 0;
+    int star_op = -1;
+    const char *star_str = NULL;
+    while (*str || op_idx < self->len) {
+        if (op_idx < self->len) {
+            GlobOp *op = &self->ops[op_idx];
+            switch (op->type) {
+                case GlobAnyString:
+                    star_op = (int) op_idx++;
+                    star_str = str;
+                    continue;
+                case GlobAnyChar:
+                    if (*str) {
+                        op_idx++;
+                        str++;
+                        continue;
+                    }
+                    break;
+                case GlobClass:
+                    if (*str && glob_class_has(op, (unsigned char) *str)) {
+                        op_idx++;
+                        str++;
+                        continue;
+                    }
+                    break;
+                case GlobLiteral:
+                    if (!strncmp(str, op->literal, op->literal_len)) {
+                        op_idx++;
+                        str += op->literal_len;
+                        continue;
+                    }
+                    break;
+            }
+        }
+        if (star_op >= 0 && *star_str) {
+            str = ++star_str;
+            op_idx = star_op + 1;
+            continue;
+        }
+        return false;
+    }
+    return true;
+}
+
+void drop_dir_snapshot(DirSnapshot *self) {
+    free(self->path);
+    free(self->names);
+    free(self->offsets);
+    free(self->types);
+    free(self);
+}
+
+void dir_snapshot_push(DirSnapshot *self, char *name, unsigned char type) {
+    size_t name_len = strlen(name) + 1;
+    if (self->names_len + name_len > self->names_cap) {
+        while (self->names_len + name_len > self->names_cap) {
+            self->names_cap <<= 1;
+        }
+        self->names = realloc(self->names, self->names_cap);
+    }
+    if (self->len == self->cap) {
+        self->cap <<= 1;
+        self->offsets = realloc(self->offsets, sizeof(unsigned int) * self->cap);
+        self->types = realloc(self->types, sizeof(unsigned char) * self->cap);
+    }
+    memcpy(self->names + self->names_len, name, name_len);
+    self->offsets[self->len] = self->names_len;
+    self->types[self->len] = type;
+    self->names_len += name_len;
+    self->len += 1;
+}
+
+/*
+ * Reads the directory with raw getdents64 calls on a large buffer, keeping the
+ * d_type of each entry so no stat is needed to tell directories apart.
+ */
+DirSnapshot *new_dir_snapshot(char *path) {
+    int fd = open(*path ? path : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    DirSnapshot *self = malloc(sizeof(DirSnapshot));
+    self->path = strdup(path);
+    self->names_cap = DIR_SCAN_BUFFER_SIZE;
+    self->names = malloc(self->names_cap);
+    self->names_len = 0;
+    self->cap = INITIAL_VEC_CAPACITY;
+    self->offsets = malloc(sizeof(unsigned int) * self->cap);
+    self->types = malloc(sizeof(unsigned char) * self->cap);
+    self->len = 0;
+    char *buffer = malloc(DIR_SCAN_BUFFER_SIZE);
+    long nread;
+    while ((nread = syscall(SYS_getdents64, fd, buffer, DIR_SCAN_BUFFER_SIZE)) > 0) {
+        long pos;
+        for (pos = 0; pos < nread;) {
+            struct linuxDirent64 *entry = (struct linuxDirent64 *) (buffer + pos);
+            pos += entry->d_reclen;
+            char *name = entry->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+                continue;
+            }
+            dir_snapshot_push(self, name, entry->d_type);
+        }
+    }
+    free(buffer);
+    close(fd);
+    return self;
+}
+
+GlobCache *new_glob_cache() {
+    GlobCache *self = malloc(sizeof(GlobCache));
+    self->snapshots = new_vec(sizeof(DirSnapshot *));
+    self->drop = drop_glob_cache;
+    return self;
+}
+
+void drop_glob_cache(GlobCache *self) {
+    unsigned int i;
+    for (i = 0; i < self->snapshots->length; i++) {
+        drop_dir_snapshot(self->snapshots->get(self->snapshots, i));
+    }
+    self->snapshots->drop(self->snapshots);
+    free(self);
+}
+
+DirSnapshot *glob_cache_dir(GlobCache *self, char *path) {
+    unsigned int i;
+    for (i = 0; i < self->snapshots->length; i++) {
+        DirSnapshot *snapshot = self->snapshots->get(self->snapshots, i);
+        if (str_equals(snapshot->path, path)) {
+            return snapshot;
+        }
+    }
+    DirSnapshot *snapshot = new_dir_snapshot(path);
+    if (snapshot != NULL) {
+        self->snapshots->push(self->snapshots, snapshot);
+    }
+    return snapshot;
+}
+
+bool is_dir_path(char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+char *join_path(char *base, char *name, size_t name_len) {
+    size_t base_len = strlen(base);
+    char *path = malloc(base_len + name_len + 2);
+    memcpy(path, base, base_len);
+    if (base_len && base[base_len - 1] != '/') {
+        path[base_len++] = '/';
+    }
+    memcpy(path + base_len, name, name_len);
+    path[base_len + name_len] = '\0';
+    return path;
+}
+
+/*
+ * Copies a component without the glob escapes.
+ */
+char *unescape_component(char *component, size_t len, size_t *out_len) {
+    char *str = malloc(len + 1);
+    size_t i, j = 0;
+    for (i = 0; i < len; i++) {
+        if (component[i] == '\\' && i + 1 < len) {
+            i++;
+        }
+        str[j++] = component[i];
+    }
+    str[j] = '\0';
+    *out_len = j;
+    return str;
+}
+
+/*
+ * Expands the components of the pattern one at a time, `bases` holds the
+ * paths matched by the previous components.
+ */
+void glob_expand_components(GlobCache *cache, char *pattern, Vec *bases, Vec *out) {
+    while (*pattern == '/') {
+        pattern++;
+    }
+    char *end = strchr(pattern, '/');
+    size_t len = end != NULL ? (size_t) (end - pattern) : strlen(pattern);
+    char *rest = pattern + len;
+    while (*rest == '/') {
+        rest++;
+    }
+    bool is_last = *rest == '\0';
+    // A trailing slash only matches directories, as any middle component
+    bool only_dirs = !is_last || end != NULL;
+    Vec *next = new_vec(sizeof(char *));
+    unsigned int i;
+    if (!has_glob_chars_len(pattern, len)) {
+        size_t literal_len;
+        char *literal = unescape_component(pattern, len, &literal_len);
+        for (i = 0; i < bases->length; i++) {
+            char *path = join_path(bases->get(bases, i), literal, literal_len);
+            struct stat st;
+            if ((!only_dirs && lstat(path, &st) == 0) || (only_dirs && is_dir_path(path))) {
+                next->push(next, path);
+            } else {
+                free(path);
+            }
+        }
+        free(literal);
+    } else {
+        GlobPattern *glob_pattern = compile_glob_pattern(pattern, len);
+        for (i = 0; i < bases->length; i++) {
+            char *base = bases->get(bases, i);
+            DirSnapshot *snapshot = glob_cache_dir(cache, base);
+            if (snapshot == NULL) {
+                continue;
+            }
+            unsigned int j;
+            for (j = 0; j < snapshot->len; j++) {
+                char *name = snapshot->names + snapshot->offsets[j];
+                if (!glob_pattern->match(glob_pattern, name)) {
+                    continue;
+                }
+                char *path = join_path(base, name, strlen(name));
+                unsigned char type = snapshot->types[j];
+                // Only symlinks and filesystems without d_type need a stat
+                if (only_dirs && type != DT_DIR &&
+                    !((type == DT_LNK || type == DT_UNKNOWN) && is_dir_path(path))) {
+                    free(path);
+                    continue;
+                }
+                next->push(next, path);
+            }
+        }
+        glob_pattern->drop(glob_pattern);
+    }
+    if (is_last || !next->length) {
+        for (i = 0; i < next->length; i++) {
+            char *path = next->get(next, i);
+            if (end != NULL) {
+                path = realloc(path, strlen(path) + 2);
+                strcat(path, "/");
+            }
+            out->push(out, path);
+        }
+    } else {
+        glob_expand_components(cache, rest, next, out);
+        for (i = 0; i < next->length; i++) {
+            free(next->get(next, i));
+        }
+    }
+    next->drop(next);
+}
+
+unsigned int glob_expand(GlobCache *cache, char *pattern, Vec *out) {
+    Vec *bases = new_vec(sizeof(char *));
+    bases->push(bases, strdup(pattern[0] == '/' ? "/" : ""));
+    Vec *matches = new_vec(sizeof(char *));
+    glob_expand_components(cache, pattern, bases, matches);
+    free(bases->get(bases, 0));
+    bases->drop(bases);
+    unsigned int len = matches->length, i;
+    if (!len) {
+        out->push(out, strdup(pattern));
+    } else {
+        char **arr = (char **) matches->_arr;
+        str_sort(arr, len);
+        for (i = 0; i < len; i++) {
+            out->push(out, arr[i]);
+        }
+    }
+    matches->drop(matches);
+    return len;
+}
@@ -0,0 +1,82 @@
+#ifndef LIB_GLOB_EXPAND_H
+#define LIB_GLOB_EXPAND_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "util/vec/vec.h"
+
+#define DIR_SCAN_BUFFER_SIZE (128 * 1024)
+
+enum GlobOpType {
+    GlobLiteral,
+    GlobAnyChar,
+    GlobAnyString,
+    GlobClass,
+};
+
+typedef struct globOp {
+    enum GlobOpType type;
+    char *literal;
+    unsigned int literal_len;
+    bool negated;
+    uint8_t class_bits[32];
+} GlobOp;
+
+/*
+ * A single path component of a glob compiled into a sequence of operations.
+ */
+typedef struct globPattern {
+    GlobOp *ops;
+    unsigned int len;
+    // Names starting with '.' only match when the pattern does too
+    bool match_hidden;
+
+    bool (*match)(struct globPattern *self, const char *str);
+
+    void (*drop)(struct globPattern *self);
+} GlobPattern;
+
+/*
+ * Entries of a directory read with getdents64, the names are packed into a
+ * single buffer so a listing costs a couple of allocations at most.
+ */
+typedef struct dirSnapshot {
+    char *path;
+    char *names;
+    size_t names_len;
+    size_t names_cap;
+    unsigned int *offsets;
+    unsigned char *types;
+    unsigned int len;
+    unsigned int cap;
+} DirSnapshot;
+
+/*
+ * Directories already read while expanding a command line, so `a*.log b*.log`
+ * reads the directory only once.
+ */
+typedef struct globCache {
+    Vec *snapshots;
+
+    void (*drop)(struct globCache *self);
+} GlobCache;
+
+bool has_glob_chars(char *str);
+
+GlobPattern *compile_glob_pattern(char *pattern, size_t len);
+
+bool glob_pattern_match(GlobPattern *self, const char *str);
+
+void drop_glob_pattern(GlobPattern *self);
+
+GlobCache *new_glob_cache();
+
+void drop_glob_cache(GlobCache *self);
+
+/*
+ * Pushes the sorted paths matching the pattern into `out`, or the pattern
+ * itself when nothing matches. Returns the amount of matches.
+ */
+unsigned int glob_expand(GlobCache *cache, char *pattern, Vec *out);
+
+#endif
@@ -1,12 +1,74 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+
+#include "alloc_stats.h"
+#include "bench.h"
+#include "fan_out.h"
 #include "handlers.h"
+#include "here_doc.h"
+#include "jobserver.h"
+#include "launcher.h"
+#include "loop.h"
+#include "output_mux.h"
+#include "path_cache.h"
+#include "process.h"
+#include "rlimits.h"
+#include "stats.h"
+#include "timeout.h"
+#include "timer_wheel.h"
+
+#define ALLOC_TAG ExecAlloc
 
-int children_in_bg = 0;
+volatile sig_atomic_t children_in_bg = 0;
 pid_t child_pgid = 0;
+// Lets long running builtins notice an interrupt the shell received
+volatile sig_atomic_t sig_int_count = 0;
+// Process group the children join instead of starting their own (see timed_group_handler)
+pid_t timed_group_pgid = 0;
+// Set in the leader of a timed group once it's timed out, nothing else is started then
+volatile sig_atomic_t timed_group_expired = 0;
+// Only background children are reaped by the SIGCHLD handler, the foreground
+// ones are waited by their handlers so their exit status isn't lost
+pid_t bg_children[MAX_BG_CHILDREN];
+
+bool track_bg_child(pid_t pid) {
+    int i;
+    for (i = 0; i < MAX_BG_CHILDREN; i++) {
+        if (!bg_children[i]) {
+            bg_children[i] = pid;
+            children_in_bg += 1;
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Leaves the child running in background, or waits for it when every
+ * background slot is taken as nothing would reap it otherwise.
+ */
+void background_child(pid_t pid) {
+    if (track_bg_child(pid)) {
+        printf("[%d] %d\n", children_in_bg, pid);
+        return;
+    }
+    fprintf(stderr, "vsh: %d background jobs already running, waiting for %d\n",
+            MAX_BG_CHILDREN, pid);
+    while (waitpid(pid, NULL, 0) == -1 && errno == EINTR);
+    jobserver_release_held(pid);
+}
+
+int background_jobs_count() { return children_in_bg; }
 
 void sig_chld_handler(const int signal) {
-    pid_t child_that_finished = wait(NULL);
-    if (child_that_finished != -1) {
-        if (children_in_bg != 0) {
+    int i;
+    for (i = 0; i < MAX_BG_CHILDREN; i++) {
+        pid_t child_that_finished;
+        if (bg_children[i] && (child_that_finished = waitpid(bg_children[i], NULL, WNOHANG)) > 0) {
+            bg_children[i] = 0;
+            jobserver_release_held(child_that_finished);
             printf("[%d] %d Done\n", children_in_bg, child_that_finished);
             children_in_bg -= 1;
         }
@@ -14,7 +76,6 @@ void sig_chld_handler(const int signal) {
 }
 
 void *input_thread_func(void *arg) {
-    ShellState *state = arg;
     pthread_exit(prompt_user(arg));
 }
 
@@ -49,6 +110,7 @@ void cancel_thread() {
 }
 
 void sig_int_handler(const int signal) {
+    sig_int_count++;
     if (child_pgid) {
         killpg(child_pgid, signal);
     }
@@ -67,11 +129,25 @@ void unknown_cmd_info(CallResult *res, bool *should_continue,
     } else {
         *should_continue = false;
         *status_code = UnknownCommand;
+        printf("Unknown command %s\n", res->additional_data);
+        res->drop(res);
+        // The forked copy of the shell leaves without the stdio cleanup of
+        // exit, which would seek the shared stdin back to what was read ahead
+        fflush(stdout);
+        _exit(UNKNOWN_COMMAND_EXIT_STATUS);
     }
 }
 
 pid_t basic_cmd_handler(ShellState *state, ExecArgs *exec_args, bool should_wait,
                         bool *should_continue, int *status_code) {
+    Builtin *builtin = find_builtin(exec_args);
+    if (builtin != NULL) {
+        int exit_code = builtin->call(state, exec_args);
+        if (should_wait) {
+            state->last_status = exit_code;
+        }
+        return 0;
+    }
     CallResult *res = exec_args->call(exec_args, true, should_wait);
     switch (res->status) {
         case Continue:
@@ -86,6 +162,9 @@ pid_t basic_cmd_handler(ShellState *state, ExecArgs *exec_args, bool should_wait
             unknown_cmd_info(res, should_continue, status_code);
             break;
     }
+    if (should_wait) {
+        state->last_status = res->exit_code;
+    }
     pid_t child_pid = res->child_pid;
     res->drop(res);
     return child_pid;
@@ -94,39 +173,296 @@ pid_t basic_cmd_handler(ShellState *state, ExecArgs *exec_args, bool should_wait
 void sequential_cmd_handler(ShellState *state, CallGroup *call_group,
                             bool *should_continue, int *status_code) {
     int i;
-    for (i = 0; i < call_group->exec_amount; i++) {
+    for (i = 0; i < call_group->exec_amount && !timed_group_expired && *should_continue; i++) {
         basic_cmd_handler(state, call_group->exec_arr[i], true, should_continue,
                           status_code);
+        // `a && b` only runs b once a succeeded
+        if (state->last_status) {
+            break;
+        }
+    }
+}
+
+typedef struct failfastWait {
+    CallGroup *call_group;
+    pid_t *child_pids;
+    pid_t pgid;
+    int status;
+} FailfastWait;
+
+/*
+ * Waits every member of a `&` group, the others are killed once one of them
+ * fails. The status is the one of that failure, or 0.
+ */
+void *failfast_wait(void *arg) {
+    FailfastWait *group = arg;
+    unsigned int len = group->call_group->exec_amount, left = 0, i;
+    pid_t running[len];
+    for (i = 0; i < len; i++) {
+        running[i] = group->child_pids[i];
+        left += running[i] > 0;
+    }
+    group->status = 0;
+    for (; left; left--) {
+        int wait_status;
+        pid_t finished = wait_any_child(running, len, &wait_status);
+        int code = exit_code_from_wait_status(wait_status);
+        if (finished == -1) {
+            break;
+        }
+        jobserver_release_held(finished);
+        if (!code || group->status) {
+            continue;
+        }
+        group->status = code;
+        for (i = 0; i < len && group->child_pids[i] != finished; i++);
+        fprintf(stderr, "vsh: %s exited %d, stopping the rest of the group\n",
+                group->call_group->exec_arr[i]->argv[0], code);
+        // The group catches what the members started, unless it's a timed one
+        // shared with its leader. A member that exec'd before its setpgid
+        // isn't part of it, each of them is signalled as well.
+        if (group->pgid && group->pgid != timed_group_pgid) {
+            killpg(group->pgid, SIGTERM);
+        }
+        for (i = 0; i < len; i++) {
+            if (running[i]) {
+                kill(running[i], SIGTERM);
+            }
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Starts a member of a `&` group once it has a jobserver slot (see
+ * jobserver.h). Returns -1 when interrupted while waiting for it, or the pid
+ * of the member (0 for a builtin).
+ */
+pid_t start_group_member(ShellState *state, CallGroup *call_group, int i, bool *should_continue,
+                         int *status_code) {
+    int token = JOBSERVER_NO_TOKEN;
+    if (!jobserver_acquire(&token)) {
+        return -1;
     }
+    pid_t child_pid = basic_cmd_handler(state, call_group->exec_arr[i], false, should_continue,
+                                        status_code);
+    if (child_pid) {
+        jobserver_hold(child_pid, token);
+    } else {
+        jobserver_release(token);
+    }
+    return child_pid;
+}
+
+/*
+ * Every member of the group writes to its own pipe and the group is waited as
+ * a whole, its output is written by the shell one complete line at a time.
+ */
+void multiplexed_cmd_handler(ShellState *state, CallGroup *call_group,
+                             bool *should_continue, int *status_code) {
+    int exec_amount = call_group->exec_amount;
+    pid_t child_pids[exec_amount];
+    int read_fds[exec_amount];
+    int i, fds_len = 0;
+    memset(child_pids, 0, sizeof(child_pids));
+    for (i = 0; i < exec_amount; i++) {
+        ExecArgs *exec_args = call_group->exec_arr[i];
+        int token = JOBSERVER_NO_TOKEN;
+        if (!jobserver_acquire(&token)) {
+            break;
+        }
+        int fds[2];
+        if (pipe2(fds, O_CLOEXEC) == -1) {
+            perror("pipe failed!\n");
+            exit(1);
+        }
+        // A `>&N` of the member goes through the multiplexer as well
+        int redirected = exec_args->stdout_fd;
+        exec_args->stdout_fd = fds[1];
+        child_pids[i] = basic_cmd_handler(state, exec_args, false, should_continue,
+                                          status_code);
+        exec_args->stdout_fd = redirected;
+        if (child_pids[i]) {
+            jobserver_hold(child_pids[i], token);
+        } else {
+            jobserver_release(token);
+        }
+        close(fds[1]);
+        read_fds[fds_len++] = fds[0];
+        if (!*should_continue) {
+            // `exit`, or a child whose exec failed and must leave
+            while (fds_len) {
+                close(read_fds[--fds_len]);
+            }
+            return;
+        }
+        if (child_pids[i]) {
+            setpgid(child_pids[i], timed_group_pgid ? timed_group_pgid : child_pids[0]);
+        }
+    }
+    child_pgid = child_pids[0];
+    FailfastWait failfast = {call_group, child_pids, timed_group_pgid ? timed_group_pgid
+                                                                     : child_pids[0], 0};
+    pthread_t failfast_waiter;
+    // The members are waited while their output is read, to stop them early
+    bool is_failfast = state->options.failfast &&
+                       !pthread_create(&failfast_waiter, NULL, failfast_wait, &failfast);
+    multiplex_output(read_fds, fds_len, state->options.tagged);
+    if (is_failfast) {
+        pthread_join(failfast_waiter, NULL);
+        state->last_status = failfast.status;
+        child_pgid = 0;
+        return;
+    }
+    for (i = 0; i < exec_amount; i++) {
+        int wait_status;
+        struct rusage usage;
+        if (child_pids[i] && wait_child_usage(child_pids[i], &wait_status, &usage) != -1) {
+            jobserver_release_held(child_pids[i]);
+            report_limit_exit(call_group->exec_arr[i], wait_status, &usage);
+            if (i == exec_amount - 1) {
+                state->last_status = exit_code_from_wait_status(wait_status);
+            }
+        }
+    }
+    child_pgid = 0;
 }
 
 void parallel_cmd_handler(ShellState *state, CallGroup *call_group,
                           bool *should_continue, int *status_code) {
+    cpu_set_t spread_cpus;
+    if (state->options.spread != NULL && parse_cpu_list(state->options.spread, &spread_cpus)) {
+        unsigned int i;
+        for (i = 0; i < call_group->exec_amount; i++) {
+            spread_launch_attrs(&call_group->exec_arr[i]->attrs, &spread_cpus, i);
+        }
+    }
+    if (call_group->exec_amount > 1 &&
+        (state->options.line_buffered || state->options.tagged)) {
+        multiplexed_cmd_handler(state, call_group, should_continue, status_code);
+        return;
+    }
     int exec_amount = call_group->exec_amount;
     pid_t child_pids[exec_amount];
+    bool is_failfast = state->options.failfast && exec_amount > 1;
     int i;
+    memset(child_pids, 0, sizeof(child_pids));
     for (i = 0; i < exec_amount; i++) {
-        child_pids[i] = basic_cmd_handler(state, call_group->exec_arr[i], false,
-                                          should_continue, status_code);
-        if (i < exec_amount - 1) {
-            children_in_bg += 1;
-            printf("[%d] %d\n", children_in_bg, child_pids[i]);
+        if ((child_pids[i] = start_group_member(state, call_group, i, should_continue,
+                                                status_code)) == -1) {
+            // Interrupted while waiting for a slot, the rest isn't started
+            child_pids[i] = 0;
+            break;
+        }
+        // A single `cmd &` is left running in background as well
+        if (child_pids[i] && !is_failfast && (i < exec_amount - 1 || exec_amount == 1)) {
+            background_child(child_pids[i]);
+        }
+        if (child_pids[i]) {
+            setpgid(child_pids[i], timed_group_pgid ? timed_group_pgid : child_pids[0]);
         }
-        setpgid(child_pids[i], child_pids[0]);
     }
     child_pgid = child_pids[0];
-    if (call_group->exec_amount > 1) {
+    if (is_failfast) {
+        FailfastWait failfast = {call_group, child_pids,
+                                 timed_group_pgid ? timed_group_pgid : child_pids[0], 0};
+        failfast_wait(&failfast);
+        state->last_status = failfast.status;
+    } else if (call_group->exec_amount > 1) {
         pid_t child_to_wait = child_pids[exec_amount - 1];
-        waitpid(child_to_wait, NULL, WUNTRACED);
+        int wait_status;
+        struct rusage usage;
+        if (child_to_wait && wait_child_usage(child_to_wait, &wait_status, &usage) != -1) {
+            jobserver_release_held(child_to_wait);
+            report_limit_exit(call_group->exec_arr[exec_amount - 1], wait_status, &usage);
+            state->last_status = exit_code_from_wait_status(wait_status);
+        }
     }
     child_pgid = 0;
 }
 
+/*
+ * A pipeline of external commands is started by the launcher (see launcher.h),
+ * returns false when it has to be forked by the shell instead.
+ */
+bool launched_piped_cmd_handler(ShellState *state, CallGroup *call_group) {
+    int exec_amount = call_group->exec_amount, i;
+    for (i = 0; i < exec_amount; i++) {
+        ExecArgs *exec_args = call_group->exec_arr[i];
+        if (!exec_args->argc || find_builtin(exec_args) != NULL ||
+            str_equals(exec_args->argv[0], "cd") || str_equals(exec_args->argv[0], "exit")) {
+            return false;
+        }
+    }
+    int pipes[exec_amount][2];
+    pid_t pids[exec_amount];
+    for (i = 0; i < exec_amount - 1; i++) {
+        if (pipe2(pipes[i], O_CLOEXEC) < 0) {
+            perror("pipe failed!\n");
+            exit(1);
+        }
+    }
+    uint64_t forked_at[exec_amount];
+    int launched;
+    for (launched = 0; launched < exec_amount; launched++) {
+        ExecArgs *exec_args = call_group->exec_arr[launched];
+        int here_doc = exec_args->stdin_fd != -1 ? open_here_doc(exec_args->stdin_fd) : -1;
+        int fds[3] = {here_doc != -1 ? here_doc
+                                     : (launched ? pipes[launched - 1][0] : STDIN_FILENO),
+                      exec_args->stdout_fd != -1 ? exec_args->stdout_fd
+                                                 : (launched < exec_amount - 1 ? pipes[launched][1]
+                                                                               : STDOUT_FILENO),
+                      STDERR_FILENO};
+        forked_at[launched] = stats_now();
+        pids[launched] = launcher_spawn(exec_args, resolve_command_path(exec_args->argv[0]), fds,
+                                        launched ? pids[0] : 0);
+        if (here_doc != -1) {
+            close(here_doc);
+        }
+        if (pids[launched] == -1) {
+            stats_count(SpawnFailures);
+            perror("We can't start a new program since 'fork' failed!\n");
+            break;
+        }
+        stats_count(CommandsLaunched);
+    }
+    for (i = 0; i < exec_amount - 1; i++) {
+        close(pipes[i][0]);
+        close(pipes[i][1]);
+    }
+    if (!launched) {
+        return false;
+    }
+    child_pgid = pids[0];
+    state->last_status = 1;
+    for (i = 0; i < launched; i++) {
+        int wait_status;
+        struct rusage usage;
+        if (launcher_wait(pids[i], &wait_status, &usage) == -1) {
+            continue;
+        }
+        stats_record(ExecToReap, forked_at[i]);
+        report_limit_exit(call_group->exec_arr[i], wait_status, &usage);
+        if (i == exec_amount - 1) {
+            state->last_status = exit_code_from_wait_status(wait_status);
+        }
+    }
+    child_pgid = 0;
+    return true;
+}
+
 void piped_cmd_handler(ShellState *state, CallGroup *call_group,
                        bool *should_continue, int *status_code) {
+    (void) should_continue;
+    (void) status_code;
+    if (launcher_enabled() && launched_piped_cmd_handler(state, call_group)) {
+        return;
+    }
     int exec_amount = call_group->exec_amount;
     int i;
-    pid_t child_pgid = 0;
+    pid_t child_pgid = 0, last_pid = 0;
+    pid_t child_pids[exec_amount];
+    uint64_t forked_at[exec_amount];
     int pipes_len = exec_amount - 1;
     int pipes[pipes_len][2];
     for (i = 0; i < pipes_len; i++) {
@@ -135,19 +471,29 @@ void piped_cmd_handler(ShellState *state, CallGroup *call_group,
             exit(1);
         }
     }
+    // A member flushes stdout before its exec, it mustn't write the shell's
+    fflush(stdout);
     for (i = 0; i < exec_amount; i++) {
         ExecArgs *exec_args = call_group->exec_arr[i];
+        forked_at[i] = stats_now();
         pid_t child_pid = fork();
         if (child_pid == -1) {
+            stats_count(ForkFailures);
             perror("fork failed!\n");
             exit(1);
         }
         if (i == 0) {
-            child_pgid = child_pid ? child_pid : getpid();
+            child_pgid = timed_group_pgid ? timed_group_pgid : (child_pid ? child_pid : getpid());
         }
         if (child_pid) {
+            stats_count(CommandsLaunched);
             setpgid(child_pid, child_pgid);
+            child_pids[i] = child_pid;
+            last_pid = child_pid;
         } else {
+            uint64_t child_forked_at = forked_at[i];
+            // Set from both sides, the parent's call fails once the child exec'd
+            setpgid(0, child_pgid);
             if (i < exec_amount - 1) {
                 dup2(pipes[i][1], STDOUT_FILENO);
                 close(pipes[i][0]);
@@ -157,16 +503,27 @@ void piped_cmd_handler(ShellState *state, CallGroup *call_group,
                 dup2(pipes[i - 1][0], STDIN_FILENO);
                 close(pipes[i - 1][1]);
             }
+            if (exec_args->stdin_fd != -1) {
+                install_here_doc(exec_args->stdin_fd);
+            }
+            if (exec_args->stdout_fd != -1) {
+                dup2(exec_args->stdout_fd, STDOUT_FILENO);
+            }
             for (i = 0; i < pipes_len; i++) {
                 if (stdin_fileno_idx >= 0 && stdin_fileno_idx != i) {
                     close(pipes[i][1]);
                     close(pipes[i][0]);
                 }
             }
-            exec_args->call(exec_args, false, false);
-            *should_continue = false;
-            *status_code = UnknownCommand;
-            break;
+            apply_launch_attrs(&exec_args->attrs);
+            Builtin *builtin = find_builtin(exec_args);
+            if (builtin != NULL) {
+                int exit_code = builtin->call(state, exec_args);
+                fflush(stdout);
+                _exit(exit_code);
+            }
+            stats_record(ForkToExec, child_forked_at);
+            tail_exec(exec_args);
         }
     }
     if (i == exec_amount) {
@@ -176,8 +533,536 @@ void piped_cmd_handler(ShellState *state, CallGroup *call_group,
             close(pipes[j][1]);
             close(pipes[j][0]);
         }
-        while (waitpid(-child_pgid, NULL, WUNTRACED) != -1);
+        pid_t finished_pid;
+        int wait_status;
+        struct rusage usage;
+        // The pipeline status is the one of its last command
+        while ((finished_pid = wait_child_usage(-child_pgid, &wait_status, &usage)) != -1) {
+            for (j = 0; j < exec_amount && child_pids[j] != finished_pid; j++);
+            if (j < exec_amount) {
+                stats_record(ExecToReap, forked_at[j]);
+                report_limit_exit(call_group->exec_arr[j], wait_status, &usage);
+            }
+            if (finished_pid == last_pid) {
+                state->last_status = exit_code_from_wait_status(wait_status);
+            }
+        }
+    }
+}
+
+void timeout_signal_handler(const int signal) {
+    (void) signal;
+    timed_group_expired = 1;
+}
+
+/*
+ * Runs the line when given, or else the call group, in a forked copy of the
+ * shell leading a process group of its own.
+ */
+pid_t spawn_group_leader(ShellState *state, char *line, CallGroup *call_group) {
+    fflush(stdout);
+    pid_t leader = fork();
+    if (leader == -1) {
+        perror("fork failed");
+        return -1;
+    }
+    if (leader == 0) {
+        setpgid(0, 0);
+        timed_group_pgid = getpid();
+        signal(SIGINT, SIG_DFL);
+        bool should_continue = true;
+        int status_code = 0;
+        if (line != NULL) {
+            call_line_handler(state, line, &should_continue, &status_code);
+        } else {
+            call_group_handler(state, call_group, &should_continue, &status_code);
+        }
+        fflush(stdout);
+        _exit(status_code ? status_code : state->last_status);
+    }
+    setpgid(leader, leader);
+    return leader;
+}
+
+pid_t spawn_line_group(ShellState *state, char *line) {
+    return spawn_group_leader(state, line, NULL);
+}
+
+pid_t spawn_call_group(ShellState *state, CallGroup *call_group) {
+    return spawn_group_leader(state, NULL, call_group);
+}
+
+/*
+ * Whether the group is a single external command the shell can become,
+ * nothing is left to do after it then and no background job or coprocess
+ * needs the shell.
+ */
+bool can_tail_exec(ShellState *state, CallGroup *call_group) {
+    if (call_group->type != Basic || call_group->exec_amount != 1 || children_in_bg ||
+        state->coprocs->length) {
+        return false;
+    }
+    ExecArgs *exec_args = call_group->exec_arr[0];
+    // The limits are reported once the command is waited
+    if (!exec_args->argc || find_builtin(exec_args) != NULL || exec_args->attrs.rlimits_len) {
+        return false;
+    }
+    char *name = exec_args->argv[0];
+    // The group prefixes need the shell to stay around
+    return !str_equals(name, "cd") && !str_equals(name, "exit") && !str_equals(name, "timeout") &&
+           !str_equals(name, "bench");
+}
+
+void tail_exec(ExecArgs *exec_args) {
+    fflush(stdout);
+    CallResult *res = exec_args->call(exec_args, false, false);
+    // Only reached when the exec failed
+    printf("Unknown command %s\n", exec_args->argv[0]);
+    res->drop(res);
+    fflush(stdout);
+    _exit(UNKNOWN_COMMAND_EXIT_STATUS);
+}
+
+void exec_fan_out_member(ShellState *state, ExecArgs *exec_args) {
+    if (exec_args->stdin_fd != -1) {
+        install_here_doc(exec_args->stdin_fd);
+    }
+    if (exec_args->stdout_fd != -1) {
+        dup2(exec_args->stdout_fd, STDOUT_FILENO);
+    }
+    apply_launch_attrs(&exec_args->attrs);
+    Builtin *builtin = find_builtin(exec_args);
+    if (builtin != NULL) {
+        int exit_code = builtin->call(state, exec_args);
+        fflush(stdout);
+        _exit(exit_code);
+    }
+    tail_exec(exec_args);
+}
+
+/*
+ * The producer (a pipeline of its own when there are several commands before
+ * `|&`) writes to a pipe the shell copies to every consumer, see fan_out.h.
+ * The status of the group is the one of its last consumer.
+ */
+void fan_out_cmd_handler(ShellState *state, CallGroup *call_group, bool *should_continue,
+                         int *status_code) {
+    unsigned int consumers = call_group->consumers, k;
+    unsigned int producers = call_group->exec_amount - consumers;
+    if (!consumers || !call_group->exec_arr[0]->argc) {
+        fprintf(stderr, "usage: producer |& { consumer, consumer... }\n");
+        state->last_status = 2;
+        return;
+    }
+    // The producer's pipe is pipes[0], the consumers' ones follow
+    int pipes[consumers + 1][2];
+    for (k = 0; k <= consumers; k++) {
+        if (pipe2(pipes[k], O_CLOEXEC) == -1) {
+            perror("pipe failed!\n");
+            exit(1);
+        }
+    }
+    pid_t child_pids[consumers + 1];
+    uint64_t forked_at[consumers + 1];
+    pid_t pgid = timed_group_pgid;
+    fflush(stdout);
+    for (k = 0; k <= consumers; k++) {
+        ExecArgs *exec_args = call_group->exec_arr[k ? producers + k - 1 : 0];
+        forked_at[k] = stats_now();
+        pid_t child_pid = fork();
+        if (child_pid == -1) {
+            stats_count(ForkFailures);
+            perror("fork failed!\n");
+            exit(1);
+        }
+        if (!pgid) {
+            pgid = child_pid ? child_pid : getpid();
+        }
+        if (child_pid) {
+            stats_count(CommandsLaunched);
+            setpgid(child_pid, pgid);
+            child_pids[k] = child_pid;
+            continue;
+        }
+        setpgid(0, pgid);
+        if (k) {
+            dup2(pipes[k][0], STDIN_FILENO);
+        } else {
+            dup2(pipes[0][1], STDOUT_FILENO);
+        }
+        // Builtins don't exec, no copy of a write end may outlive its user
+        unsigned int j;
+        for (j = 0; j <= consumers; j++) {
+            close(pipes[j][0]);
+            close(pipes[j][1]);
+        }
+        if (!k && producers > 1) {
+            CallGroup pipeline = *call_group;
+            pipeline.type = Piped;
+            pipeline.exec_amount = producers;
+            timed_group_pgid = pgid;
+            piped_cmd_handler(state, &pipeline, should_continue, status_code);
+            fflush(stdout);
+            _exit(*status_code ? *status_code : state->last_status);
+        }
+        stats_record(ForkToExec, forked_at[k]);
+        exec_fan_out_member(state, exec_args);
+    }
+    int sinks[consumers];
+    close(pipes[0][1]);
+    for (k = 0; k < consumers; k++) {
+        close(pipes[k + 1][0]);
+        sinks[k] = pipes[k + 1][1];
+    }
+    child_pgid = pgid;
+    fan_out(pipes[0][0], sinks, consumers);
+    close(pipes[0][0]);
+    for (k = 0; k <= consumers; k++) {
+        int wait_status;
+        struct rusage usage;
+        if (wait_child_usage(child_pids[k], &wait_status, &usage) == -1) {
+            continue;
+        }
+        stats_record(ExecToReap, forked_at[k]);
+        // A pipeline producer reported its own members
+        if (k || producers == 1) {
+            report_limit_exit(call_group->exec_arr[k ? producers + k - 1 : 0], wait_status,
+                              &usage);
+        }
+        if (k == consumers) {
+            state->last_status = exit_code_from_wait_status(wait_status);
+        }
+    }
+    child_pgid = 0;
+}
+
+/*
+ * The group runs in a forked copy of the shell leading a process group that
+ * every process of the group joins, so the timer signals all of them at once.
+ */
+void timed_group_handler(ShellState *state, CallGroup *call_group, TimeoutSpec *spec,
+                         bool *should_continue, int *status_code) {
+    // A single `cmd &` keeps running in background with its timeout
+    bool in_background = call_group->type == Parallel && call_group->exec_amount == 1;
+    fflush(stdout);
+    pid_t leader = fork();
+    if (leader == -1) {
+        perror("fork failed!\n");
+        exit(1);
+    }
+    if (leader == 0) {
+        setpgid(0, 0);
+        timed_group_pgid = getpid();
+        // The leader outlives the signal to wait for the rest of the group
+        signal(spec->signal, timeout_signal_handler);
+        if (in_background) {
+            call_group->type = Basic;
+        }
+        // A lone command becomes the leader itself, the signal reaches it directly
+        if (can_tail_exec(state, call_group)) {
+            tail_exec(call_group->exec_arr[0]);
+        }
+        call_group_handler(state, call_group, should_continue, status_code);
+        // _exit, as exit would seek the shared stdin back to what stdio read ahead
+        fflush(stdout);
+        _exit(state->last_status);
+    }
+    setpgid(leader, leader);
+    unsigned long timer = timer_wheel_add(leader, leader, spec->seconds, spec->signal,
+                                          spec->grace);
+    if (in_background) {
+        timer_wheel_detach(timer);
+        background_child(leader);
+        return;
+    }
+    child_pgid = leader;
+    int wait_status;
+    struct rusage usage;
+    bool has_status = wait_child_usage(leader, &wait_status, &usage) != -1;
+    child_pgid = 0;
+    switch (timer_wheel_cancel(timer)) {
+        case TimerKilled:
+            state->last_status = TIMEOUT_KILLED_EXIT_STATUS;
+            break;
+        case TimerSignalled:
+            state->last_status = TIMEOUT_EXIT_STATUS;
+            break;
+        default:
+            state->last_status = has_status ? exit_code_from_wait_status(wait_status) : 1;
+    }
+}
+
+/*
+ * Runs the group repeatedly, a single command goes through posix_spawn so the
+ * fork of the whole shell isn't part of its timings. The prefixes are taken
+ * off argv only once, so the timeout of `bench timeout ...` is kept apart.
+ */
+void bench_group_handler(ShellState *state, CallGroup *call_group, GroupPrefixes *prefixes,
+                         bool *should_continue, int *status_code) {
+    ExecArgs *first = call_group->exec_arr[0];
+    BenchSpec *spec = &prefixes->bench;
+    bool has_timeout = prefixes->has_timeout;
+    GroupPrefixes none = {false};
+    bool can_spawn = !has_timeout && call_group->type == Basic && can_bench_spawn(first);
+    char *name = str_join(first->argv, first->argc, " ");
+    if (call_group->exec_amount > 1) {
+        // Only the first command is named, the rest of the group is elided
+        name = realloc(name, strlen(name) + 5);
+        strcat(name, " ...");
+    }
+    unsigned int total = spec->warmup + spec->runs, i, measured = 0;
+    int spawn_error = 0;
+    BenchRun *runs = malloc(sizeof(BenchRun) * spec->runs);
+    fflush(stdout);
+    for (i = 0; i < total && *should_continue; i++) {
+        BenchRun run;
+        struct rusage before, after;
+        struct timespec start, end;
+        if (can_spawn) {
+            if (!bench_spawn_run(first, &run)) {
+                spawn_error = run.exit_code;
+                break;
+            }
+        } else {
+            getrusage(RUSAGE_CHILDREN, &before);
+            take_waited_max_rss();
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            if (has_timeout) {
+                timed_group_handler(state, call_group, &prefixes->timeout, should_continue,
+                                    status_code);
+            } else {
+                prefixed_group_handler(state, call_group, &none, should_continue, status_code);
+            }
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            getrusage(RUSAGE_CHILDREN, &after);
+            run.elapsed_ns = timespec_diff_ns(&start, &end);
+            run.user_ns = timeval_ns(&after.ru_utime) - timeval_ns(&before.ru_utime);
+            run.sys_ns = timeval_ns(&after.ru_stime) - timeval_ns(&before.ru_stime);
+            // RUSAGE_CHILDREN keeps the peak of every run before, only this run's counts
+            run.max_rss = take_waited_max_rss();
+            run.exit_code = state->last_status;
+        }
+        if (i >= spec->warmup) {
+            runs[measured++] = run;
+        }
+        if (run.exit_code == 128 + SIGINT) {
+            break;
+        }
+    }
+    if (measured) {
+        print_bench_report(name, runs, measured, spec->warmup);
+    }
+    state->last_status = spawn_error ? spawn_error : measured == spec->runs ? 0 : 130;
+    for (i = 0; i < measured; i++) {
+        if (runs[i].exit_code) {
+            state->last_status = runs[i].exit_code;
+            break;
+        }
+    }
+    free(runs);
+    free(name);
+}
+
+void take_group_prefixes(CallGroup *call_group, GroupPrefixes *prefixes) {
+    ExecArgs *first = call_group->exec_amount ? call_group->exec_arr[0] : NULL;
+    prefixes->has_bench = first != NULL && take_bench_prefix(first, &prefixes->bench);
+    prefixes->has_timeout = first != NULL && take_timeout_prefix(first, &prefixes->timeout);
+}
+
+void prefixed_group_handler(ShellState *state, CallGroup *call_group, GroupPrefixes *prefixes,
+                            bool *should_continue, int *status_code) {
+    if (prefixes->has_bench) {
+        bench_group_handler(state, call_group, prefixes, should_continue, status_code);
+        return;
+    }
+    if (prefixes->has_timeout) {
+        timed_group_handler(state, call_group, &prefixes->timeout, should_continue, status_code);
+        return;
+    }
+    switch (call_group->type) {
+        case Basic:
+            if (call_group->exec_amount)
+                basic_cmd_handler(state, call_group->exec_arr[0], true,
+                                  should_continue, status_code);
+            break;
+        case Parallel:
+            parallel_cmd_handler(state, call_group, should_continue,
+                                 status_code);
+            break;
+        case Sequential:
+            sequential_cmd_handler(state, call_group, should_continue,
+                                   status_code);
+            break;
+        case Piped:
+            piped_cmd_handler(state, call_group, should_continue, status_code);
+            break;
+        case FanOut:
+            fan_out_cmd_handler(state, call_group, should_continue, status_code);
+            break;
+        case Loop:
+            loop_plan_handler(state, call_group->loop, should_continue, status_code);
+            break;
+        default:
+            break;
+    }
+}
+
+void call_group_handler(ShellState *state, CallGroup *call_group,
+                        bool *should_continue, int *status_code) {
+    GroupPrefixes prefixes;
+    take_group_prefixes(call_group, &prefixes);
+    prefixed_group_handler(state, call_group, &prefixes, should_continue, status_code);
+}
+
+void call_groups_handler(ShellState *state, CallGroups *call_groups, bool is_last_line,
+                         bool *should_continue, int *status_code) {
+    int i;
+    for (i = 0; i < call_groups->len && *should_continue; i++) {
+        CallGroup *call_group = call_groups->groups[i];
+        if (is_last_line && i == call_groups->len - 1 && can_tail_exec(state, call_group)) {
+            tail_exec(call_group->exec_arr[0]);
+        }
+        call_group_handler(state, call_group, should_continue, status_code);
+    }
+}
+
+void call_line_handler(ShellState *state, char *line, bool *should_continue,
+                       int *status_code) {
+    CallArg *call_arg = initialize_call_arg(line);
+    call_arg->state = state;
+    CallGroups *call_groups = call_arg->call_groups(call_arg);
+    call_groups_handler(state, call_groups, false, should_continue, status_code);
+    call_groups->drop(call_groups);
+    call_arg->drop(call_arg);
+}
+
+bool is_script_line(char *line) {
+    char *start = line + strspn(line, " \t");
+    // Blank lines and comments (the shebang included) are skipped
+    return *start && *start != '#';
+}
+
+/*
+ * Splits the next line off the script, with the bodies of the here-documents
+ * it opens. Blank and comment lines are skipped.
+ */
+char *take_script_line(char **cursor) {
+    while (**cursor) {
+        char *line = *cursor, *end = strchrnul(line, '\n');
+        while (*end) {
+            *end = '\0';
+            bool here_docs_done = here_docs_complete(line);
+            bool is_complete = here_docs_done && loops_complete(line);
+            // The lines of a loop are joined as its statements
+            *end = is_complete || !here_docs_done ? '\n' : ';';
+            if (is_complete) {
+                break;
+            }
+            end = strchrnul(end + 1, '\n');
+        }
+        *cursor = *end ? end + 1 : end;
+        *end = '\0';
+        if (is_script_line(line)) {
+            return line;
+        }
+    }
+    return NULL;
+}
+
+int call_script_handler(ShellState *state, char *script, bool may_tail_exec) {
+    bool should_continue = true;
+    int status_code = 0;
+    char *cursor = script, *line, *next_line;
+    line = take_script_line(&cursor);
+    for (; line != NULL && should_continue; line = next_line) {
+        next_line = take_script_line(&cursor);
+        CallArg *call_arg = initialize_call_arg(line);
+        call_arg->state = state;
+        CallGroups *call_groups = call_arg->call_groups(call_arg);
+        call_groups_handler(state, call_groups, may_tail_exec && next_line == NULL,
+                            &should_continue, &status_code);
+        call_groups->drop(call_groups);
+        call_arg->drop(call_arg);
+        report_line_allocs();
+    }
+    return status_code ? status_code : state->last_status;
+}
+
+typedef struct captureBuffer {
+    int fd;
+    char *data;
+    size_t len;
+    size_t cap;
+} CaptureBuffer;
+
+/*
+ * Reads the captured output with large reads straight into the free space
+ * of the buffer, doubling it when it gets full.
+ */
+void *capture_reader_func(void *arg) {
+    CaptureBuffer *buffer = arg;
+    while (true) {
+        if (buffer->cap - buffer->len < CAPTURE_READ_SIZE) {
+            buffer->cap = (buffer->cap << 1) > buffer->len + CAPTURE_READ_SIZE
+                          ? buffer->cap << 1 : buffer->len + CAPTURE_READ_SIZE;
+            buffer->data = realloc(buffer->data, buffer->cap + 1);
+        }
+        ssize_t len = read(buffer->fd, buffer->data + buffer->len, buffer->cap - buffer->len);
+        if (len < 0 && errno == EINTR) {
+            continue;
+        }
+        if (len <= 0) {
+            break;
+        }
+        buffer->len += len;
+    }
+    return NULL;
+}
+
+/*
+ * Runs the line through the regular handlers with the shell stdout pointing
+ * to a pipe, which is drained by a thread so big outputs can't block the
+ * children. Trailing newlines are removed from the returned output.
+ */
+char *capture_output_handler(ShellState *state, char *line) {
+    int pipe_fds[2];
+    CaptureBuffer buffer = {.data = NULL, .len = 0, .cap = 0};
+    fflush(stdout);
+    int saved_stdout = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+    if (saved_stdout < 0 || pipe2(pipe_fds, O_CLOEXEC) < 0) {
+        perror("command substitution failed");
+        if (saved_stdout >= 0) {
+            close(saved_stdout);
+        }
+        return strdup("");
+    }
+    buffer.fd = pipe_fds[0];
+    pthread_t reader;
+    pthread_create(&reader, NULL, capture_reader_func, &buffer);
+    dup2(pipe_fds[1], STDOUT_FILENO);
+    close(pipe_fds[1]);
+    bool should_continue = true;
+    int status_code = 0;
+    pid_t shell_pid = getpid();
+    call_line_handler(state, line, &should_continue, &status_code);
+    if (getpid() != shell_pid) {
+        // A forked child whose exec failed must not go on as the shell
+        fflush(stdout);
+        _exit(status_code);
+    }
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+    pthread_join(reader, NULL);
+    close(pipe_fds[0]);
+    if (buffer.data == NULL) {
+        return strdup("");
+    }
+    while (buffer.len && buffer.data[buffer.len - 1] == '\n') {
+        buffer.len--;
     }
+    buffer.data[buffer.len] = '\0';
+    return buffer.data;
 }
 
 const char *WEIRD = "\n                                        .--.  .--.\n"
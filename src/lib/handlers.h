@@ -9,11 +9,27 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include "bench.h"
+#include "builtins.h"
 #include "lib.h"
+#include "timeout.h"
 #include "util/string_util/string_util.h"
 
+#define MAX_BG_CHILDREN 256
+#define CAPTURE_READ_SIZE (64 * 1024)
+
 void print_weird();
 
+// Pids of the background children, 0 for a free entry
+extern pid_t bg_children[MAX_BG_CHILDREN];
+
+/*
+ * Returns false, without tracking it, when MAX_BG_CHILDREN are already.
+ */
+bool track_bg_child(pid_t pid);
+
+int background_jobs_count();
+
 void create_input_thread(ShellState *state);
 
 CallArg *join_input_thread();
@@ -21,6 +37,12 @@ CallArg *join_input_thread();
 /*
  * Signal Handlers
  */
+extern pid_t child_pgid;
+
+extern volatile sig_atomic_t sig_int_count;
+
+extern volatile sig_atomic_t timed_group_expired;
+
 void sig_int_handler(int signal);
 
 void sig_chld_handler(int signal);
@@ -46,4 +68,54 @@ void parallel_cmd_handler(ShellState *state, CallGroup *call_group,
 void piped_cmd_handler(ShellState *state, CallGroup *call_group,
                        bool *should_continue, int *status_code);
 
+/*
+ * The `bench` and `timeout` prefixes of a group, taken off its first command.
+ */
+typedef struct groupPrefixes {
+    bool has_bench;
+    BenchSpec bench;
+    bool has_timeout;
+    TimeoutSpec timeout;
+} GroupPrefixes;
+
+void take_group_prefixes(CallGroup *call_group, GroupPrefixes *prefixes);
+
+void prefixed_group_handler(ShellState *state, CallGroup *call_group, GroupPrefixes *prefixes,
+                            bool *should_continue, int *status_code);
+
+void call_group_handler(ShellState *state, CallGroup *call_group,
+                        bool *should_continue, int *status_code);
+
+void call_line_handler(ShellState *state, char *line, bool *should_continue,
+                       int *status_code);
+
+/*
+ * Runs the line in a forked copy of the shell leading its own process group,
+ * every command of the line joins it so a single killpg stops them all.
+ */
+pid_t spawn_line_group(ShellState *state, char *line);
+
+/*
+ * Same as spawn_line_group for an already parsed group, which is left as is.
+ */
+pid_t spawn_call_group(ShellState *state, CallGroup *call_group);
+
+/*
+ * Replaces the forked shell with the command. When the exec fails it says so
+ * and exits with UNKNOWN_COMMAND_EXIT_STATUS.
+ */
+void tail_exec(ExecArgs *exec_args);
+
+void call_groups_handler(ShellState *state, CallGroups *call_groups, bool is_last_line,
+                         bool *should_continue, int *status_code);
+
+/*
+ * Runs each line of the script until one of them exits the shell, returning
+ * the status of the last one. When `may_tail_exec` the shell execs the last
+ * command itself instead of forking it, if nothing else needs to be done.
+ */
+int call_script_handler(ShellState *state, char *script, bool may_tail_exec);
+
+char *capture_output_handler(ShellState *state, char *line);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,106 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "alloc_stats.h"
+#include "here_doc.h"
+#include "line_editor.h"
+
+#define ALLOC_TAG ExecAlloc
+
+int here_doc_memfd(const char *data, size_t len) {
+    int fd = memfd_create("vsh-here-doc", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd == -1) {
+        perror("vsh: memfd_create failed");
+        return -1;
+    }
+    write_all(fd, data, len);
+    // Nobody can change the body once the line is parsed
+    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+    return fd;
+}
+
+int open_here_doc(int fd) {
+    char path[32];
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+    return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+void install_here_doc(int fd) {
+    int fresh = open_here_doc(fd);
+    if (fresh == -1) {
+        // Without /proc the description is shared, rewinding it is enough for one run
+        dup2(fd, STDIN_FILENO);
+        lseek(STDIN_FILENO, 0, SEEK_SET);
+        return;
+    }
+    dup2(fresh, STDIN_FILENO);
+    close(fresh);
+}
+
+int read_here_doc_word(char *line, int i, int len, char **word) {
+    for (; i < len && line[i] == ' '; i++);
+    if (i >= len) {
+        return -1;
+    }
+    if (line[i] == '"') {
+        char *unquoted = malloc(len - i), *ptr = unquoted;
+        for (i++; i < len && line[i] != '"'; i++) {
+            if (line[i] == '\\' && i + 1 < len && line[i + 1] == '"') {
+                i++;
+            }
+            *ptr++ = line[i];
+        }
+        if (i >= len) {
+            free(unquoted);
+            return -1;
+        }
+        *ptr = '\0';
+        *word = unquoted;
+        return i + 1;
+    }
+    int start = i;
+    for (; i < len && !strchr(" |&\n", line[i]); i++);
+    *word = strndup(line + start, i - start);
+    return i;
+}
+
+bool here_docs_complete(char *text) {
+    char *delimiters[HERE_DOC_MAX_DELIMITERS];
+    unsigned int len = 0, matched = 0, i;
+    int line_len = (int) strcspn(text, "\n"), j;
+    bool quoted = false;
+    for (j = 0; j < line_len; j++) {
+        if (text[j] == '"' && (!j || text[j - 1] != '\\')) {
+            quoted = !quoted;
+        } else if (!quoted && !strncmp(text + j, "<<<", 3)) {
+            j += 2;
+        } else if (!quoted && !strncmp(text + j, "<<", 2) && len < HERE_DOC_MAX_DELIMITERS) {
+            char *word;
+            int next = read_here_doc_word(text, j + 2, line_len, &word);
+            if (next == -1) {
+                break;
+            }
+            delimiters[len++] = word;
+            j = next - 1;
+        }
+    }
+    char *line = text + line_len;
+    while (*line && matched < len) {
+        line++;
+        size_t body_line_len = strcspn(line, "\n");
+        if (strlen(delimiters[matched]) == body_line_len &&
+            !strncmp(line, delimiters[matched], body_line_len)) {
+            matched++;
+        }
+        line += body_line_len;
+    }
+    for (i = 0; i < len; i++) {
+        free(delimiters[i]);
+    }
+    return matched == len;
+}
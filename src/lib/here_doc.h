@@ -0,0 +1,42 @@
+#ifndef LIB_HERE_DOC_H
+#define LIB_HERE_DOC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define HERE_DOC_MAX_DELIMITERS 16
+
+/*
+ * Here-strings (`cmd <<< word`, the word and a newline) and here-documents
+ * (`cmd <<EOF`, the lines following the command line up to the one being
+ * EOF) become the stdin of the command. Their body is written once into a
+ * sealed memfd when the line is parsed, each run of the command then gets
+ * its own read-only description of it, so no process or pipe feeds it and
+ * nothing touches the disk. Bodies are taken literally.
+ */
+int here_doc_memfd(const char *data, size_t len);
+
+/*
+ * Opens the memfd again, with its own offset so every run reads it whole.
+ */
+int open_here_doc(int fd);
+
+/*
+ * Makes the here-doc the stdin of the (forked) process.
+ */
+void install_here_doc(int fd);
+
+/*
+ * Reads the delimiter after `<<` (or the word after `<<<`), quoted or not,
+ * from `line` at `i` up to `len`. Returns the index following it, or -1 when
+ * there's no word.
+ */
+int read_here_doc_word(char *line, int i, int len, char **word);
+
+/*
+ * Whether every here-document opened by the first line of `text` is
+ * terminated in the lines following it, readers keep adding lines until then.
+ */
+bool here_docs_complete(char *text);
+
+#endif
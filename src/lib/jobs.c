@@ -0,0 +1,372 @@
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "alloc_stats.h"
+#include "handlers.h"
+#include "jobs.h"
+#include "stats.h"
+#include "util/string_util/string_util.h"
+
+#define ALLOC_TAG ExecAlloc
+
+void jobs_usage() {
+    fprintf(stderr, "usage: jobs [-v [--interval MS] [--watch]]\n");
+}
+
+/*
+ * The process groups of the background children, without duplicates. A child
+ * left in the shell's group (its leader exited before it joined) is sampled
+ * alone, see is_tracked.
+ */
+unsigned int tracked_pgids(pid_t *pgids) {
+    unsigned int i, j, len = 0;
+    pid_t shell_pgid = getpgrp();
+    for (i = 0; i < MAX_BG_CHILDREN; i++) {
+        pid_t pgid;
+        if (!bg_children[i] || (pgid = getpgid(bg_children[i])) == -1 || pgid == shell_pgid) {
+            continue;
+        }
+        for (j = 0; j < len && pgids[j] != pgid; j++);
+        if (j == len) {
+            pgids[len++] = pgid;
+        }
+    }
+    return len;
+}
+
+bool is_tracked(pid_t *pgids, unsigned int pgids_len, JobSample *sample) {
+    unsigned int i;
+    for (i = 0; i < pgids_len; i++) {
+        if (pgids[i] == sample->pgid) {
+            return true;
+        }
+    }
+    for (i = 0; i < MAX_BG_CHILDREN; i++) {
+        if (bg_children[i] == sample->pid) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Index of the pid in the sorted array, or where it would be inserted.
+ */
+unsigned int pid_index(pid_t *pids, unsigned int len, size_t stride, pid_t pid) {
+    unsigned int low = 0, high = len;
+    while (low < high) {
+        unsigned int mid = (low + high) / 2;
+        pid_t mid_pid = *(pid_t *) ((char *) pids + mid * stride);
+        if (mid_pid < pid) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+bool read_proc_file(int fd, char *buf, size_t size) {
+    ssize_t read_len = pread(fd, buf, size - 1, 0);
+    if (read_len <= 0) {
+        return false;
+    }
+    buf[read_len] = '\0';
+    return true;
+}
+
+bool parse_stat(char *buf, JobSample *sample) {
+    char *comm_start = strchr(buf, '('), *comm_end = strrchr(buf, ')');
+    if (comm_start == NULL || comm_end == NULL || comm_end < comm_start) {
+        return false;
+    }
+    size_t comm_len = comm_end - comm_start - 1;
+    if (comm_len >= JOBS_COMM_LEN) {
+        comm_len = JOBS_COMM_LEN - 1;
+    }
+    memcpy(sample->comm, comm_start + 1, comm_len);
+    sample->comm[comm_len] = '\0';
+    unsigned long long utime, stime;
+    if (sscanf(comm_end + 1, " %c %*d %d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu",
+               &sample->state, &sample->pgid, &utime, &stime) != 4) {
+        return false;
+    }
+    sample->cpu_ticks = utime + stime;
+    return true;
+}
+
+/*
+ * Reads the three files of the sample, returns false once the process is gone.
+ */
+bool read_sample(JobSample *sample, uint64_t elapsed_ns) {
+    char buf[1024];
+    uint64_t cpu_ticks = sample->cpu_ticks;
+    if (!read_proc_file(sample->stat_fd, buf, sizeof(buf)) || !parse_stat(buf, sample)) {
+        return false;
+    }
+    if (read_proc_file(sample->statm_fd, buf, sizeof(buf))) {
+        sscanf(buf, "%*s %ld", &sample->rss_pages);
+    }
+    uint64_t read_bytes = sample->read_bytes, write_bytes = sample->write_bytes;
+    unsigned long long rchar, wchar;
+    if (sample->io_fd != -1 && read_proc_file(sample->io_fd, buf, sizeof(buf)) &&
+        sscanf(buf, "rchar: %llu wchar: %llu", &rchar, &wchar) == 2) {
+        sample->read_bytes = rchar;
+        sample->write_bytes = wchar;
+    }
+    if (elapsed_ns) {
+        double seconds = (double) elapsed_ns / 1e9;
+        sample->cpu_percent = (double) (sample->cpu_ticks - cpu_ticks) /
+                              (double) sysconf(_SC_CLK_TCK) / seconds * 100;
+        sample->read_rate = (double) (sample->read_bytes - read_bytes) / seconds;
+        sample->write_rate = (double) (sample->write_bytes - write_bytes) / seconds;
+        sample->has_rates = true;
+    }
+    return true;
+}
+
+int open_proc_file(pid_t pid, char *name) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/%s", pid, name);
+    return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+void close_sample(JobSample *sample) {
+    close(sample->stat_fd);
+    close(sample->statm_fd);
+    if (sample->io_fd != -1) {
+        close(sample->io_fd);
+    }
+}
+
+void add_foreign(JobsMonitor *monitor, pid_t pid) {
+    if (monitor->foreign_len == monitor->foreign_capacity) {
+        monitor->foreign_capacity = monitor->foreign_capacity ? monitor->foreign_capacity * 2 : 64;
+        monitor->foreign = realloc(monitor->foreign, sizeof(pid_t) * monitor->foreign_capacity);
+    }
+    unsigned int i = pid_index(monitor->foreign, monitor->foreign_len, sizeof(pid_t), pid);
+    memmove(monitor->foreign + i + 1, monitor->foreign + i,
+            sizeof(pid_t) * (monitor->foreign_len - i));
+    monitor->foreign[i] = pid;
+    monitor->foreign_len++;
+}
+
+/*
+ * Starts sampling the process when it's in one of the groups, it's remembered
+ * as foreign otherwise.
+ */
+void open_sample(JobsMonitor *monitor, pid_t pid, pid_t *pgids, unsigned int pgids_len) {
+    JobSample sample = {0};
+    sample.pid = pid;
+    if ((sample.stat_fd = open_proc_file(pid, "stat")) == -1) {
+        return;
+    }
+    char buf[1024];
+    if (!read_proc_file(sample.stat_fd, buf, sizeof(buf)) || !parse_stat(buf, &sample)) {
+        close(sample.stat_fd);
+        return;
+    }
+    if (!is_tracked(pgids, pgids_len, &sample)) {
+        close(sample.stat_fd);
+        add_foreign(monitor, pid);
+        return;
+    }
+    if ((sample.statm_fd = open_proc_file(pid, "statm")) == -1) {
+        close(sample.stat_fd);
+        return;
+    }
+    sample.io_fd = open_proc_file(pid, "io");
+    read_sample(&sample, 0);
+    if (monitor->samples_len == monitor->samples_capacity) {
+        monitor->samples_capacity = monitor->samples_capacity ? monitor->samples_capacity * 2 : 16;
+        monitor->samples = realloc(monitor->samples,
+                                   sizeof(JobSample) * monitor->samples_capacity);
+    }
+    unsigned int i = pid_index((pid_t *) monitor->samples, monitor->samples_len,
+                               sizeof(JobSample), pid);
+    memmove(monitor->samples + i + 1, monitor->samples + i,
+            sizeof(JobSample) * (monitor->samples_len - i));
+    monitor->samples[i] = sample;
+    monitor->samples_len++;
+}
+
+void sample_jobs(JobsMonitor *monitor) {
+    pid_t pgids[MAX_BG_CHILDREN];
+    unsigned int pgids_len = tracked_pgids(pgids), i, kept = 0;
+    uint64_t now = stats_now();
+    uint64_t elapsed = monitor->sampled_at ? now - monitor->sampled_at : 0;
+    monitor->sampled_at = now;
+    for (i = 0; i < monitor->samples_len; i++) {
+        JobSample *sample = &monitor->samples[i];
+        if (!read_sample(sample, elapsed) || !is_tracked(pgids, pgids_len, sample)) {
+            close_sample(sample);
+            continue;
+        }
+        monitor->samples[kept++] = *sample;
+    }
+    monitor->samples_len = kept;
+    if (monitor->samples_taken++ % JOBS_FOREIGN_RESCAN == 0) {
+        // A pid may have been reused, or moved to a group since
+        monitor->foreign_len = 0;
+    }
+    if (!background_jobs_count()) {
+        return;
+    }
+    DIR *proc = opendir("/proc");
+    if (proc == NULL) {
+        perror("jobs: opendir /proc failed");
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(proc)) != NULL) {
+        if (!isdigit((unsigned char) entry->d_name[0])) {
+            continue;
+        }
+        pid_t pid = (pid_t) strtol(entry->d_name, NULL, 10);
+        unsigned int sample_i = pid_index((pid_t *) monitor->samples, monitor->samples_len,
+                                          sizeof(JobSample), pid);
+        unsigned int foreign_i = pid_index(monitor->foreign, monitor->foreign_len,
+                                           sizeof(pid_t), pid);
+        if ((sample_i < monitor->samples_len && monitor->samples[sample_i].pid == pid) ||
+            (foreign_i < monitor->foreign_len && monitor->foreign[foreign_i] == pid)) {
+            continue;
+        }
+        open_sample(monitor, pid, pgids, pgids_len);
+    }
+    closedir(proc);
+}
+
+void format_bytes(double bytes, char *buf, size_t size) {
+    const char *units = "BKMGT";
+    unsigned int unit = 0;
+    while (bytes >= 1024 && unit < 4) {
+        bytes /= 1024;
+        unit++;
+    }
+    snprintf(buf, size, unit ? "%.1f%c" : "%.0f%c", bytes, units[unit]);
+}
+
+/*
+ * Prints a row per process, grouped by job, returns the number of lines.
+ */
+unsigned int print_samples(JobsMonitor *monitor, bool in_place) {
+    char *line_end = in_place ? "\x1b[K\n" : "\n";
+    printf("%7s %7s S %6s %8s %9s %9s  COMMAND%s", "PGID", "PID", "CPU%", "RSS", "READ/s",
+           "WRITE/s", line_end);
+    long page_size = sysconf(_SC_PAGESIZE);
+    unsigned int lines = 1, i, j;
+    for (i = 0; i < monitor->samples_len; i++) {
+        pid_t pgid = monitor->samples[i].pgid;
+        // Each group is printed with its first process
+        for (j = 0; j < i && monitor->samples[j].pgid != pgid; j++);
+        if (j < i) {
+            continue;
+        }
+        for (j = i; j < monitor->samples_len; j++) {
+            JobSample *sample = &monitor->samples[j];
+            if (sample->pgid != pgid) {
+                continue;
+            }
+            char cpu[16] = "-", rss[16], read_rate[16] = "-", write_rate[16] = "-";
+            format_bytes((double) sample->rss_pages * page_size, rss, sizeof(rss));
+            if (sample->has_rates) {
+                snprintf(cpu, sizeof(cpu), "%.1f", sample->cpu_percent);
+                if (sample->io_fd != -1) {
+                    format_bytes(sample->read_rate, read_rate, sizeof(read_rate));
+                    format_bytes(sample->write_rate, write_rate, sizeof(write_rate));
+                }
+            }
+            printf("%7d %7d %c %6s %8s %9s %9s  %s%s", pgid, sample->pid, sample->state, cpu,
+                   rss, read_rate, write_rate, sample->comm, line_end);
+            lines++;
+        }
+    }
+    if (in_place) {
+        printf("\x1b[J");
+    }
+    fflush(stdout);
+    return lines;
+}
+
+/*
+ * Returns false when interrupted.
+ */
+bool wait_interval(long interval, sig_atomic_t interrupts) {
+    uint64_t until = stats_now() + (uint64_t) interval * 1000000;
+    uint64_t now;
+    while (sig_int_count == interrupts && (now = stats_now()) < until) {
+        poll(NULL, 0, (int) ((until - now + 999999) / 1000000));
+    }
+    return sig_int_count == interrupts;
+}
+
+void drop_jobs_monitor(JobsMonitor *monitor) {
+    unsigned int i;
+    for (i = 0; i < monitor->samples_len; i++) {
+        close_sample(&monitor->samples[i]);
+    }
+    free(monitor->samples);
+    free(monitor->foreign);
+}
+
+void list_jobs() {
+    unsigned int i, n = 0;
+    for (i = 0; i < MAX_BG_CHILDREN; i++) {
+        if (bg_children[i]) {
+            printf("[%u] %d Running\n", ++n, bg_children[i]);
+        }
+    }
+}
+
+int jobs_builtin(ShellState *state, ExecArgs *exec_args) {
+    (void) state;
+    char **argv = exec_args->argv;
+    unsigned int argc = exec_args->argc, i;
+    bool verbose = false, watch = false;
+    long interval = JOBS_DEFAULT_INTERVAL_MS;
+    for (i = 1; i < argc; i++) {
+        if (str_equals(argv[i], "-v")) {
+            verbose = true;
+        } else if (str_equals(argv[i], "--watch")) {
+            watch = true;
+        } else if (str_equals(argv[i], "--interval") && i + 1 < argc) {
+            char *end;
+            interval = strtol(argv[++i], &end, 10);
+            if (*end || interval <= 0) {
+                jobs_usage();
+                return 2;
+            }
+        } else {
+            jobs_usage();
+            return 2;
+        }
+    }
+    if (!verbose) {
+        list_jobs();
+        return 0;
+    }
+    JobsMonitor monitor = {0};
+    sig_atomic_t interrupts = sig_int_count;
+    // Rates need a first sample to compare with
+    sample_jobs(&monitor);
+    unsigned int lines = 0;
+    while (wait_interval(interval, interrupts)) {
+        sample_jobs(&monitor);
+        if (lines) {
+            printf("\x1b[%uA", lines);
+        }
+        lines = print_samples(&monitor, watch);
+        if (!watch || !monitor.samples_len) {
+            break;
+        }
+    }
+    drop_jobs_monitor(&monitor);
+    return 0;
+}
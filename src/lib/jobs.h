@@ -0,0 +1,59 @@
+#ifndef LIB_JOBS_H
+#define LIB_JOBS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "lib.h"
+
+#define JOBS_DEFAULT_INTERVAL_MS 1000
+// Pids found outside the tracked groups are checked again after this many samples
+#define JOBS_FOREIGN_RESCAN 10
+#define JOBS_COMM_LEN 64
+
+/*
+ * `jobs` lists the background jobs, `jobs -v` samples every process of their
+ * process groups: CPU %, RSS, bytes read and written per second (rchar and
+ * wchar, what went through read and write) and state. With `--watch` the view
+ * is refreshed in place every `--interval MS` until interrupted or the jobs
+ * are done.
+ *
+ * The stat, statm and io files of a process are opened the first time it's
+ * found and re-read with pread afterwards. A sample only lists /proc to find
+ * new processes, the pids known to be in no tracked group aren't opened again.
+ */
+typedef struct jobSample {
+    pid_t pid;
+    pid_t pgid;
+    int stat_fd;
+    int statm_fd;
+    // -1 when the io file can't be read, as for a setuid helper
+    int io_fd;
+    char state;
+    char comm[JOBS_COMM_LEN];
+    uint64_t cpu_ticks;
+    uint64_t read_bytes;
+    uint64_t write_bytes;
+    long rss_pages;
+    double cpu_percent;
+    double read_rate;
+    double write_rate;
+    // Whether the rates are known, they need two samples
+    bool has_rates;
+    bool found;
+} JobSample;
+
+typedef struct jobsMonitor {
+    JobSample *samples;
+    unsigned int samples_len;
+    unsigned int samples_capacity;
+    // Sorted
+    pid_t *foreign;
+    unsigned int foreign_len;
+    unsigned int foreign_capacity;
+    unsigned int samples_taken;
+    uint64_t sampled_at;
+} JobsMonitor;
+
+int jobs_builtin(ShellState *state, ExecArgs *exec_args);
+
+#endif
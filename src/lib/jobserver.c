@@ -0,0 +1,288 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "alloc_stats.h"
+#include "handlers.h"
+#include "jobserver.h"
+
+#define ALLOC_TAG ExecAlloc
+
+int jobserver_read_fd = -1;
+int jobserver_write_fd = -1;
+// A non blocking description of the read end of its own, the one shared with
+// make and the children keeps its flags. The read end itself if it can't be
+// reopened.
+int token_read_fd = -1;
+// Whether the fds were opened here, from a fifo or as the pool of VSH_JOBSERVER
+bool owns_jobserver_fds = false;
+struct {
+    pid_t pid;
+    int token;
+} held_tokens[JOBSERVER_MAX_HELD];
+// The child running in the implicit slot, 0 when it's free and -1 once it's
+// taken by a member not started yet
+pid_t implicit_slot_pid = 0;
+// The held tokens are copied by a fork, only this process gives them back
+pid_t jobserver_pid = 0;
+
+bool is_open_fd(int fd) { return fd >= 0 && fcntl(fd, F_GETFD) != -1; }
+
+/*
+ * Joins the pool of the last `--jobserver-auth` (or pre 4.2 `--jobserver-fds`)
+ * of MAKEFLAGS, make drops the fds for the recipes not marked with `+`.
+ */
+bool join_make_jobserver(char *makeflags) {
+    char *auth = NULL, *found = makeflags;
+    while ((found = strstr(found, "--jobserver-")) != NULL) {
+        if (!strncmp(found, "--jobserver-auth=", 17) || !strncmp(found, "--jobserver-fds=", 16)) {
+            auth = strchr(found, '=') + 1;
+        }
+        found++;
+    }
+    if (auth == NULL) {
+        return false;
+    }
+    if (!strncmp(auth, "fifo:", 5)) {
+        char *path = strndup(auth + 5, strcspn(auth + 5, " "));
+        int fd = open(path, O_RDWR | O_CLOEXEC);
+        free(path);
+        if (fd == -1) {
+            return false;
+        }
+        jobserver_read_fd = jobserver_write_fd = fd;
+        owns_jobserver_fds = true;
+        return true;
+    }
+    int read_fd, write_fd;
+    if (sscanf(auth, "%d,%d", &read_fd, &write_fd) != 2 || !is_open_fd(read_fd) ||
+        !is_open_fd(write_fd)) {
+        return false;
+    }
+    jobserver_read_fd = read_fd;
+    jobserver_write_fd = write_fd;
+    return true;
+}
+
+/*
+ * The pool of VSH_JOBSERVER, a pipe the children inherit as make's does.
+ */
+void start_jobserver(char *slots_env) {
+    char *end;
+    long slots = strtol(slots_env, &end, 10);
+    if (*end || slots < 1) {
+        fprintf(stderr, "vsh: VSH_JOBSERVER must be a number of slots, got '%s'\n", slots_env);
+        return;
+    }
+    int fds[2];
+    if (pipe(fds) == -1) {
+        perror("vsh: jobserver pipe failed");
+        return;
+    }
+    long i;
+    for (i = 1; i < slots; i++) {
+        if (write(fds[1], "+", 1) != 1) {
+            perror("vsh: jobserver pipe is full");
+            break;
+        }
+    }
+    jobserver_read_fd = fds[0];
+    jobserver_write_fd = fds[1];
+    owns_jobserver_fds = true;
+    char *makeflags = getenv("MAKEFLAGS");
+    char value[64 + (makeflags != NULL ? strlen(makeflags) : 0)];
+    snprintf(value, sizeof(value), "%s -j%ld --jobserver-auth=%d,%d",
+             makeflags != NULL ? makeflags : "", slots, fds[0], fds[1]);
+    setenv("MAKEFLAGS", value, 1);
+}
+
+/*
+ * Another client can win the byte poll saw, a blocking read would then wait
+ * for the next free slot without looking at SIGINT or the held slots.
+ */
+void open_token_read_fd() {
+    char path[32];
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", jobserver_read_fd);
+    token_read_fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (token_read_fd == -1) {
+        token_read_fd = jobserver_read_fd;
+    }
+}
+
+void init_jobserver() {
+    jobserver_pid = getpid();
+    char *makeflags = getenv("MAKEFLAGS"), *slots_env = getenv("VSH_JOBSERVER");
+    // A pool already shared by an outer make or vsh is joined instead
+    if (makeflags != NULL && join_make_jobserver(makeflags)) {
+        open_token_read_fd();
+        return;
+    }
+    if (slots_env != NULL) {
+        start_jobserver(slots_env);
+    }
+    if (jobserver_enabled()) {
+        open_token_read_fd();
+    }
+}
+
+bool jobserver_enabled() { return jobserver_read_fd != -1; }
+
+bool read_token(int *token) {
+    unsigned char byte;
+    if (read(token_read_fd, &byte, 1) == 1) {
+        *token = byte;
+        return true;
+    }
+    return false;
+}
+
+bool claim_implicit_slot() {
+    pid_t free_slot = 0;
+    return __atomic_compare_exchange_n(&implicit_slot_pid, &free_slot, -1, false,
+                                       __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+bool has_exited(pid_t pid) {
+    siginfo_t info;
+    info.si_pid = 0;
+    return pid > 0 && waitid(P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT) != -1 &&
+           info.si_pid;
+}
+
+/*
+ * The members of a group are only waited once all of them started, the slots
+ * of those that already exited are given back without reaping them.
+ */
+void release_exited_held() {
+    unsigned int i;
+    for (i = 0; i < JOBSERVER_MAX_HELD; i++) {
+        pid_t pid = held_tokens[i].pid;
+        if (has_exited(pid)) {
+            jobserver_release_held(pid);
+        }
+    }
+    pid_t implicit = implicit_slot_pid;
+    if (has_exited(implicit)) {
+        jobserver_release_held(implicit);
+    }
+}
+
+bool jobserver_acquire(int *token) {
+    *token = JOBSERVER_NO_TOKEN;
+    if (!jobserver_enabled()) {
+        return true;
+    }
+    sig_atomic_t interrupts = sig_int_count;
+    // Without a slot read_token fails with EAGAIN and the wait goes on
+    struct pollfd fd = {token_read_fd, POLLIN, 0};
+    while (sig_int_count == interrupts) {
+        release_exited_held();
+        if (claim_implicit_slot()) {
+            *token = JOBSERVER_IMPLICIT_TOKEN;
+            return true;
+        }
+        if (poll(&fd, 1, JOBSERVER_POLL_MS) == -1 && errno != EINTR) {
+            perror("vsh: jobserver poll failed");
+            return true;
+        }
+        if (fd.revents & POLLIN) {
+            if (read_token(token)) {
+                return true;
+            }
+        }
+        if (fd.revents & ~POLLIN) {
+            // The pool is gone, the member runs without a slot
+            return true;
+        }
+    }
+    return false;
+}
+
+bool jobserver_try_acquire(int *token) {
+    *token = JOBSERVER_NO_TOKEN;
+    if (!jobserver_enabled()) {
+        return true;
+    }
+    if (claim_implicit_slot()) {
+        *token = JOBSERVER_IMPLICIT_TOKEN;
+        return true;
+    }
+    struct pollfd fd = {token_read_fd, POLLIN, 0};
+    return poll(&fd, 1, 0) == 1 && (fd.revents & POLLIN) && read_token(token);
+}
+
+void jobserver_release(int token) {
+    if (token == JOBSERVER_IMPLICIT_TOKEN) {
+        __atomic_store_n(&implicit_slot_pid, 0, __ATOMIC_SEQ_CST);
+        return;
+    }
+    if (token == JOBSERVER_NO_TOKEN || jobserver_write_fd == -1) {
+        return;
+    }
+    unsigned char byte = (unsigned char) token;
+    while (write(jobserver_write_fd, &byte, 1) == -1 && errno == EINTR);
+}
+
+void jobserver_hold(pid_t pid, int token) {
+    if (token == JOBSERVER_NO_TOKEN) {
+        return;
+    }
+    if (token == JOBSERVER_IMPLICIT_TOKEN) {
+        __atomic_store_n(&implicit_slot_pid, pid, __ATOMIC_SEQ_CST);
+        return;
+    }
+    unsigned int i;
+    for (i = 0; i < JOBSERVER_MAX_HELD; i++) {
+        if (!held_tokens[i].pid) {
+            held_tokens[i].token = token;
+            held_tokens[i].pid = pid;
+            return;
+        }
+    }
+    // Nowhere to remember it, the slot is given back right away
+    jobserver_release(token);
+}
+
+void jobserver_release_held(pid_t pid) {
+    unsigned int i;
+    pid_t implicit = pid;
+    if (pid > 0 && __atomic_compare_exchange_n(&implicit_slot_pid, &implicit, 0, false,
+                                               __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+        return;
+    }
+    for (i = 0; i < JOBSERVER_MAX_HELD; i++) {
+        pid_t held = pid;
+        // Also called by the SIGCHLD handler, only the one clearing it releases
+        if (pid && __atomic_compare_exchange_n(&held_tokens[i].pid, &held, 0, false,
+                                               __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+            jobserver_release(held_tokens[i].token);
+            return;
+        }
+    }
+}
+
+/*
+ * The members still running when the shell leaves give their slots back now,
+ * the pool would be short of them for good otherwise.
+ */
+void drop_jobserver() {
+    unsigned int i;
+    for (i = 0; jobserver_pid == getpid() && i < JOBSERVER_MAX_HELD; i++) {
+        jobserver_release_held(held_tokens[i].pid);
+    }
+    if (token_read_fd != jobserver_read_fd) {
+        close(token_read_fd);
+    }
+    if (owns_jobserver_fds) {
+        if (jobserver_write_fd != jobserver_read_fd) {
+            close(jobserver_write_fd);
+        }
+        close(jobserver_read_fd);
+    }
+    jobserver_read_fd = jobserver_write_fd = token_read_fd = -1;
+}
@@ -0,0 +1,53 @@
+#ifndef LIB_JOBSERVER_H
+#define LIB_JOBSERVER_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#define JOBSERVER_NO_TOKEN (-1)
+// The slot the shell owns without a byte in the pool
+#define JOBSERVER_IMPLICIT_TOKEN (-2)
+#define JOBSERVER_MAX_HELD 256
+// How often a blocked acquire looks for members that exited meanwhile
+#define JOBSERVER_POLL_MS 50
+
+/*
+ * GNU make's jobserver: a pipe (or a fifo) holding one byte per job slot of
+ * a shared pool. Every process owns one implicit slot, the members a `&`
+ * group or `batch -j` starts run in it while it's free and take a byte
+ * otherwise, writing the same byte back once reaped. The implicit slot is
+ * free again once the member running in it is reaped.
+ *
+ * vsh joins the pool named by the `--jobserver-auth=R,W` (or `fifo:PATH`) of
+ * MAKEFLAGS, so it's a client when run under `make -jN`. Otherwise, with
+ * VSH_JOBSERVER=N, it creates a pool of N slots and exports it through
+ * MAKEFLAGS, its children (nested makes and shells) then draw from it too.
+ */
+void init_jobserver();
+
+bool jobserver_enabled();
+
+/*
+ * Blocks until a slot is free, returns false when interrupted by SIGINT.
+ * The token is JOBSERVER_NO_TOKEN without a jobserver, and
+ * JOBSERVER_IMPLICIT_TOKEN for the implicit slot.
+ */
+bool jobserver_acquire(int *token);
+
+bool jobserver_try_acquire(int *token);
+
+/*
+ * Async-signal-safe, it's called by the SIGCHLD handler.
+ */
+void jobserver_release(int token);
+
+/*
+ * The token is released once the child is, see jobserver_release_held.
+ */
+void jobserver_hold(pid_t pid, int token);
+
+void jobserver_release_held(pid_t pid);
+
+void drop_jobserver();
+
+#endif
@@ -0,0 +1,204 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "alloc_stats.h"
+#include "launch.h"
+#include "rlimits.h"
+#include "util/string_util/string_util.h"
+
+#define ALLOC_TAG ExecAlloc
+
+void init_launch_attrs(LaunchAttrs *attrs) {
+    attrs->has_cpus = false;
+    CPU_ZERO(&attrs->cpus);
+    attrs->has_nice = false;
+    attrs->nice = 0;
+    attrs->ioprio = -1;
+    attrs->rlimits_len = 0;
+}
+
+bool parse_cpu_list(char *list, cpu_set_t *cpus) {
+    CPU_ZERO(cpus);
+    char *cursor = list;
+    while (*cursor) {
+        char *end;
+        long first = strtol(cursor, &end, 10), last = first;
+        if (end == cursor || first < 0) {
+            return false;
+        }
+        if (*end == '-') {
+            cursor = end + 1;
+            last = strtol(cursor, &end, 10);
+            if (end == cursor || last < first) {
+                return false;
+            }
+        }
+        if (last >= CPU_SETSIZE || (*end && *end != ',')) {
+            return false;
+        }
+        for (; first <= last; first++) {
+            CPU_SET(first, cpus);
+        }
+        cursor = *end ? end + 1 : end;
+    }
+    return CPU_COUNT(cpus) > 0;
+}
+
+bool parse_int(char *str, int min, int max, int *out) {
+    char *end;
+    long value = strtol(str, &end, 10);
+    if (!*str || *end || value < min || value > max) {
+        return false;
+    }
+    *out = (int) value;
+    return true;
+}
+
+int parse_ioprio_class(char *str) {
+    int class;
+    if (str_equals(str, "realtime")) {
+        return 1;
+    } else if (str_equals(str, "best-effort")) {
+        return 2;
+    } else if (str_equals(str, "idle")) {
+        return 3;
+    }
+    return parse_int(str, 0, 3, &class) ? class : -1;
+}
+
+/*
+ * Returns the amount of words of the prefix at argv, or 0 if there isn't one.
+ */
+unsigned int take_launch_prefix(LaunchAttrs *attrs, char **argv, unsigned int argc) {
+    if (str_equals(argv[0], "pin")) {
+        if (argc < 2 || !parse_cpu_list(argv[1], &attrs->cpus)) {
+            return 0;
+        }
+        attrs->has_cpus = true;
+        return 2;
+    } else if (str_equals(argv[0], "nice")) {
+        // Like nice(1) the default adjustment is 10
+        int adjustment = 10;
+        unsigned int words = 1;
+        if (argc > 2 && str_equals(argv[1], "-n")) {
+            if (!parse_int(argv[2], -40, 40, &adjustment)) {
+                return 0;
+            }
+            words = 3;
+        }
+        attrs->has_nice = true;
+        attrs->nice = adjustment;
+        return words;
+    } else if (str_equals(argv[0], "ionice")) {
+        if (argc < 3 || !str_equals(argv[1], "-c")) {
+            return 0;
+        }
+        int class = parse_ioprio_class(argv[2]), level = IOPRIO_DEFAULT_LEVEL;
+        if (class < 0) {
+            return 0;
+        }
+        unsigned int words = 3;
+        if (argc > 4 && str_equals(argv[3], "-n")) {
+            if (!parse_int(argv[4], 0, 7, &level)) {
+                return 0;
+            }
+            words = 5;
+        }
+        attrs->ioprio = (class << IOPRIO_CLASS_SHIFT) | (class == 3 ? 0 : level);
+        return words;
+    } else if (str_equals(argv[0], "ulimit")) {
+        unsigned int words = 1;
+        while (words + 1 < argc && argv[words][0] == '-' && strlen(argv[words]) == 2) {
+            RlimitInfo *info = find_rlimit(argv[words][1]);
+            rlim_t value;
+            if (info == NULL || !parse_rlimit_value(info, argv[words + 1], &value)) {
+                return 0;
+            }
+            LaunchRlimit *rlimit = NULL;
+            unsigned int i;
+            for (i = 0; i < attrs->rlimits_len && rlimit == NULL; i++) {
+                if (attrs->rlimits[i].resource == info->resource) {
+                    rlimit = &attrs->rlimits[i];
+                }
+            }
+            if (rlimit == NULL) {
+                rlimit = &attrs->rlimits[attrs->rlimits_len++];
+            }
+            *rlimit = (LaunchRlimit) {info->flag, info->resource, value};
+            words += 2;
+        }
+        return words > 1 ? words : 0;
+    }
+    return 0;
+}
+
+void take_launch_prefixes(LaunchAttrs *attrs, char **argv, unsigned int *argc) {
+    unsigned int taken = 0, words;
+    LaunchAttrs parsed = *attrs;
+    while (taken < *argc && (words = take_launch_prefix(&parsed, argv + taken, *argc - taken))) {
+        taken += words;
+    }
+    if (!taken || taken >= *argc) {
+        return;
+    }
+    *attrs = parsed;
+    unsigned int i;
+    for (i = 0; i < taken; i++) {
+        free(argv[i]);
+    }
+    memmove(argv, argv + taken, sizeof(char *) * (*argc - taken + 1));
+    *argc -= taken;
+}
+
+void spread_launch_attrs(LaunchAttrs *attrs, cpu_set_t *cpus, unsigned int i) {
+    if (attrs->has_cpus) {
+        return;
+    }
+    unsigned int nth = i % CPU_COUNT(cpus), cpu;
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, cpus) && !nth--) {
+            break;
+        }
+    }
+    CPU_ZERO(&attrs->cpus);
+    CPU_SET(cpu, &attrs->cpus);
+    attrs->has_cpus = true;
+}
+
+void apply_launch_attrs(LaunchAttrs *attrs) {
+    unsigned int i;
+    for (i = 0; i < attrs->rlimits_len; i++) {
+        struct rlimit limit = {attrs->rlimits[i].value, attrs->rlimits[i].value};
+        if (limit.rlim_max != RLIM_INFINITY && attrs->rlimits[i].resource == RLIMIT_CPU) {
+            // A second of margin so SIGXCPU is sent before the SIGKILL of the hard limit
+            limit.rlim_max += 1;
+        }
+        if (setrlimit(attrs->rlimits[i].resource, &limit) == -1) {
+            fprintf(stderr, "ulimit: -%c: %s\n", attrs->rlimits[i].flag, strerror(errno));
+            _exit(126);
+        }
+    }
+    if (attrs->has_cpus && sched_setaffinity(0, sizeof(cpu_set_t), &attrs->cpus) == -1) {
+        // As taskset does, the command isn't run outside of the requested cpus
+        perror("pin: sched_setaffinity failed");
+        _exit(126);
+    }
+    if (attrs->has_nice) {
+        errno = 0;
+        int current = getpriority(PRIO_PROCESS, 0);
+        if ((current != -1 || !errno) &&
+            setpriority(PRIO_PROCESS, 0, current + attrs->nice) == -1) {
+            perror("nice: setpriority failed");
+        }
+    }
+    if (attrs->ioprio != -1 &&
+        syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, attrs->ioprio) == -1) {
+        perror("ionice: ioprio_set failed");
+    }
+    init_launch_attrs(attrs);
+}
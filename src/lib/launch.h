@@ -0,0 +1,59 @@
+#ifndef LIB_LAUNCH_H
+#define LIB_LAUNCH_H
+
+#include <sched.h>
+#include <stdbool.h>
+#include <sys/resource.h>
+
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_DEFAULT_LEVEL 4
+#define LAUNCH_MAX_RLIMITS 9
+
+typedef struct launchRlimit {
+    char flag;
+    int resource;
+    rlim_t value;
+} LaunchRlimit;
+
+/*
+ * Scheduling attributes applied by the child between fork and exec, set with
+ * the `pin CPUS`, `nice [-n N]`, `ionice -c CLASS [-n LEVEL]` and
+ * `ulimit -FLAG VALUE...` prefixes.
+ */
+typedef struct launchAttrs {
+    bool has_cpus;
+    cpu_set_t cpus;
+    bool has_nice;
+    int nice;
+    // -1 keeps the inherited I/O priority
+    int ioprio;
+    LaunchRlimit rlimits[LAUNCH_MAX_RLIMITS];
+    unsigned int rlimits_len;
+} LaunchAttrs;
+
+void init_launch_attrs(LaunchAttrs *attrs);
+
+/*
+ * Parses a cpu list like "0-3,6" into the set, returning false when it's invalid.
+ */
+bool parse_cpu_list(char *list, cpu_set_t *cpus);
+
+/*
+ * Removes the leading launch prefixes of argv storing them in attrs. argv is
+ * left as is when they're malformed or nothing follows them, so the programs
+ * with the same names still run.
+ */
+void take_launch_prefixes(LaunchAttrs *attrs, char **argv, unsigned int *argc);
+
+/*
+ * Sets the i-th cpu of the list as the affinity unless the command was pinned.
+ */
+void spread_launch_attrs(LaunchAttrs *attrs, cpu_set_t *cpus, unsigned int i);
+
+/*
+ * Called in the child, the attrs are cleared so applying them twice is harmless.
+ */
+void apply_launch_attrs(LaunchAttrs *attrs);
+
+#endif
@@ -0,0 +1,331 @@
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "alloc_stats.h"
+#include "launcher.h"
+#include "line_editor.h"
+#include "process.h"
+#include "stats.h"
+#include "util/string_util/string_util.h"
+
+#define ALLOC_TAG ExecAlloc
+
+extern char **environ;
+
+int launcher_fd = -1;
+pid_t launcher_pid = 0;
+// Exits read while waiting for something else
+LaunchReply pending_exits[LAUNCHER_MAX_PENDING];
+unsigned int pending_exits_len = 0;
+
+bool launcher_read(int fd, void *data, size_t len) {
+    char *cursor = data;
+    while (len > 0) {
+        ssize_t amount = read(fd, cursor, len);
+        if (amount == -1 && errno == EINTR) {
+            continue;
+        }
+        if (amount <= 0) {
+            return false;
+        }
+        cursor += amount;
+        len -= amount;
+    }
+    return true;
+}
+
+void launcher_reply(int sock, enum LaunchReplyType type, pid_t pid, int value,
+                    struct rusage *usage) {
+    LaunchReply reply;
+    memset(&reply, 0, sizeof(reply));
+    reply.type = type;
+    reply.pid = pid;
+    reply.value = value;
+    if (usage != NULL) {
+        reply.usage = *usage;
+    }
+    write_all(sock, (char *) &reply, sizeof(reply));
+}
+
+void launcher_exec(LaunchRequest *request, char *payload, int *fds, uint64_t forked_at) {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigprocmask(SIG_SETMASK, &signals, NULL);
+    // The ignored signals would stay ignored through exec
+    int reset[] = {SIGINT, SIGQUIT, SIGUSR1, SIGUSR2, SIGTSTP, SIGCHLD, SIGPIPE};
+    unsigned int i;
+    for (i = 0; i < sizeof(reset) / sizeof(int); i++) {
+        signal(reset[i], SIG_DFL);
+    }
+    if (request->pgid != -1) {
+        setpgid(0, request->pgid);
+    }
+    for (i = 0; i < 3; i++) {
+        dup2(fds[i], i);
+    }
+    char *path = payload, *cwd = path + strlen(path) + 1, *cursor = cwd + strlen(cwd) + 1;
+    char **argv = malloc(sizeof(char *) * (request->argc + 1));
+    char **envp = malloc(sizeof(char *) * (request->envc + 1));
+    for (i = 0; i < request->argc; i++, cursor += strlen(cursor) + 1) {
+        argv[i] = cursor;
+    }
+    argv[i] = NULL;
+    for (i = 0; i < request->envc; i++, cursor += strlen(cursor) + 1) {
+        envp[i] = cursor;
+    }
+    envp[i] = NULL;
+    environ = envp;
+    if (chdir(cwd) == -1) {
+        perror("vsh: chdir failed");
+    }
+    apply_launch_attrs(&request->attrs);
+    stats_record(ForkToExec, forked_at);
+    exec_program(*path ? path : NULL, argv);
+    printf("Unknown command %s\n", argv[0]);
+    fflush(stdout);
+    _exit(UNKNOWN_COMMAND_EXIT_STATUS);
+}
+
+/*
+ * Handles a single request, returns false once the shell is gone.
+ */
+bool launcher_handle_request(int sock) {
+    LaunchRequest request;
+    char control[CMSG_SPACE(sizeof(int) * 3)];
+    struct iovec iov = {&request, sizeof(request)};
+    struct msghdr message = {0};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    ssize_t amount;
+    while ((amount = recvmsg(sock, &message, MSG_CMSG_CLOEXEC)) == -1 && errno == EINTR);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+    if (amount != sizeof(request) || request.magic != LAUNCHER_MAGIC || cmsg == NULL ||
+        cmsg->cmsg_len != CMSG_LEN(sizeof(int) * 3)) {
+        return false;
+    }
+    int fds[3], i;
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+    char *payload = malloc(request.payload_len);
+    if (!launcher_read(sock, payload, request.payload_len)) {
+        return false;
+    }
+    uint64_t forked_at = stats_now();
+    pid_t pid = fork();
+    // Saved before the closes below can change it
+    int fork_error = pid == -1 ? errno : 0;
+    if (pid == 0) {
+        launcher_exec(&request, payload, fds, forked_at);
+    }
+    if (pid != -1 && request.pgid != -1) {
+        // Set from both sides, so it's done before anyone signals the group
+        setpgid(pid, request.pgid ? request.pgid : pid);
+    }
+    for (i = 0; i < 3; i++) {
+        close(fds[i]);
+    }
+    free(payload);
+    launcher_reply(sock, pid == -1 ? LaunchFailed : LaunchStarted, pid, fork_error, NULL);
+    return true;
+}
+
+void launcher_loop(int sock) {
+    int ignored[] = {SIGINT, SIGQUIT, SIGUSR1, SIGUSR2, SIGTSTP};
+    unsigned int i;
+    for (i = 0; i < sizeof(ignored) / sizeof(int); i++) {
+        signal(ignored[i], SIG_IGN);
+    }
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &signals, NULL);
+    int signal_fd = signalfd(-1, &signals, SFD_CLOEXEC);
+    struct pollfd fds[2] = {{sock, POLLIN, 0}, {signal_fd, POLLIN, 0}};
+    while (true) {
+        if (poll(fds, 2, -1) == -1) {
+            continue;
+        }
+        if (fds[1].revents & POLLIN) {
+            struct signalfd_siginfo info;
+            read(signal_fd, &info, sizeof(info));
+            pid_t pid;
+            int wait_status;
+            struct rusage usage;
+            // A stopped command is reported too, the shell waits it with WUNTRACED
+            while ((pid = wait4(-1, &wait_status, WNOHANG | WUNTRACED, &usage)) > 0) {
+                launcher_reply(sock, LaunchExited, pid, wait_status, &usage);
+            }
+        }
+        if (fds[0].revents & (POLLIN | POLLHUP) && !launcher_handle_request(sock)) {
+            _exit(0);
+        }
+    }
+}
+
+/*
+ * A forked copy of the shell leaves the launcher to the shell, so their
+ * requests and replies don't get mixed.
+ */
+void forget_launcher_in_child() {
+    if (launcher_fd != -1) {
+        close(launcher_fd);
+        launcher_fd = -1;
+    }
+    pending_exits_len = 0;
+}
+
+void start_launcher() {
+    char *env = getenv("VSH_LAUNCHER");
+    if (env == NULL || (!str_equals(env, "1") && !str_equals(env, "true"))) {
+        return;
+    }
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets) == -1) {
+        perror("vsh: the launcher couldn't be started");
+        return;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(sockets[0]);
+        launcher_loop(sockets[1]);
+    } else if (pid == -1) {
+        perror("vsh: the launcher couldn't be started");
+        close(sockets[0]);
+    } else {
+        launcher_fd = sockets[0];
+        launcher_pid = pid;
+        pthread_atfork(NULL, NULL, forget_launcher_in_child);
+    }
+    close(sockets[1]);
+}
+
+bool launcher_enabled() { return launcher_fd != -1; }
+
+void disable_launcher() {
+    fprintf(stderr, "vsh: the launcher stopped, commands are forked by the shell\n");
+    close(launcher_fd);
+    launcher_fd = -1;
+}
+
+/*
+ * Reads replies until the one of the given type and pid (any pid when 0),
+ * keeping the exits of other commands for later.
+ */
+bool launcher_read_reply(LaunchReply *reply, bool exit_of, pid_t pid) {
+    while (launcher_read(launcher_fd, reply, sizeof(LaunchReply))) {
+        if (reply->type == LaunchExited && (!exit_of || reply->pid != pid)) {
+            if (pending_exits_len < LAUNCHER_MAX_PENDING) {
+                pending_exits[pending_exits_len++] = *reply;
+            }
+            continue;
+        }
+        return true;
+    }
+    disable_launcher();
+    return false;
+}
+
+size_t payload_strings_len(char **strings, uint32_t *count) {
+    size_t len = 0;
+    for (*count = 0; strings[*count] != NULL; (*count)++) {
+        len += strlen(strings[*count]) + 1;
+    }
+    return len;
+}
+
+char *push_payload_string(char *cursor, char *str) {
+    size_t len = strlen(str) + 1;
+    memcpy(cursor, str, len);
+    return cursor + len;
+}
+
+pid_t launcher_spawn(ExecArgs *exec_args, char *resolved_path, int *fds, pid_t pgid) {
+    if (launcher_fd == -1) {
+        return -1;
+    }
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        return -1;
+    }
+    char *path = resolved_path != NULL ? resolved_path : "";
+    LaunchRequest request;
+    memset(&request, 0, sizeof(request));
+    request.magic = LAUNCHER_MAGIC;
+    request.pgid = pgid;
+    request.attrs = exec_args->attrs;
+    size_t payload_len = strlen(path) + strlen(cwd) + 2 +
+                         payload_strings_len(exec_args->argv, &request.argc) +
+                         payload_strings_len(environ, &request.envc);
+    request.payload_len = payload_len;
+    char *payload = malloc(payload_len), *cursor = payload;
+    cursor = push_payload_string(cursor, path);
+    cursor = push_payload_string(cursor, cwd);
+    unsigned int i;
+    for (i = 0; i < request.argc; i++) {
+        cursor = push_payload_string(cursor, exec_args->argv[i]);
+    }
+    for (i = 0; i < request.envc; i++) {
+        cursor = push_payload_string(cursor, environ[i]);
+    }
+    char control[CMSG_SPACE(sizeof(int) * 3)];
+    memset(control, 0, sizeof(control));
+    struct iovec iov = {&request, sizeof(request)};
+    struct msghdr message = {0};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * 3);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * 3);
+    fflush(stdout);
+    if (sendmsg(launcher_fd, &message, MSG_NOSIGNAL) != sizeof(request)) {
+        free(payload);
+        disable_launcher();
+        return -1;
+    }
+    write_all(launcher_fd, payload, payload_len);
+    free(payload);
+    LaunchReply reply;
+    if (!launcher_read_reply(&reply, false, 0)) {
+        return -1;
+    }
+    if (reply.type == LaunchFailed) {
+        errno = reply.value;
+        return -1;
+    }
+    return reply.pid;
+}
+
+pid_t launcher_wait(pid_t pid, int *wait_status, struct rusage *usage) {
+    unsigned int i;
+    LaunchReply reply;
+    bool found = false;
+    for (i = 0; i < pending_exits_len && !found; i++) {
+        if (pending_exits[i].pid == pid) {
+            reply = pending_exits[i];
+            pending_exits[i] = pending_exits[--pending_exits_len];
+            found = true;
+        }
+    }
+    if (!found && !launcher_read_reply(&reply, true, pid)) {
+        return -1;
+    }
+    *wait_status = reply.value;
+    *usage = reply.usage;
+    record_waited_usage(usage);
+    return pid;
+}
@@ -0,0 +1,61 @@
+#ifndef LIB_LAUNCHER_H
+#define LIB_LAUNCHER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/resource.h>
+#include "lib.h"
+
+#define LAUNCHER_MAGIC 0x76736c31
+#define LAUNCHER_MAX_PENDING 256
+
+/*
+ * With VSH_LAUNCHER=1 a small process is forked at startup, before the shell
+ * allocates anything big, and the foreground commands are forked by it. The
+ * cost of fork grows with the memory of the process, so launching stays as
+ * cheap as it was at startup however large the shell gets.
+ *
+ * A request carries the stdin, stdout and stderr of the command (SCM_RIGHTS)
+ * and is followed by a payload with the resolved path, the cwd, argv and the
+ * environment, all of them NUL terminated.
+ */
+typedef struct launchRequest {
+    uint32_t magic;
+    uint32_t argc;
+    uint32_t envc;
+    uint32_t payload_len;
+    // -1 keeps the group of the shell, 0 starts a new one
+    pid_t pgid;
+    LaunchAttrs attrs;
+} LaunchRequest;
+
+enum LaunchReplyType {
+    LaunchStarted,
+    LaunchFailed,
+    LaunchExited,
+};
+
+typedef struct launchReply {
+    enum LaunchReplyType type;
+    pid_t pid;
+    // errno when it failed, the wait status once it exited
+    int value;
+    struct rusage usage;
+} LaunchReply;
+
+void start_launcher();
+
+bool launcher_enabled();
+
+/*
+ * Returns the pid of the launched command, or -1 when the launcher couldn't
+ * do it (the caller forks by itself then).
+ */
+pid_t launcher_spawn(ExecArgs *exec_args, char *resolved_path, int *fds, pid_t pgid);
+
+/*
+ * Waits for a command started by the launcher, like wait_child_usage.
+ */
+pid_t launcher_wait(pid_t pid, int *wait_status, struct rusage *usage);
+
+#endif
@@ -1,4 +1,6 @@
 #include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -6,10 +8,26 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include "alloc_stats.h"
+#include "completion.h"
+#include "coproc.h"
+#include "glob_expand.h"
+#include "here_doc.h"
+#include "jobserver.h"
+#include "launcher.h"
 #include "lib.h"
+#include "line_editor.h"
+#include "loop.h"
+#include "path_cache.h"
+#include "process.h"
+#include "prompt.h"
+#include "rlimits.h"
+#include "stats.h"
 #include "util/string_util/string_util.h"
 #include "util/vec/vec.h"
 
+#define ALLOC_TAG StateAlloc
+
 /*
  * Ansi Colors for stdout color manipulation
  */
@@ -22,20 +40,20 @@ const char YellowAnsi[] = "\033[93m";
 void todo(char *msg) { printf("%sTODO: %s%s\n", YellowAnsi, msg, EndAnsi); }
 
 char *read_env(char *name) {
-    char *env = malloc(sizeof(char) * BUFFER_MAX_SIZE);
     char *env_value;
     if (!(env_value = getenv(name))) {
         fprintf(stderr, "The environment variable '%s' is not available!\n", name);
         exit(1);
     }
-    if (snprintf(env, BUFFER_MAX_SIZE, "%s", env_value) >= BUFFER_MAX_SIZE) {
+    size_t len = strlen(env_value);
+    if (len >= BUFFER_MAX_SIZE) {
         fprintf(stderr,
                 "BUFFER_MAX_SIZE wasn't enough to hold the %s env value of size "
                 "'%ld'\n",
-                name, strlen(env_value));
+                name, len);
         exit(1);
     }
-    return env;
+    return strndup(env_value, len);
 }
 
 Vec *new_vec_string() { return new_vec(sizeof(char *)); }
@@ -54,32 +72,53 @@ ShellState *initialize_shell_state() {
     ShellState *state = malloc(sizeof(ShellState));
     state->pwd = PWD;
     state->home = HOME;
+    state->prettied_pwd = NULL;
+    state->last_status = 0;
+    state->options = (ShellOptions) {false, false, NULL, false};
+    state->coprocs = new_vec(sizeof(Coproc *));
     state->pretty_pwd = pretty_pwd;
     state->drop = drop_shell_state;
     state->change_dir = shell_state_change_dir;
+    state->capture_output = NULL;
+    update_pretty_pwd(state);
     return state;
 }
 
 void drop_shell_state(ShellState *self) {
+    drop_coprocs(self);
+    drop_completion_cache();
+    drop_line_history();
+    drop_prompt_worker();
+    drop_path_cache();
+    drop_jobserver();
+    free(self->options.spread);
+    free(self->prettied_pwd);
     free(self->home);
     free(self->pwd);
     free(self);
 }
 
-char *pretty_pwd(ShellState *self) {
-    if (!strcmp(self->pwd, self->home)) {
-        return strdup("~/");
-    }
-    char *pwd = strstr(self->pwd, self->home);
-    if (pwd != NULL) {
-        pwd = pwd + strlen(self->home);
-        char *prettied_pwd = malloc(sizeof(char) * (strlen(pwd) + 2));
+/*
+ * The prettied pwd is owned by the state, so rendering the prompt doesn't
+ * allocate anything.
+ */
+char *pretty_pwd(ShellState *self) { return self->prettied_pwd; }
+
+void update_pretty_pwd(ShellState *self) {
+    size_t home_len = strlen(self->home);
+    char *prettied_pwd;
+    if (home_len && !strncmp(self->pwd, self->home, home_len) &&
+        (self->pwd[home_len] == '/' || self->pwd[home_len] == '\0')) {
+        char *pwd = self->pwd + home_len;
+        prettied_pwd = malloc(sizeof(char) * (strlen(pwd) + 3));
         prettied_pwd[0] = '~';
         prettied_pwd[1] = '\0';
-        strcat(prettied_pwd, pwd);
-        return prettied_pwd;
+        strcat(prettied_pwd, *pwd ? pwd : "/");
+    } else {
+        prettied_pwd = strdup(self->pwd);
     }
-    return strdup(self->pwd);
+    free(self->prettied_pwd);
+    self->prettied_pwd = prettied_pwd;
 }
 
 void shell_state_change_dir(ShellState *self, char *new_dir) {
@@ -91,6 +130,7 @@ void shell_state_change_dir(ShellState *self, char *new_dir) {
         self->pwd = real_dir_path;
         setenv("PWD", real_dir_path, 1);
         chdir(real_dir_path);
+        update_pretty_pwd(self);
     } else {
         printf("\"%s\" is a invalid directory\n", new_dir);
         free(real_dir_path);
@@ -98,18 +138,29 @@ void shell_state_change_dir(ShellState *self, char *new_dir) {
     closedir(dir);
 }
 
+char *render_continuation_prompt(void *ctx) { return strdup("> "); }
+
 CallArg *prompt_user(ShellState *state) {
     if (state != NULL) {
-        char input[BUFFER_MAX_SIZE];
-        fflush(stdout);
-        char *pwd = state->pretty_pwd(state);
-        printf("%s%s > %s%svsh%s%s > %s", BlueAnsi, pwd, EndAnsi, JojoAnsi, EndAnsi,
-               BlueAnsi, EndAnsi);
-        free(pwd);
-        fflush(stdin);
-        fgets(input, BUFFER_MAX_SIZE, stdin);
-        input[strcspn(input, "\n")] = '\0';
-        CallArg *call = initialize_call_arg(input);
+        char *input = read_line(render_prompt, state, prompt_notify_fd());
+        // The lines of the here-documents opened by the command line, or of
+        // its loops, whose lines are joined as statements
+        bool here_docs_done;
+        while (input != NULL &&
+               (!(here_docs_done = here_docs_complete(input)) || !loops_complete(input))) {
+            char *body_line = read_line(render_continuation_prompt, NULL, -1);
+            if (body_line == NULL) {
+                break;
+            }
+            size_t len = strlen(input);
+            input = realloc(input, len + strlen(body_line) + 3);
+            sprintf(input + len, here_docs_done ? "; %s" : "\n%s", body_line);
+            free(body_line);
+        }
+        // End of input behaves as if the user had typed exit
+        CallArg *call = initialize_call_arg(input != NULL ? input : "exit");
+        call->state = state;
+        free(input);
         return call;
     } else {
         perror("provided ShellState is NULL\n");
@@ -117,9 +168,14 @@ CallArg *prompt_user(ShellState *state) {
     }
 }
 
+#undef ALLOC_TAG
+#define ALLOC_TAG ParserAlloc
+
 CallArg *initialize_call_arg(char *arg) {
     CallArg *self = malloc(sizeof(CallArg));
     self->arg = strdup(arg);
+    self->state = NULL;
+    self->late_bound = NULL;
     self->call_groups = call_groups;
     self->drop = drop_call_arg;
     return self;
@@ -135,11 +191,49 @@ void drop_call_arg(CallArg *self) {
     }
 }
 
-ExecArgs *exec_args_from_vec_str(Vec *vec) {
+#undef ALLOC_TAG
+#define ALLOC_TAG ExecAlloc
+
+/*
+ * Takes the `>&N` and `<&N` words off argv, the command gets a duplicate of
+ * N as its stdout or stdin.
+ */
+void take_fd_redirections(ExecArgs *self) {
+    unsigned int i, j = 0;
+    for (i = 0; i < self->argc; i++) {
+        char *word = self->argv[i];
+        if ((word[0] != '>' && word[0] != '<') || word[1] != '&') {
+            self->argv[j++] = word;
+            continue;
+        }
+        char *target = word[2] || i + 1 == self->argc ? word + 2 : self->argv[++i], *end;
+        long fd = strtol(target, &end, 10);
+        int duplicate = *target && !*end ? fcntl((int) fd, F_DUPFD_CLOEXEC, 3) : -1;
+        if (duplicate == -1) {
+            fprintf(stderr, "vsh: bad file descriptor '%s'\n", target);
+        } else {
+            int *redirected = word[0] == '>' ? &self->stdout_fd : &self->stdin_fd;
+            if (*redirected != -1) {
+                close(*redirected);
+            }
+            *redirected = duplicate;
+        }
+        if (target != word + 2) {
+            free(target);
+        }
+        free(word);
+    }
+    self->argv[j] = NULL;
+    self->argc = j;
+}
+
+ExecArgs *exec_args_from_vec_str(Vec *vec, int stdin_fd) {
     ExecArgs *self = malloc(sizeof(ExecArgs));
     self->drop = drop_exec_args;
     self->fmt = (char *(*)(struct execArgs *self)) fmt_exec_arg;
     self->call = basic_exec_args_call;
+    self->stdout_fd = -1;
+    self->stdin_fd = stdin_fd;
     self->argc = vec->length;
     self->argv = malloc(sizeof(char *) * (self->argc + 1));
     int i, j;
@@ -150,12 +244,21 @@ ExecArgs *exec_args_from_vec_str(Vec *vec) {
     }
     self->argv[j] = NULL;
     self->argc = j;
+    take_fd_redirections(self);
+    init_launch_attrs(&self->attrs);
+    take_launch_prefixes(&self->attrs, self->argv, &self->argc);
     vec->drop(vec);
     return self;
 }
 
 void drop_exec_args(ExecArgs *self) {
     int i;
+    if (self->stdin_fd != -1) {
+        close(self->stdin_fd);
+    }
+    if (self->stdout_fd != -1) {
+        close(self->stdout_fd);
+    }
     for (i = 0; i < self->argc; i++) {
         free(self->argv[i]);
     }
@@ -165,12 +268,28 @@ void drop_exec_args(ExecArgs *self) {
 
 Vec *new_vec_exec_args() { return new_vec(sizeof(ExecArgs *)); }
 
+void exec_program(char *resolved_path, char **argv) {
+    if (resolved_path != NULL) {
+        execv(resolved_path, argv);
+    }
+    // execvp also handles the scripts without a shebang
+    if (resolved_path == NULL || errno == ENOENT || errno == ENOEXEC) {
+        execvp(argv[0], argv);
+    }
+    if (errno == E2BIG) {
+        fprintf(stderr, "%s: argument list too long, `batch %s ...` runs it in "
+                        "ARG_MAX sized chunks\n", argv[0], argv[0]);
+        _exit(126);
+    }
+}
+
 CallResult *basic_exec_args_call(ExecArgs *exec_args, bool should_fork,
                                  bool should_wait) {
     enum CallStatus status = UnknownCommand;
     char *program_name = NULL;
     bool is_parent = true;
     pid_t child_pid = 0;
+    int exit_code = 0;
     if (exec_args->argc == 0) {
         status = Continue;
     } else {
@@ -181,22 +300,59 @@ CallResult *basic_exec_args_call(ExecArgs *exec_args, bool should_fork,
         } else if (str_equals(program_name, "cd")) {
             status = Cd;
         } else {
-            child_pid = should_fork ? fork() : 0;
+            char *resolved_path = resolve_command_path(program_name);
+            bool launched = false;
+            uint64_t forked_at = stats_now();
+            if (should_fork && should_wait && launcher_enabled()) {
+                int here_doc = exec_args->stdin_fd != -1 ? open_here_doc(exec_args->stdin_fd) : -1;
+                int fds[3] = {here_doc != -1 ? here_doc : STDIN_FILENO,
+                              exec_args->stdout_fd != -1 ? exec_args->stdout_fd : STDOUT_FILENO,
+                              STDERR_FILENO};
+                child_pid = launcher_spawn(exec_args, resolved_path, fds, -1);
+                if (here_doc != -1) {
+                    close(here_doc);
+                }
+                launched = child_pid > 0;
+                if (!launched) {
+                    stats_count(SpawnFailures);
+                }
+            }
+            if (!launched) {
+                child_pid = should_fork ? fork() : 0;
+            }
             if (child_pid == -1) {
+                stats_count(ForkFailures);
                 perror("We can't start a new program since 'fork' failed!\n");
                 exit(1);
             } else if (child_pid) {
                 status = Continue;
+                stats_count(CommandsLaunched);
                 if (should_wait) {
                     int wait_status;
-                    waitpid(child_pid, &wait_status, WUNTRACED);
-                    if (WIFEXITED(wait_status) &&
-                        (WEXITSTATUS(wait_status) == UnknownCommand)) {
-                        status = UnknownCommand;
+                    struct rusage usage;
+                    pid_t waited = launched ? launcher_wait(child_pid, &wait_status, &usage)
+                                            : wait_child_usage(child_pid, &wait_status, &usage);
+                    if (waited == -1) {
+                        // The launcher stopped before the exit was read
+                        wait_status = W_EXITCODE(LOST_CHILD_EXIT_STATUS, 0);
+                        memset(&usage, 0, sizeof(usage));
                     }
+                    stats_record(ExecToReap, forked_at);
+                    report_limit_exit(exec_args, wait_status, &usage);
+                    exit_code = exit_code_from_wait_status(wait_status);
                 }
             } else {
-                execvp(program_name, exec_args->argv);
+                if (exec_args->stdout_fd != -1) {
+                    dup2(exec_args->stdout_fd, STDOUT_FILENO);
+                }
+                if (exec_args->stdin_fd != -1) {
+                    install_here_doc(exec_args->stdin_fd);
+                }
+                apply_launch_attrs(&exec_args->attrs);
+                if (should_fork) {
+                    stats_record(ForkToExec, forked_at);
+                }
+                exec_program(resolved_path, exec_args->argv);
                 is_parent = false;
             }
         }
@@ -218,17 +374,29 @@ CallResult *basic_exec_args_call(ExecArgs *exec_args, bool should_fork,
         default:
             aux_str = NULL;
     }
-    return new_call_result(status, is_parent, aux_str, child_pid);
+    return new_call_result(status, is_parent, aux_str, child_pid, exit_code);
+}
+
+int exit_code_from_wait_status(int wait_status) {
+    if (WIFEXITED(wait_status)) {
+        return WEXITSTATUS(wait_status);
+    } else if (WIFSIGNALED(wait_status)) {
+        return 128 + WTERMSIG(wait_status);
+    } else if (WIFSTOPPED(wait_status)) {
+        return 128 + WSTOPSIG(wait_status);
+    }
+    return 0;
 }
 
 CallResult *new_call_result(enum CallStatus status, bool is_parent,
-                            char *additional_data, pid_t child_pid) {
+                            char *additional_data, pid_t child_pid, int exit_code) {
     CallResult *res = malloc(sizeof(CallResult));
     res->drop = drop_call_res;
     res->is_parent = is_parent;
     res->status = status;
     res->additional_data = additional_data;
     res->child_pid = child_pid;
+    res->exit_code = exit_code;
     return res;
 }
 
@@ -240,6 +408,9 @@ void drop_call_res(CallResult *self) {
     free(self);
 }
 
+#undef ALLOC_TAG
+#define ALLOC_TAG ParserAlloc
+
 CallGroup *call_group_from_vec_exec_args(Vec *vec_exec_args,
                                          enum CallType type) {
     CallGroup *self = malloc(sizeof(CallGroup));
@@ -255,6 +426,8 @@ CallGroup *call_group_from_vec_exec_args(Vec *vec_exec_args,
     self->exec_arr = exec_arr;
     self->drop = drop_call_group;
     self->file_name = NULL;
+    self->consumers = 0;
+    self->loop = NULL;
     return self;
 }
 
@@ -269,6 +442,9 @@ void drop_call_group(CallGroup *self) {
         free(self->file_name);
         self->file_name = NULL;
     }
+    if (self->loop != NULL) {
+        self->loop->drop(self->loop);
+    }
     free(self);
 }
 
@@ -307,6 +483,7 @@ ParseArgRes *new_parse_arg_res(char *str, enum ArgType type) {
     ParseArgRes *val = malloc(sizeof(ParseArgRes));
     val->arg = str;
     val->type = type;
+    val->joins_next = false;
     val->take_arg = parse_arg_res_take_arg;
     val->drop = drop_parse_arg_res;
     return val;
@@ -327,12 +504,32 @@ char *str_from_vec_char(Vec **vec, bool should_alloc) {
     return str;
 }
 
+/*
+ * Takes the body of the next here-document from the lines following the
+ * command line, `bodies` being at the newline preceding them.
+ */
+char *take_here_doc_body(char **bodies, char *delimiter) {
+    char *start = **bodies ? *bodies + 1 : *bodies, *line = start;
+    size_t delimiter_len = strlen(delimiter);
+    while (*line) {
+        size_t line_len = strcspn(line, "\n");
+        if (line_len == delimiter_len && !strncmp(line, delimiter, line_len)) {
+            *bodies = line + line_len;
+            return strndup(start, line - start);
+        }
+        line += line_len + (line[line_len] == '\n');
+    }
+    return NULL;
+}
+
 Vec *process_call_arg(CallArg *call_arg) {
     Vec *args = new_vec(sizeof(ParseArgRes *));
     Vec *char_buffer = new_vec(sizeof(char));
     bool has_error = false;
     enum ArgParseState arg_parse_state = Ignore;
-    int str_len = strlen(call_arg->arg);
+    // Here-document bodies follow the command line
+    int str_len = strcspn(call_arg->arg, "\n");
+    char *bodies = call_arg->arg + str_len;
     int i = 0;
     char c;
     if (str_len > 0 && (c = call_arg->arg[0]) && (c == '|' || c == '&')) {
@@ -356,12 +553,39 @@ Vec *process_call_arg(CallArg *call_arg) {
                 };
                 break;
             case '|': {
-                args->push(args,
-                           new_parse_arg_res(str_from_vec_char(&char_buffer, true), Bar));
+                if (i + 1 < str_len && call_arg->arg[i + 1] == '&') {
+                    // The consumers are split and parsed by call_groups
+                    char *open = call_arg->arg + i + 2 + strspn(call_arg->arg + i + 2, " ");
+                    char *close = *open == '{' ? strchr(open, '}') : NULL;
+                    if (close == NULL || close - call_arg->arg >= str_len) {
+                        has_error = true;
+                        i = str_len;
+                        break;
+                    }
+                    if (char_buffer->length) {
+                        args->push(args, new_parse_arg_res(
+                                str_from_vec_char(&char_buffer, true), Simple));
+                    }
+                    args->push(args, new_parse_arg_res(strndup(open + 1, close - open - 1),
+                                                       FanOutBar));
+                    i = (int) (close - call_arg->arg);
+                } else {
+                    args->push(args,
+                               new_parse_arg_res(str_from_vec_char(&char_buffer, true), Bar));
+                }
                 arg_parse_state = Ignore;
             }
                 break;
             case '&': {
+                if (arg_parse_state == Word && char_buffer->length) {
+                    char last = (char) (uintptr_t) char_buffer->get(char_buffer,
+                                                                    char_buffer->length - 1);
+                    // `>&N` and `<&N` are words, not a group separator
+                    if (last == '>' || last == '<') {
+                        push_in_buffer(char_buffer, c);
+                        break;
+                    }
+                }
                 enum ArgType type = At;
                 if (i + 1 < str_len && call_arg->arg[i + 1] == '&') {
                     type = DoubleAt;
@@ -387,6 +611,66 @@ Vec *process_call_arg(CallArg *call_arg) {
                     }
                 }
                 break;
+            case '$':
+                if (arg_parse_state != LeftQuote && i + 1 < str_len && call_arg->arg[i + 1] == '(') {
+                    int depth = 0, j;
+                    for (j = i + 1; j < str_len; j++) {
+                        if (call_arg->arg[j] == '(') {
+                            depth++;
+                        } else if (call_arg->arg[j] == ')' && !--depth) {
+                            break;
+                        }
+                    }
+                    if (j >= str_len) {
+                        has_error = true;
+                        i = str_len;
+                        break;
+                    }
+                    if (char_buffer->length) {
+                        ParseArgRes *prefix = new_parse_arg_res(
+                                str_from_vec_char(&char_buffer, true), Simple);
+                        prefix->joins_next = true;
+                        args->push(args, prefix);
+                    }
+                    ParseArgRes *substitution = new_parse_arg_res(
+                            strndup(call_arg->arg + i + 2, j - i - 2), Substitution);
+                    // What follows right after the `)` is part of the same word
+                    substitution->joins_next = j + 1 < str_len &&
+                                               !strchr(" \t\n|&\"", call_arg->arg[j + 1]);
+                    args->push(args, substitution);
+                    arg_parse_state = substitution->joins_next ? Word : Ignore;
+                    i = j;
+                    break;
+                }
+                // FALLTHROUGH
+            case '<':
+                if (c == '<' && arg_parse_state != LeftQuote && i + 1 < str_len &&
+                    call_arg->arg[i + 1] == '<') {
+                    bool is_here_string = i + 2 < str_len && call_arg->arg[i + 2] == '<';
+                    char *word, *body = NULL;
+                    int next = read_here_doc_word(call_arg->arg, i + (is_here_string ? 3 : 2),
+                                                  str_len, &word);
+                    if (next != -1 && !is_here_string) {
+                        body = take_here_doc_body(&bodies, word);
+                        free(word);
+                        word = body;
+                    }
+                    if (next == -1 || word == NULL) {
+                        has_error = true;
+                        i = str_len;
+                        break;
+                    }
+                    if (char_buffer->length) {
+                        args->push(args, new_parse_arg_res(
+                                str_from_vec_char(&char_buffer, true), Simple));
+                    }
+                    args->push(args, new_parse_arg_res(word, is_here_string ? HereString
+                                                                            : HereDoc));
+                    arg_parse_state = Ignore;
+                    i = next - 1;
+                    break;
+                }
+                // FALLTHROUGH
             default:
                 if (arg_parse_state == Ignore) {
                     arg_parse_state = Word;
@@ -430,8 +714,9 @@ CallGroups *new_call_groups(int call_group_count, bool has_parsing_error) {
 
 void call_group_specific_type(enum CallType expected_type, enum CallType *type,
                               Vec **vec_str, Vec *vec_call_group,
-                              Vec **vec_exec_args) {
-    ExecArgs *exec_arg = exec_args_from_vec_str(*vec_str);
+                              Vec **vec_exec_args, int *stdin_fd) {
+    ExecArgs *exec_arg = exec_args_from_vec_str(*vec_str, *stdin_fd);
+    *stdin_fd = -1;
     *vec_str = new_vec_string();
     if (*type == Basic || *type == expected_type) {
         *type = expected_type;
@@ -445,7 +730,164 @@ void call_group_specific_type(enum CallType expected_type, enum CallType *type,
     }
 }
 
+/*
+ * Parses the comma separated consumers of a fan-out, each a single command,
+ * into `vec_exec_args`. Returns how many there are, 0 when one isn't valid.
+ */
+unsigned int push_fan_out_consumers(CallArg *call_arg, char *consumers, Vec *vec_exec_args) {
+    unsigned int count = 0;
+    char *save = NULL, *consumer;
+    for (consumer = strtok_r(consumers, ",", &save); consumer != NULL;
+         consumer = strtok_r(NULL, ",", &save)) {
+        CallArg *consumer_arg = initialize_call_arg(consumer);
+        consumer_arg->state = call_arg->state;
+        consumer_arg->late_bound = call_arg->late_bound;
+        CallGroups *groups = consumer_arg->call_groups(consumer_arg);
+        CallGroup *group = groups->len == 1 ? groups->groups[0] : NULL;
+        bool is_valid = group != NULL && group->type == Basic && group->exec_amount == 1 &&
+                        group->exec_arr[0]->argc;
+        if (is_valid) {
+            vec_exec_args->push(vec_exec_args, group->exec_arr[0]);
+            // Now owned by the fan-out group
+            group->exec_amount = 0;
+            count++;
+        }
+        groups->drop(groups);
+        consumer_arg->drop(consumer_arg);
+        if (!is_valid) {
+            fprintf(stderr, "vsh: the fan-out consumer '%s' isn't a single command\n", consumer);
+            return 0;
+        }
+    }
+    return count;
+}
+
+/*
+ * Pushes the part of a word, appended to the last word when it's still open.
+ */
+void push_word_part(Vec *vec_string, char *part, bool *in_word) {
+    if (*in_word && vec_string->length) {
+        char *word = vec_string->pop(vec_string);
+        size_t len = strlen(word);
+        word = realloc(word, len + strlen(part) + 1);
+        strcpy(word + len, part);
+        free(part);
+        part = word;
+    }
+    vec_string->push(vec_string, part);
+    *in_word = true;
+}
+
+/*
+ * Runs the command of a `$(...)` and pushes the words of its output, the
+ * first and last ones join the text around the `$(...)` unless the output
+ * starts or ends with a blank.
+ */
+void push_substitution_words(CallArg *call_arg, char *line, Vec *vec_string, bool *in_word) {
+    ShellState *state = call_arg->state;
+    if (state == NULL || state->capture_output == NULL) {
+        return;
+    }
+    char *output = state->capture_output(state, line);
+    char *word = output;
+    while (*word) {
+        size_t word_len = strcspn(word, " \t\n");
+        if (word_len) {
+            push_word_part(vec_string, strndup(word, word_len), in_word);
+            word += word_len;
+        } else {
+            *in_word = false;
+            word++;
+        }
+    }
+    free(output);
+}
+
+bool is_late_bound(CallArg *call_arg, char *name) {
+    unsigned int i;
+    for (i = 0; call_arg->late_bound != NULL && i < call_arg->late_bound->length; i++) {
+        if (str_equals(call_arg->late_bound->get(call_arg->late_bound, i), name)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * `${NAME}`, or `${NAME[0]}`/`${NAME[1]}` for the pipes of a coproc. NULL
+ * when the word isn't one of them.
+ */
+char *expand_braced(CallArg *call_arg, char *word) {
+    size_t len = strlen(word);
+    if (len < 4 || word[len - 1] != '}') {
+        return NULL;
+    }
+    char *name = strndup(word + 2, len - 3), *index = strchr(name, '['), *value;
+    if (index != NULL) {
+        char *end;
+        *index = '\0';
+        unsigned long i = strtoul(index + 1, &end, 10);
+        int fd = str_equals(end, "]") ? coproc_fd(call_arg->state, name, i) : -1;
+        if (fd == -1) {
+            fprintf(stderr, "vsh: %s isn't a coproc pipe\n", word);
+            value = strdup("");
+        } else {
+            value = malloc(16);
+            sprintf(value, "%d", fd);
+        }
+    } else if (is_late_bound(call_arg, name)) {
+        // Left as the word of a loop slot
+        value = malloc(len - 1);
+        sprintf(value, "$%s", name);
+    } else {
+        value = read_env(name);
+    }
+    free(name);
+    return value;
+}
+
+/*
+ * Expands a word starting with `$`, or a `>&$...`/`<&$...` redirection.
+ */
+char *expand_word(CallArg *call_arg, char *word) {
+    size_t prefix_len = (word[0] == '>' || word[0] == '<') && word[1] == '&' ? 2 : 0;
+    char *ref = word + prefix_len, *value;
+    if (ref[0] != '$' || (prefix_len && !ref[1])) {
+        return word;
+    }
+    if (ref[1] == '{') {
+        if ((value = expand_braced(call_arg, ref)) == NULL) {
+            return word;
+        }
+    } else if (is_late_bound(call_arg, ref + 1)) {
+        return word;
+    } else {
+        value = read_env(ref + 1);
+    }
+    if (prefix_len) {
+        char *redirection = malloc(strlen(value) + 3);
+        sprintf(redirection, "%.2s%s", word, value);
+        free(value);
+        value = redirection;
+    }
+    free(word);
+    return value;
+}
+
 CallGroups *call_groups(CallArg *call_arg) {
+    uint64_t parse_start = stats_now();
+    stats_count(LinesParsed);
+    if (is_statement_list(call_arg->arg)) {
+        LoopPlan *plan = compile_loop_plan(call_arg->arg);
+        stats_record(ParseLatency, parse_start);
+        if (plan == NULL) {
+            return new_call_groups(0, true);
+        }
+        CallGroups *val = new_call_groups(1, false);
+        val->groups[0] = call_group_from_vec_exec_args(new_vec_exec_args(), Loop);
+        val->groups[0]->loop = plan;
+        return val;
+    }
     Vec *args = process_call_arg(call_arg);
     if (args != NULL) {
         Vec *vec_call_group = new_vec_call_group();
@@ -454,42 +896,98 @@ CallGroups *call_groups(CallArg *call_arg) {
         enum CallType type = Basic;
         int len = args->length;
         ParseArgRes **args_res = (ParseArgRes **) args->take_arr(args);
+        GlobCache *glob_cache = new_glob_cache();
+        int stdin_fd = -1;
+        // Whether the last pushed word goes on with the next part, see joins_next
+        bool in_word = false;
         int i;
         for (i = 0; i < len; i++) {
             ParseArgRes *parse_arg_res = args_res[i];
             char *str = parse_arg_res->take_arg(parse_arg_res);
-            if (strlen(str) && str[0] == '$') {
-                char *env_value = read_env(str + 1);
-                free(str);
-                str = env_value;
+            if (parse_arg_res->type != Substitution && parse_arg_res->type != HereDoc &&
+                strlen(str)) {
+                str = expand_word(call_arg, str);
             }
             switch (parse_arg_res->type) {
+                case Substitution:
+                    push_substitution_words(call_arg, str, vec_string, &in_word);
+                    free(str);
+                    break;
+                case HereString: {
+                    size_t len = strlen(str);
+                    str = realloc(str, len + 2);
+                    strcpy(str + len, "\n");
+                }
+                    // FALLTHROUGH
+                case HereDoc:
+                    // The last one given wins, as in other shells
+                    if (stdin_fd != -1) {
+                        close(stdin_fd);
+                    }
+                    stdin_fd = here_doc_memfd(str, strlen(str));
+                    free(str);
+                    break;
                 case Bar:
                     call_group_specific_type(Piped, &type, &vec_string, vec_call_group,
-                                             &vec_exec_args);
+                                             &vec_exec_args, &stdin_fd);
                     free(str);
                     break;
+                case FanOutBar: {
+                    // The producer (pipeline) and the consumers make a group of their own
+                    if (type != Basic && type != Piped) {
+                        vec_call_group->push(vec_call_group,
+                                             call_group_from_vec_exec_args(vec_exec_args, type));
+                        vec_exec_args = new_vec_exec_args();
+                    }
+                    vec_exec_args->push(vec_exec_args,
+                                        exec_args_from_vec_str(vec_string, stdin_fd));
+                    vec_string = new_vec_string();
+                    stdin_fd = -1;
+                    unsigned int consumers = push_fan_out_consumers(call_arg, str, vec_exec_args);
+                    free(str);
+                    CallGroup *fan_out = call_group_from_vec_exec_args(vec_exec_args, FanOut);
+                    // Without consumers the handler reports the error
+                    fan_out->consumers = consumers;
+                    vec_call_group->push(vec_call_group, fan_out);
+                    vec_exec_args = new_vec_exec_args();
+                    type = Basic;
+                }
+                    break;
                 case At:
                     call_group_specific_type(Parallel, &type, &vec_string, vec_call_group,
-                                             &vec_exec_args);
+                                             &vec_exec_args, &stdin_fd);
                     free(str);
                     break;
                 case DoubleAt:
                     call_group_specific_type(Sequential, &type, &vec_string, vec_call_group,
-                                             &vec_exec_args);
+                                             &vec_exec_args, &stdin_fd);
                     free(str);
                     break;
                 default:
-                    vec_string->push(vec_string, str);
+                    if (parse_arg_res->type == Simple && (in_word || parse_arg_res->joins_next)) {
+                        push_word_part(vec_string, str, &in_word);
+                    } else if (parse_arg_res->type == Simple && has_glob_chars(str)) {
+                        glob_expand(glob_cache, str, vec_string);
+                        free(str);
+                    } else {
+                        vec_string->push(vec_string, str);
+                    }
                     break;
             }
+            if (!parse_arg_res->joins_next) {
+                in_word = false;
+            }
             parse_arg_res->drop(parse_arg_res);
         }
         free(args_res);
+        glob_cache->drop(glob_cache);
         if (vec_string->length) {
-            vec_exec_args->push(vec_exec_args, exec_args_from_vec_str(vec_string));
+            vec_exec_args->push(vec_exec_args, exec_args_from_vec_str(vec_string, stdin_fd));
         } else {
             vec_string->drop(vec_string);
+            if (stdin_fd != -1) {
+                close(stdin_fd);
+            }
         }
         vec_call_group->push(vec_call_group,
                              call_group_from_vec_exec_args(vec_exec_args, type));
@@ -503,8 +1001,10 @@ CallGroups *call_groups(CallArg *call_arg) {
             val->groups[i] = call_group;
         }
         vec_call_group->drop(vec_call_group);
+        stats_record(ParseLatency, parse_start);
         return val;
     } else {
+        stats_record(ParseLatency, parse_start);
         return new_call_groups(0, true);
     }
 }
\ No newline at end of file
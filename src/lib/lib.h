@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <sys/types.h>
+#include "launch.h"
 #include "util/vec/vec.h"
 
 enum CallType {
@@ -13,14 +14,42 @@ enum CallType {
     Piped,
     RedirectStdout,
     RedirectStdIn,
+    // `producer |& { c1, c2 }`, the consumers are the last exec args
+    FanOut,
+    // A line of statements or loops, see loop.h
+    Loop,
 };
 
+/*
+ * Options toggled with `set -o name` / `set +o name`.
+ */
+typedef struct shellOptions {
+    // Output of `&` groups goes through pipes and is written a whole line at a time
+    bool line_buffered;
+    // Lines of `&` groups are prefixed with `[job n]`, implies line_buffered
+    bool tagged;
+    // Cpu list the members of `&` groups are pinned to round-robin, or NULL
+    char *spread;
+    // The rest of a `&` group is killed once one of its members fails
+    bool failfast;
+} ShellOptions;
+
 typedef struct shellState {
     char *pwd;
     char *home;
+    // pwd with the home directory replaced by '~', updated on each change_dir
+    char *prettied_pwd;
+    // Exit status of the last foreground command
+    int last_status;
+    ShellOptions options;
+    // Helpers started with `coproc`, see coproc.h
+    Vec *coprocs;
 
     void (*change_dir)(struct shellState *state, char *new_dir);
 
+    // Runs the line with stdout captured, returning the output (see handlers.h)
+    char *(*capture_output)(struct shellState *state, char *line);
+
     char *(*pretty_pwd)(struct shellState *state);
 
     void (*drop)(struct shellState *state);
@@ -30,11 +59,15 @@ enum CallStatus {
     Continue, Exit, Cd, UnknownCommand
 };
 
+// Exit status of a child whose exec failed, it tells so itself before leaving
+#define UNKNOWN_COMMAND_EXIT_STATUS 127
+
 typedef struct callResult {
     char *additional_data;
     enum CallStatus status;
     bool is_parent;
     pid_t child_pid;
+    int exit_code;
 
     void (*drop)(struct callResult *self);
 } CallResult;
@@ -42,6 +75,12 @@ typedef struct callResult {
 typedef struct execArgs {
     unsigned int argc;
     char **argv;
+    // When not -1 the forked child uses it as its stdout, set by `>&N`
+    int stdout_fd;
+    // Here-doc memfd, or the duplicate of the fd of `<&N`, the child reads
+    // as its stdin, or -1
+    int stdin_fd;
+    LaunchAttrs attrs;
 
     void (*drop)(struct execArgs *self);
 
@@ -55,6 +94,10 @@ typedef struct callGroup {
     enum CallType type;
     char *file_name;
     ExecArgs **exec_arr;
+    // Trailing exec args of a FanOut group fed with the output of the others
+    unsigned int consumers;
+    // Statements of a Loop group
+    struct loopPlan *loop;
 
     void (*drop)(struct callGroup *self);
 } CallGroup;
@@ -73,6 +116,10 @@ typedef struct callArg {
     void (*drop)(struct callArg *self);
 
     char *arg;
+    // Used to run the command substitutions, they are left empty when NULL
+    ShellState *state;
+    // Names whose `$NAME` words are left as is, loop variables bound later
+    Vec *late_bound;
 } CallArg;
 
 
@@ -88,17 +135,34 @@ enum ArgType {
     Bar,
     At,
     DoubleAt,
+    Substitution,
+    // `<<< word` and `<<EOF` (the arg is the body), see here_doc.h
+    HereString,
+    HereDoc,
+    // `|& { c1, c2 }`, the arg is what's between the braces
+    FanOutBar,
 };
 
 typedef struct parseArgRes {
     char *arg;
     enum ArgType type;
+    // The word goes on in the next one, as `x` and `$(cmd)` in `x$(cmd)`
+    bool joins_next;
 
     void (*drop)(struct parseArgRes *self);
 
     char *(*take_arg)(struct parseArgRes *self);
 } ParseArgRes;
 
+/*
+ * Ansi Colors for stdout color manipulation
+ */
+extern const char BlueAnsi[];
+extern const char JojoAnsi[];
+extern const char EndAnsi[];
+extern const char RedAnsi[];
+extern const char YellowAnsi[];
+
 CallArg *prompt_user(ShellState *state);
 
 ShellState *initialize_shell_state();
@@ -132,6 +196,8 @@ void drop_shell_state(ShellState *self);
 
 char *pretty_pwd(ShellState *self);
 
+void update_pretty_pwd(ShellState *self);
+
 void shell_state_change_dir(ShellState *self, char *new_dir);
 
 /*
@@ -144,6 +210,11 @@ void drop_call_arg(CallArg *self);
 /*
  * ExecArgs functions
  */
+/*
+ * Takes the strings of the vec, and the vec itself.
+ */
+ExecArgs *exec_args_from_vec_str(Vec *vec, int stdin_fd);
+
 void drop_exec_args(ExecArgs *self);
 
 char *fmt_exec_arg(void *data);
@@ -157,7 +228,14 @@ CallResult *basic_exec_args_call(ExecArgs *exec_args, bool should_fork,
  * CallRes functions
  */
 CallResult *new_call_result(enum CallStatus status, bool is_parent,
-                            char *program_name, pid_t child_pid);
+                            char *program_name, pid_t child_pid, int exit_code);
+
+int exit_code_from_wait_status(int wait_status);
+
+/*
+ * Replaces the process with the program, it only returns when that failed.
+ */
+void exec_program(char *resolved_path, char **argv);
 
 void drop_call_res(CallResult *self);
 
@@ -2,6 +2,9 @@
 #include "util/string_util/string_util.h"
 #include <string.h>
 #include <stdlib.h>
+#include "alloc_stats.h"
+
+#define ALLOC_TAG ParserAlloc
 
 /*
  * Implementation for formatting structs into a string to more easily debug these data.
@@ -52,6 +55,12 @@ char *fmt_call_group(void *data) {
         case RedirectStdIn:
             call_group_type = "RedirectStdin";
             break;
+        case FanOut:
+            call_group_type = "FanOut";
+            break;
+        case Loop:
+            call_group_type = "Loop";
+            break;
         case RedirectStdout:
             call_group_type = "RedirectStdout";
             break;
@@ -107,6 +116,18 @@ char *fmt_parse_arg_res(void *data) {
         case At:
             type = "At";
             break;
+        case Substitution:
+            type = "Substitution";
+            break;
+        case HereString:
+            type = "HereString";
+            break;
+        case HereDoc:
+            type = "HereDoc";
+            break;
+        case FanOutBar:
+            type = "FanOutBar";
+            break;
         default:
             type = "DoubleAt";
     }
@@ -0,0 +1,456 @@
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "alloc_stats.h"
+#include "completion.h"
+#include "line_editor.h"
+#include "util/string_util/string_util.h"
+#include "util/vec/vec.h"
+
+#define ALLOC_TAG StateAlloc
+
+enum Key {
+    CtrlA = 1,
+    CtrlB = 2,
+    CtrlD = 4,
+    CtrlE = 5,
+    CtrlF = 6,
+    CtrlH = 8,
+    Tab = 9,
+    CtrlJ = 10,
+    CtrlK = 11,
+    CtrlL = 12,
+    Enter = 13,
+    CtrlN = 14,
+    CtrlP = 16,
+    CtrlU = 21,
+    CtrlW = 23,
+    Esc = 27,
+    Backspace = 127,
+};
+
+Vec *history = NULL;
+
+typedef struct editSession {
+    struct termios original;
+    LineBuffer *line;
+    char *prompt;
+
+    char *(*render_prompt)(void *ctx);
+
+    void *ctx;
+    int notify_fd;
+} EditSession;
+
+LineBuffer *new_line_buffer() {
+    LineBuffer *self = malloc(sizeof(LineBuffer));
+    self->cap = BUFFER_MAX_SIZE;
+    self->buf = malloc(sizeof(char) * self->cap);
+    self->buf[0] = '\0';
+    self->len = 0;
+    self->pos = 0;
+    return self;
+}
+
+void line_buffer_insert(LineBuffer *self, char *str, size_t str_len) {
+    if (self->len + str_len + 1 > self->cap) {
+        while (self->len + str_len + 1 > self->cap) {
+            self->cap <<= 1;
+        }
+        self->buf = realloc(self->buf, self->cap);
+    }
+    memmove(self->buf + self->pos + str_len, self->buf + self->pos, self->len - self->pos + 1);
+    memcpy(self->buf + self->pos, str, str_len);
+    self->len += str_len;
+    self->pos += str_len;
+}
+
+void line_buffer_delete(LineBuffer *self, size_t from, size_t to) {
+    memmove(self->buf + from, self->buf + to, self->len - to + 1);
+    self->len -= to - from;
+    self->pos = from;
+}
+
+void line_buffer_set(LineBuffer *self, char *str) {
+    self->len = 0;
+    self->pos = 0;
+    self->buf[0] = '\0';
+    line_buffer_insert(self, str, strlen(str));
+}
+
+void write_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(fd, data, len);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        data += written;
+        len -= written;
+    }
+}
+
+void refresh_line(char *prompt, LineBuffer *line) {
+    size_t prompt_len = strlen(prompt);
+    char *out = malloc(prompt_len + line->len + 32);
+    size_t len = 0;
+    out[len++] = '\r';
+    memcpy(out + len, prompt, prompt_len);
+    len += prompt_len;
+    memcpy(out + len, line->buf, line->len);
+    len += line->len;
+    len += sprintf(out + len, "\033[K");
+    if (line->len > line->pos) {
+        len += sprintf(out + len, "\033[%zuD", line->len - line->pos);
+    }
+    write_all(STDOUT_FILENO, out, len);
+    free(out);
+}
+
+unsigned short terminal_columns() {
+    struct winsize ws;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0) {
+        return 80;
+    }
+    return ws.ws_col;
+}
+
+void print_matches(CompletionRes *res) {
+    Vec *matches = res->matches;
+    size_t width = 0;
+    unsigned int i;
+    for (i = 0; i < matches->length; i++) {
+        size_t len = strlen(matches->get(matches, i));
+        width = len > width ? len : width;
+    }
+    width += 2;
+    unsigned int columns = terminal_columns() / width;
+    columns = columns ? columns : 1;
+    printf("\n");
+    for (i = 0; i < matches->length; i++) {
+        printf("%-*s", (int) width, (char *) matches->get(matches, i));
+        if ((i + 1) % columns == 0 || i + 1 == matches->length) {
+            printf("\n");
+        }
+    }
+    if (res->total > matches->length) {
+        printf("... and %u more\n", res->total - matches->length);
+    }
+    fflush(stdout);
+}
+
+void complete(char *prompt, LineBuffer *line, bool should_list) {
+    char saved = line->buf[line->pos];
+    line->buf[line->pos] = '\0';
+    CompletionRes *res = complete_line(line->buf, line->pos);
+    line->buf[line->pos] = saved;
+    if (strlen(res->insertion)) {
+        line_buffer_insert(line, res->insertion, strlen(res->insertion));
+    } else if (res->total > 1 && should_list) {
+        print_matches(res);
+    } else {
+        write_all(STDOUT_FILENO, "\a", 1);
+    }
+    res->drop(res);
+    refresh_line(prompt, line);
+}
+
+void history_push(char *str) {
+    if (history == NULL) {
+        history = new_vec(sizeof(char *));
+    }
+    if (!strlen(str) ||
+        (history->length && str_equals(history->get(history, history->length - 1), str))) {
+        return;
+    }
+    if (history->length >= HISTORY_MAX_SIZE) {
+        free(history->pop_first(history));
+    }
+    history->push(history, strdup(str));
+}
+
+void drop_line_history() {
+    if (history != NULL) {
+        unsigned int i;
+        for (i = 0; i < history->length; i++) {
+            free(history->get(history, i));
+        }
+        history->drop(history);
+        history = NULL;
+    }
+}
+
+void restore_terminal(void *arg) {
+    EditSession *session = arg;
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &session->original);
+}
+
+void drop_edit_session(void *arg) {
+    EditSession *session = arg;
+    free(session->prompt);
+    session->prompt = NULL;
+    if (session->line != NULL) {
+        free(session->line->buf);
+        free(session->line);
+        session->line = NULL;
+    }
+}
+
+/*
+ * Handles the escape sequences of the arrows, Home, End and Delete keys.
+ */
+void handle_escape(LineBuffer *line, unsigned int *history_idx) {
+    char seq[3];
+    if (read(STDIN_FILENO, seq, 1) != 1 || read(STDIN_FILENO, seq + 1, 1) != 1) {
+        return;
+    }
+    if (seq[0] == '[' && seq[1] >= '0' && seq[1] <= '9') {
+        if (read(STDIN_FILENO, seq + 2, 1) != 1 || seq[2] != '~') {
+            return;
+        }
+        if (seq[1] == '3' && line->pos < line->len) {
+            line_buffer_delete(line, line->pos, line->pos + 1);
+        } else if (seq[1] == '1' || seq[1] == '7') {
+            line->pos = 0;
+        } else if (seq[1] == '4' || seq[1] == '8') {
+            line->pos = line->len;
+        }
+        return;
+    }
+    if (seq[0] != '[' && seq[0] != 'O') {
+        return;
+    }
+    unsigned int history_len = history != NULL ? history->length : 0;
+    switch (seq[1]) {
+        case 'A':
+            if (*history_idx > 0) {
+                *history_idx -= 1;
+                line_buffer_set(line, history->get(history, *history_idx));
+            }
+            break;
+        case 'B':
+            if (*history_idx < history_len) {
+                *history_idx += 1;
+                line_buffer_set(line, *history_idx == history_len
+                                      ? "" : (char *) history->get(history, *history_idx));
+            }
+            break;
+        case 'C':
+            line->pos += line->pos < line->len;
+            break;
+        case 'D':
+            line->pos -= line->pos > 0;
+            break;
+        case 'H':
+            line->pos = 0;
+            break;
+        case 'F':
+            line->pos = line->len;
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+ * Drains the notification fd, re-rendering the prompt in place when it had
+ * something.
+ */
+void redraw_prompt(EditSession *session) {
+    char drain[64];
+    if (read(session->notify_fd, drain, sizeof(drain)) <= 0) {
+        return;
+    }
+    while (read(session->notify_fd, drain, sizeof(drain)) > 0);
+    free(session->prompt);
+    session->prompt = session->render_prompt(session->ctx);
+    refresh_line(session->prompt, session->line);
+}
+
+/*
+ * Waits for stdin to be readable, redrawing the prompt whenever the notify fd
+ * signals that fresher prompt data is available.
+ */
+ssize_t read_key(EditSession *session, char *c) {
+    if (session->notify_fd >= 0) {
+        struct pollfd fds[2] = {
+                {.fd = STDIN_FILENO, .events = POLLIN},
+                {.fd = session->notify_fd, .events = POLLIN},
+        };
+        while (!(fds[0].revents & (POLLIN | POLLHUP | POLLERR))) {
+            if (poll(fds, 2, -1) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                break;
+            }
+            if (fds[1].revents & POLLIN) {
+                redraw_prompt(session);
+            }
+        }
+    }
+    return read(STDIN_FILENO, c, 1);
+}
+
+char *read_line_raw(EditSession *session) {
+    LineBuffer *line = session->line;
+    unsigned int history_idx = history != NULL ? history->length : 0;
+    char last_key = 0;
+    bool done = false, eof = false;
+    refresh_line(session->prompt, line);
+    while (!done) {
+        char c;
+        ssize_t nread = read_key(session, &c);
+        if (nread < 0 && errno == EINTR) {
+            continue;
+        }
+        if (nread <= 0) {
+            eof = true;
+            break;
+        }
+        switch (c) {
+            case Enter:
+            case CtrlJ:
+                done = true;
+                break;
+            case Tab:
+                complete(session->prompt, line, last_key == Tab);
+                break;
+            case CtrlD:
+                if (!line->len) {
+                    eof = true;
+                    done = true;
+                } else if (line->pos < line->len) {
+                    line_buffer_delete(line, line->pos, line->pos + 1);
+                }
+                break;
+            case Backspace:
+            case CtrlH:
+                if (line->pos > 0) {
+                    line_buffer_delete(line, line->pos - 1, line->pos);
+                }
+                break;
+            case CtrlA:
+                line->pos = 0;
+                break;
+            case CtrlE:
+                line->pos = line->len;
+                break;
+            case CtrlB:
+                line->pos -= line->pos > 0;
+                break;
+            case CtrlF:
+                line->pos += line->pos < line->len;
+                break;
+            case CtrlK:
+                line_buffer_delete(line, line->pos, line->len);
+                break;
+            case CtrlU:
+                line_buffer_delete(line, 0, line->pos);
+                break;
+            case CtrlW: {
+                size_t start = line->pos;
+                while (start > 0 && line->buf[start - 1] == ' ') {
+                    start--;
+                }
+                while (start > 0 && line->buf[start - 1] != ' ') {
+                    start--;
+                }
+                line_buffer_delete(line, start, line->pos);
+            }
+                break;
+            case CtrlL:
+                write_all(STDOUT_FILENO, "\033[H\033[2J", 7);
+                break;
+            case CtrlP:
+                if (history_idx > 0) {
+                    history_idx -= 1;
+                    line_buffer_set(line, history->get(history, history_idx));
+                }
+                break;
+            case CtrlN:
+                if (history != NULL && history_idx < history->length) {
+                    history_idx += 1;
+                    line_buffer_set(line, history_idx == history->length
+                                          ? "" : (char *) history->get(history, history_idx));
+                }
+                break;
+            case Esc:
+                handle_escape(line, &history_idx);
+                break;
+            default:
+                if ((unsigned char) c >= ' ') {
+                    line_buffer_insert(line, &c, 1);
+                }
+                break;
+        }
+        last_key = c;
+        if (!done && c != Tab) {
+            refresh_line(session->prompt, line);
+        }
+    }
+    write_all(STDOUT_FILENO, "\r\n", 2);
+    if (eof && !line->len) {
+        return NULL;
+    }
+    char *str = strdup(line->buf);
+    history_push(str);
+    return str;
+}
+
+void free_plain_input(void *input) { free(*(char **) input); }
+
+char *read_line_plain(char *prompt) {
+    // Lines of any length are read, long generated command lines are common here
+    char *input = NULL;
+    size_t cap = 0;
+    printf("%s", prompt);
+    fflush(stdout);
+    pthread_cleanup_push(free_plain_input, &input);
+    if (getline(&input, &cap, stdin) == -1) {
+        free(input);
+        input = NULL;
+    } else {
+        input[strcspn(input, "\n")] = '\0';
+    }
+    pthread_cleanup_pop(0);
+    return input;
+}
+
+char *read_line(char *(*render_prompt)(void *ctx), void *ctx, int notify_fd) {
+    fflush(stdout);
+    EditSession session;
+    session.render_prompt = render_prompt;
+    session.ctx = ctx;
+    session.notify_fd = notify_fd;
+    session.prompt = render_prompt(ctx);
+    if (!isatty(STDIN_FILENO) || tcgetattr(STDIN_FILENO, &session.original) == -1) {
+        char *str = read_line_plain(session.prompt);
+        free(session.prompt);
+        return str;
+    }
+    struct termios raw = session.original;
+    raw.c_iflag &= ~(IXON | ICRNL);
+    raw.c_lflag &= ~(ICANON | ECHO | IEXTEN);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    session.line = new_line_buffer();
+    char *str = NULL;
+    // The input thread may be cancelled (SIGINT) while blocked on read
+    pthread_cleanup_push(drop_edit_session, &session);
+    pthread_cleanup_push(restore_terminal, &session);
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &raw);
+    str = read_line_raw(&session);
+    pthread_cleanup_pop(1);
+    pthread_cleanup_pop(1);
+    return str;
+}
@@ -0,0 +1,32 @@
+#ifndef LIB_LINE_EDITOR_H
+#define LIB_LINE_EDITOR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define HISTORY_MAX_SIZE 512
+
+/*
+ * Line being edited by the user, `pos` is the cursor position inside `buf`.
+ */
+typedef struct lineBuffer {
+    char *buf;
+    size_t len;
+    size_t cap;
+    size_t pos;
+} LineBuffer;
+
+/*
+ * Reads a line from stdin, when it's a terminal the line is edited in raw mode
+ * with Tab completion and history, otherwise it's read as is.
+ * The prompt is rendered again in place each time `notify_fd` (if >= 0)
+ * becomes readable. Returns NULL on end of input.
+ */
+char *read_line(char *(*render_prompt)(void *ctx), void *ctx, int notify_fd);
+
+void drop_line_history();
+
+// write(2) until everything is written, retrying when interrupted
+void write_all(int fd, const char *data, size_t len);
+
+#endif
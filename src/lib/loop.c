@@ -0,0 +1,511 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc_stats.h"
+#include "glob_expand.h"
+#include "loop.h"
+
+#define ALLOC_TAG ParserAlloc
+
+typedef struct statementParser {
+    LoopPlan *plan;
+    // What's left to parse of each segment, `do cmd` and `repeat N cmd`
+    // leave the command in place once their keywords are taken
+    char **segments;
+    unsigned int len;
+    unsigned int cursor;
+} StatementParser;
+
+bool starts_with_word(char *text, char *word) {
+    size_t len = strlen(word);
+    return !strncmp(text, word, len) && (text[len] == ' ' || text[len] == '\0');
+}
+
+char *after_word(char *text) {
+    text += strcspn(text, " ");
+    return text + strspn(text, " ");
+}
+
+/*
+ * Index of the `;` ending the statement starting the text, quotes, `$(...)`
+ * and fan-out braces are skipped. Returns len when it's the last one.
+ */
+size_t statement_end(char *text, size_t len) {
+    bool quoted = false;
+    unsigned int depth = 0;
+    size_t i;
+    for (i = 0; i < len; i++) {
+        char c = text[i];
+        if (c == '"' && (!i || text[i - 1] != '\\')) {
+            quoted = !quoted;
+        } else if (quoted) {
+            continue;
+        } else if (c == '{' || (c == '(' && i && text[i - 1] == '$')) {
+            depth++;
+        } else if ((c == '}' || c == ')') && depth) {
+            depth--;
+        } else if (c == ';' && !depth) {
+            break;
+        }
+    }
+    return i;
+}
+
+/*
+ * Splits the line into its trimmed non empty statements. The here-document
+ * bodies following the line go with the first statement opening one.
+ */
+Vec *split_statements(char *line) {
+    Vec *segments = new_vec(sizeof(char *));
+    size_t line_len = strcspn(line, "\n"), start = 0;
+    char *bodies = line + line_len;
+    while (start <= line_len) {
+        size_t end = start + statement_end(line + start, line_len - start);
+        char *segment = line + start + strspn(line + start, " \t");
+        size_t len = line + end - segment;
+        while (len && (segment[len - 1] == ' ' || segment[len - 1] == '\t')) {
+            len--;
+        }
+        if (len) {
+            bool takes_bodies = *bodies && memmem(segment, len, "<<", 2) != NULL;
+            size_t bodies_len = takes_bodies ? strlen(bodies) : 0;
+            char *text = malloc(len + bodies_len + 1);
+            memcpy(text, segment, len);
+            memcpy(text + len, bodies, bodies_len);
+            text[len + bodies_len] = '\0';
+            if (takes_bodies) {
+                bodies += bodies_len;
+            }
+            segments->push(segments, text);
+        }
+        start = end + 1;
+    }
+    return segments;
+}
+
+bool is_statement_list(char *line) {
+    line += strspn(line, " \t");
+    if (starts_with_word(line, "for") || starts_with_word(line, "while") ||
+        starts_with_word(line, "repeat")) {
+        return true;
+    }
+    size_t line_len = strcspn(line, "\n");
+    return statement_end(line, line_len) < line_len;
+}
+
+bool loops_complete(char *text) {
+    Vec *segments = split_statements(text);
+    int open = 0;
+    unsigned int i;
+    for (i = 0; i < segments->length; i++) {
+        char *segment = segments->get(segments, i);
+        while (starts_with_word(segment, "do") || starts_with_word(segment, "repeat")) {
+            segment = starts_with_word(segment, "do") ? after_word(segment)
+                                                      : after_word(after_word(segment));
+        }
+        if (starts_with_word(segment, "for") || starts_with_word(segment, "while")) {
+            open++;
+        } else if (str_equals(segment, "done")) {
+            open--;
+        }
+        free(segments->get(segments, i));
+    }
+    segments->drop(segments);
+    return open <= 0;
+}
+
+void syntax_error(char *msg) { fprintf(stderr, "vsh: syntax error: %s\n", msg); }
+
+void drop_statement(Statement *self) {
+    unsigned int i;
+    if (self->head != NULL) {
+        for (i = 0; i < self->slots_len; i++) {
+            *self->slots[i].word = self->slots[i].placeholder;
+        }
+        self->head->drop(self->head);
+    }
+    if (self->body != NULL) {
+        for (i = 0; i < self->body->length; i++) {
+            Statement *statement = self->body->get(self->body, i);
+            statement->drop(statement);
+        }
+        self->body->drop(self->body);
+    }
+    free(self->prefixes);
+    free(self->slots);
+    free(self->text);
+    free(self->name);
+    free(self);
+}
+
+/*
+ * Whether the text refers to a variable other than the ones of the enclosing
+ * loops, its value is read from the environment when the statement is parsed.
+ */
+bool has_unbound_variable(char *text, Statement *parent) {
+    Statement *loop;
+    char *ref;
+    for (ref = strchr(text, '$'); ref != NULL; ref = strchr(ref + 1, '$')) {
+        size_t len = strcspn(ref + 1, " \t;|&\"'");
+        for (loop = parent; loop != NULL; loop = loop->parent) {
+            if (loop->kind == ForStatement && strlen(loop->name) == len &&
+                !strncmp(loop->name, ref + 1, len)) {
+                break;
+            }
+        }
+        if (loop == NULL) {
+            return true;
+        }
+    }
+    return false;
+}
+
+Statement *new_statement(enum StatementKind kind, char *text, Statement *parent) {
+    Statement *self = malloc(sizeof(Statement));
+    self->kind = kind;
+    self->text = text;
+    self->reparse = strstr(text, "$(") != NULL || has_glob_chars(text) ||
+                    has_unbound_variable(text, parent);
+    self->head = NULL;
+    self->prefixes = NULL;
+    self->slots = NULL;
+    self->slots_len = 0;
+    self->name = NULL;
+    self->binding = 0;
+    self->body = NULL;
+    self->parent = parent;
+    self->drop = drop_statement;
+    return self;
+}
+
+Statement *parse_statement(StatementParser *parser, Statement *parent);
+
+/*
+ * Parses `do ...; done` into the statements of the loop.
+ */
+Vec *parse_body(StatementParser *parser, Statement *loop) {
+    if (parser->cursor == parser->len ||
+        !starts_with_word(parser->segments[parser->cursor], "do")) {
+        syntax_error("expected 'do'");
+        return NULL;
+    }
+    char *first = after_word(parser->segments[parser->cursor]);
+    if (*first) {
+        parser->segments[parser->cursor] = first;
+    } else {
+        parser->cursor++;
+    }
+    Vec *body = new_vec(sizeof(Statement *));
+    while (parser->cursor < parser->len) {
+        if (str_equals(parser->segments[parser->cursor], "done")) {
+            parser->cursor++;
+            return body;
+        }
+        Statement *statement = parse_statement(parser, loop);
+        if (statement == NULL) {
+            break;
+        }
+        body->push(body, statement);
+    }
+    if (parser->cursor == parser->len) {
+        syntax_error("expected 'done'");
+    }
+    unsigned int i;
+    for (i = 0; i < body->length; i++) {
+        Statement *statement = body->get(body, i);
+        statement->drop(statement);
+    }
+    body->drop(body);
+    return NULL;
+}
+
+Statement *parse_statement(StatementParser *parser, Statement *parent) {
+    char *segment = parser->segments[parser->cursor];
+    Statement *self;
+    if (starts_with_word(segment, "for")) {
+        char *name = after_word(segment);
+        size_t name_len = strcspn(name, " ");
+        char *words = after_word(name);
+        if (!name_len || !starts_with_word(words, "in")) {
+            syntax_error("for NAME in words...; do ...; done");
+            return NULL;
+        }
+        // The words are parsed as the arguments of `in`
+        self = new_statement(ForStatement, strdup(words), parent);
+        self->name = strndup(name, name_len);
+        self->binding = parser->plan->bindings++;
+        parser->cursor++;
+        self->body = parse_body(parser, self);
+    } else if (starts_with_word(segment, "while")) {
+        char *condition = after_word(segment);
+        if (!*condition) {
+            syntax_error("while cmd; do ...; done");
+            return NULL;
+        }
+        self = new_statement(WhileStatement, strdup(condition), parent);
+        parser->cursor++;
+        self->body = parse_body(parser, self);
+    } else if (starts_with_word(segment, "repeat")) {
+        char *count = after_word(segment), *command = after_word(count);
+        size_t count_len = strcspn(count, " ");
+        if (!count_len || !*command) {
+            syntax_error("repeat N cmd");
+            return NULL;
+        }
+        char *text = malloc(count_len + 4);
+        sprintf(text, "in %.*s", (int) count_len, count);
+        self = new_statement(RepeatStatement, text, parent);
+        parser->segments[parser->cursor] = command;
+        Statement *statement = parse_statement(parser, self);
+        if (statement != NULL) {
+            self->body = new_vec(sizeof(Statement *));
+            self->body->push(self->body, statement);
+        }
+    } else if (starts_with_word(segment, "do") || str_equals(segment, "done")) {
+        syntax_error(starts_with_word(segment, "do") ? "unexpected 'do'" : "unexpected 'done'");
+        return NULL;
+    } else {
+        parser->cursor++;
+        return new_statement(CommandStatement, strdup(segment), parent);
+    }
+    if (self->body == NULL) {
+        self->drop(self);
+        return NULL;
+    }
+    return self;
+}
+
+LoopPlan *compile_loop_plan(char *line) {
+    LoopPlan *self = malloc(sizeof(LoopPlan));
+    self->statements = new_vec(sizeof(Statement *));
+    self->values = NULL;
+    self->bindings = 0;
+    self->interrupts = 0;
+    self->drop = drop_loop_plan;
+    Vec *segments = split_statements(line);
+    unsigned int len = segments->length;
+    char **owned = (char **) segments->take_arr(segments);
+    char *cursors[len ? len : 1];
+    memcpy(cursors, owned, sizeof(char *) * len);
+    StatementParser parser = {self, cursors, len, 0};
+    while (parser.cursor < len) {
+        Statement *statement = parse_statement(&parser, NULL);
+        if (statement == NULL) {
+            self->drop(self);
+            self = NULL;
+            break;
+        }
+        self->statements->push(self->statements, statement);
+    }
+    unsigned int i;
+    for (i = 0; i < len; i++) {
+        free(owned[i]);
+    }
+    free(owned);
+    if (self != NULL) {
+        self->values = calloc(self->bindings ? self->bindings : 1, sizeof(char *));
+    }
+    return self;
+}
+
+void drop_loop_plan(LoopPlan *self) {
+    unsigned int i;
+    for (i = 0; i < self->statements->length; i++) {
+        Statement *statement = self->statements->get(self->statements, i);
+        statement->drop(statement);
+    }
+    self->statements->drop(self->statements);
+    free(self->values);
+    free(self);
+}
+
+/*
+ * The loop whose variable the `$NAME` word of the statement stands for.
+ */
+Statement *binding_loop(Statement *statement, char *word) {
+    Statement *loop;
+    if (word[0] != '$') {
+        return NULL;
+    }
+    for (loop = statement->parent; loop != NULL; loop = loop->parent) {
+        if (loop->kind == ForStatement && str_equals(loop->name, word + 1)) {
+            return loop;
+        }
+    }
+    return NULL;
+}
+
+void push_slot(Statement *self, char **word, unsigned int binding) {
+    self->slots = realloc(self->slots, sizeof(LoopSlot) * (self->slots_len + 1));
+    self->slots[self->slots_len++] = (LoopSlot) {word, *word, binding};
+}
+
+/*
+ * Parses the text of the statement. Unless reparsed the result is kept, its
+ * group prefixes taken and the words of the loop variables made slots.
+ */
+CallGroups *parse_head(ShellState *state, Statement *self) {
+    CallArg *call_arg = initialize_call_arg(self->text);
+    call_arg->state = state;
+    Vec *late_bound = NULL;
+    Statement *loop;
+    if (!self->reparse) {
+        late_bound = new_vec(sizeof(char *));
+        for (loop = self->parent; loop != NULL; loop = loop->parent) {
+            if (loop->kind == ForStatement) {
+                late_bound->push(late_bound, loop->name);
+            }
+        }
+        call_arg->late_bound = late_bound;
+    }
+    CallGroups *groups = call_arg->call_groups(call_arg);
+    call_arg->drop(call_arg);
+    if (self->reparse) {
+        return groups;
+    }
+    late_bound->drop(late_bound);
+    self->head = groups;
+    self->prefixes = malloc(sizeof(GroupPrefixes) * (groups->len ? groups->len : 1));
+    int i;
+    unsigned int j, k;
+    for (i = 0; i < groups->len; i++) {
+        CallGroup *call_group = groups->groups[i];
+        take_group_prefixes(call_group, &self->prefixes[i]);
+        for (j = 0; j < call_group->exec_amount; j++) {
+            ExecArgs *exec_args = call_group->exec_arr[j];
+            for (k = 0; k < exec_args->argc; k++) {
+                if ((loop = binding_loop(self, exec_args->argv[k])) != NULL) {
+                    push_slot(self, &exec_args->argv[k], loop->binding);
+                }
+            }
+        }
+    }
+    return groups;
+}
+
+CallGroups *bound_head(ShellState *state, LoopPlan *plan, Statement *self) {
+    CallGroups *groups = self->head != NULL ? self->head : parse_head(state, self);
+    unsigned int i;
+    for (i = 0; i < self->slots_len; i++) {
+        *self->slots[i].word = plan->values[self->slots[i].binding];
+    }
+    return groups;
+}
+
+void drop_reparsed_head(Statement *self, CallGroups *groups) {
+    if (self->reparse) {
+        groups->drop(groups);
+    }
+}
+
+/*
+ * The arguments of the `in` of a `for` or `repeat` head.
+ */
+ExecArgs *head_words(CallGroups *groups) {
+    if (groups->len && groups->groups[0]->exec_amount) {
+        return groups->groups[0]->exec_arr[0];
+    }
+    return NULL;
+}
+
+bool loop_stopped(LoopPlan *plan, bool *should_continue) {
+    return !*should_continue || sig_int_count != plan->interrupts || timed_group_expired;
+}
+
+void run_statements(ShellState *state, LoopPlan *plan, Vec *statements, bool *should_continue,
+                    int *status_code);
+
+void run_head_command(ShellState *state, LoopPlan *plan, Statement *self, bool *should_continue,
+                      int *status_code) {
+    if (self->reparse) {
+        call_line_handler(state, self->text, should_continue, status_code);
+        return;
+    }
+    CallGroups *groups = bound_head(state, plan, self);
+    int i;
+    for (i = 0; i < groups->len && *should_continue; i++) {
+        prefixed_group_handler(state, groups->groups[i], &self->prefixes[i], should_continue,
+                               status_code);
+    }
+}
+
+void run_for(ShellState *state, LoopPlan *plan, Statement *self, bool *should_continue,
+             int *status_code) {
+    CallGroups *groups = bound_head(state, plan, self);
+    ExecArgs *words = head_words(groups);
+    int status = 0;
+    unsigned int i;
+    for (i = 1; words != NULL && i < words->argc && !loop_stopped(plan, should_continue); i++) {
+        plan->values[self->binding] = words->argv[i];
+        // Lines parsed again, and the commands run, see it as an environment variable
+        setenv(self->name, words->argv[i], 1);
+        run_statements(state, plan, self->body, should_continue, status_code);
+        status = state->last_status;
+    }
+    drop_reparsed_head(self, groups);
+    state->last_status = status;
+}
+
+void run_while(ShellState *state, LoopPlan *plan, Statement *self, bool *should_continue,
+               int *status_code) {
+    int status = 0;
+    while (!loop_stopped(plan, should_continue)) {
+        run_head_command(state, plan, self, should_continue, status_code);
+        if (state->last_status || loop_stopped(plan, should_continue)) {
+            break;
+        }
+        run_statements(state, plan, self->body, should_continue, status_code);
+        status = state->last_status;
+    }
+    state->last_status = status;
+}
+
+void run_repeat(ShellState *state, LoopPlan *plan, Statement *self, bool *should_continue,
+                int *status_code) {
+    CallGroups *groups = bound_head(state, plan, self);
+    ExecArgs *words = head_words(groups);
+    char *end = NULL;
+    unsigned long count = words != NULL && words->argc == 2 ? strtoul(words->argv[1], &end, 10) : 0;
+    if (end == NULL || *end || end == words->argv[1]) {
+        fprintf(stderr, "repeat: invalid count '%s'\n", self->text + 3);
+        drop_reparsed_head(self, groups);
+        state->last_status = 2;
+        return;
+    }
+    drop_reparsed_head(self, groups);
+    int status = 0;
+    unsigned long i;
+    for (i = 0; i < count && !loop_stopped(plan, should_continue); i++) {
+        run_statements(state, plan, self->body, should_continue, status_code);
+        status = state->last_status;
+    }
+    state->last_status = status;
+}
+
+void run_statements(ShellState *state, LoopPlan *plan, Vec *statements, bool *should_continue,
+                    int *status_code) {
+    unsigned int i;
+    for (i = 0; i < statements->length && !loop_stopped(plan, should_continue); i++) {
+        Statement *statement = statements->get(statements, i);
+        switch (statement->kind) {
+            case CommandStatement:
+                run_head_command(state, plan, statement, should_continue, status_code);
+                break;
+            case ForStatement:
+                run_for(state, plan, statement, should_continue, status_code);
+                break;
+            case WhileStatement:
+                run_while(state, plan, statement, should_continue, status_code);
+                break;
+            case RepeatStatement:
+                run_repeat(state, plan, statement, should_continue, status_code);
+                break;
+        }
+    }
+}
+
+void loop_plan_handler(ShellState *state, LoopPlan *plan, bool *should_continue,
+                       int *status_code) {
+    plan->interrupts = sig_int_count;
+    run_statements(state, plan, plan->statements, should_continue, status_code);
+}
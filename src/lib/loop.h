@@ -0,0 +1,92 @@
+#ifndef LIB_LOOP_H
+#define LIB_LOOP_H
+
+#include <stdbool.h>
+#include "handlers.h"
+#include "lib.h"
+
+/*
+ * A line of `;` separated statements, or one starting a loop:
+ *
+ *     for NAME in words...; do ...; done
+ *     while cmd; do ...; done
+ *     repeat N cmd
+ *
+ * is turned into a plan whose statements are parsed the first time they run
+ * and reused afterwards. The `$NAME` words of a loop body aren't expanded,
+ * they are slots each iteration points at the current value, so running the
+ * body again parses and allocates nothing. Statements with a command
+ * substitution, a glob or another variable are parsed again each time, their
+ * result may change between iterations. A loop spanning several lines is read as a whole, its
+ * lines joined with `;`.
+ */
+enum StatementKind {
+    CommandStatement,
+    ForStatement,
+    WhileStatement,
+    RepeatStatement,
+};
+
+/*
+ * A word of a parsed statement standing for a loop variable.
+ */
+typedef struct loopSlot {
+    char **word;
+    // The `$NAME` word itself, put back before the statement is dropped
+    char *placeholder;
+    unsigned int binding;
+} LoopSlot;
+
+typedef struct statement {
+    enum StatementKind kind;
+    // The command, the `for` words, the `while` condition or the `repeat` count
+    char *text;
+    bool reparse;
+    // Parsed text, NULL until the statement first runs or when reparsed
+    CallGroups *head;
+    GroupPrefixes *prefixes;
+    LoopSlot *slots;
+    unsigned int slots_len;
+    // Variable of a `for` and its index in the plan's values
+    char *name;
+    unsigned int binding;
+    Vec *body;
+    struct statement *parent;
+
+    void (*drop)(struct statement *self);
+} Statement;
+
+typedef struct loopPlan {
+    Vec *statements;
+    // Current value of each `for` variable, indexed by their binding
+    char **values;
+    unsigned int bindings;
+    // sig_int_count when the plan started, it stops once that changes
+    sig_atomic_t interrupts;
+
+    void (*drop)(struct loopPlan *self);
+} LoopPlan;
+
+/*
+ * Whether the line has to be run as a plan, it starts a loop or has several
+ * statements.
+ */
+bool is_statement_list(char *line);
+
+/*
+ * Whether every loop the text opens is closed, the next line is read as part
+ * of the same command line otherwise.
+ */
+bool loops_complete(char *text);
+
+/*
+ * Returns NULL, after printing why, when the statements are malformed.
+ */
+LoopPlan *compile_loop_plan(char *line);
+
+void drop_loop_plan(LoopPlan *self);
+
+void loop_plan_handler(ShellState *state, LoopPlan *plan, bool *should_continue,
+                       int *status_code);
+
+#endif
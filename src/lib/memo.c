@@ -0,0 +1,368 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "alloc_stats.h"
+#include "here_doc.h"
+#include "line_editor.h"
+#include "memo.h"
+#include "path_cache.h"
+#include "process.h"
+#include "util/string_util/string_util.h"
+
+#define ALLOC_TAG ExecAlloc
+
+extern char **environ;
+
+void memo_keep_input(MemoKey *key, const void *data, size_t len) {
+    if (key->inputs_len + len > key->inputs_cap) {
+        key->inputs_cap = (key->inputs_len + len) * 2;
+        key->inputs = realloc(key->inputs, key->inputs_cap);
+    }
+    memcpy(key->inputs + key->inputs_len, data, len);
+    key->inputs_len += len;
+}
+
+/*
+ * Two FNV-1a hashes with different offsets make the 128 bits name of the
+ * entry, the hashed data is kept as well to tell apart colliding keys.
+ */
+void memo_hash(MemoKey *key, const void *data, size_t len) {
+    const unsigned char *bytes = data;
+    size_t i;
+    memo_keep_input(key, data, len);
+    memo_keep_input(key, &len, sizeof(len));
+    for (i = 0; i < len; i++) {
+        key->high = (key->high ^ bytes[i]) * 1099511628211ULL;
+        key->low = (key->low ^ bytes[i]) * 1099511628211ULL;
+    }
+    // The length separates consecutive fields ("ab","c" from "a","bc")
+    key->high = (key->high ^ len) * 1099511628211ULL;
+    key->low = (key->low ^ (len + 1)) * 1099511628211ULL;
+}
+
+void memo_hash_str(MemoKey *key, const char *str) { memo_hash(key, str, str ? strlen(str) : 0); }
+
+void memo_hash_env(MemoKey *key) {
+    char cwd[PATH_MAX];
+    memo_hash_str(key, getcwd(cwd, sizeof(cwd)) ? cwd : "");
+    memo_hash_str(key, getenv("PATH"));
+    char *names = getenv("VSH_MEMO_ENV");
+    if (names == NULL) {
+        return;
+    }
+    char *copy = strdup(names), *save = NULL, *name;
+    for (name = strtok_r(copy, ",", &save); name != NULL; name = strtok_r(NULL, ",", &save)) {
+        memo_hash_str(key, name);
+        memo_hash_str(key, getenv(name));
+    }
+    free(copy);
+}
+
+void memo_hash_input(MemoKey *key, char *path) {
+    struct stat st;
+    memo_hash_str(key, path);
+    if (stat(path, &st) == -1) {
+        memo_hash_str(key, "missing");
+        return;
+    }
+    uint64_t fingerprint[5] = {st.st_size, st.st_mtim.tv_sec, st.st_mtim.tv_nsec, st.st_ino,
+                               st.st_dev};
+    memo_hash(key, fingerprint, sizeof(fingerprint));
+}
+
+/*
+ * The body of a here-doc given as stdin, the output depends on it too.
+ */
+void memo_hash_here_doc(MemoKey *key, int here_doc) {
+    struct stat st;
+    if (fstat(here_doc, &st) == -1) {
+        memo_hash_str(key, "unreadable stdin");
+        return;
+    }
+    char *body = malloc(st.st_size ? st.st_size : 1);
+    ssize_t amount = pread(here_doc, body, st.st_size, 0);
+    memo_hash(key, body, amount > 0 ? amount : 0);
+    free(body);
+}
+
+char *memo_dir() {
+    char *dir = getenv("VSH_MEMO_DIR");
+    char path[PATH_MAX];
+    if (dir != NULL) {
+        snprintf(path, sizeof(path), "%s", dir);
+    } else if (getenv("XDG_CACHE_HOME") != NULL) {
+        snprintf(path, sizeof(path), "%s/vsh/memo", getenv("XDG_CACHE_HOME"));
+    } else {
+        snprintf(path, sizeof(path), "%s/.cache/vsh/memo",
+                 getenv("HOME") ? getenv("HOME") : "/tmp");
+    }
+    // Creates every missing directory of the path
+    char *slash;
+    for (slash = strchr(path + 1, '/'); slash != NULL; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        mkdir(path, 0700);
+        *slash = '/';
+    }
+    if (mkdir(path, 0700) == -1 && errno != EEXIST) {
+        fprintf(stderr, "memo: %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    return strdup(path);
+}
+
+/*
+ * Copies the rest of the file to out_fd, in kernel when out_fd allows it.
+ */
+void memo_replay(int fd, off_t offset, off_t size, int out_fd) {
+    char buf[MEMO_COPY_SIZE];
+    fflush(stdout);
+    while (offset < size) {
+        ssize_t sent = sendfile(out_fd, fd, &offset, size - offset);
+        if (sent > 0) {
+            continue;
+        }
+        if (sent == -1 && errno == EINTR) {
+            continue;
+        }
+        if (sent == -1 && (errno == EINVAL || errno == ENOSYS)) {
+            ssize_t amount = pread(fd, buf, sizeof(buf), offset);
+            if (amount > 0) {
+                write_all(out_fd, buf, amount);
+                offset += amount;
+                continue;
+            }
+        }
+        break;
+    }
+}
+
+/*
+ * Whether the entry was stored for the same inputs as the key.
+ */
+bool memo_inputs_match(int fd, char *header, MemoKey *key) {
+    uint32_t inputs_len;
+    memcpy(&inputs_len, header + strlen(MEMO_MAGIC) + sizeof(int), sizeof(uint32_t));
+    if (inputs_len != key->inputs_len) {
+        return false;
+    }
+    char *inputs = malloc(inputs_len ? inputs_len : 1);
+    bool matches = pread(fd, inputs, inputs_len, MEMO_HEADER_SIZE) == (ssize_t) inputs_len &&
+                   !memcmp(inputs, key->inputs, inputs_len);
+    free(inputs);
+    return matches;
+}
+
+/*
+ * Returns the stored exit status, or -1 when there isn't a valid entry.
+ */
+int memo_lookup(char *path, MemoKey *key, int out_fd) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    char header[MEMO_HEADER_SIZE];
+    struct stat st;
+    int status = -1;
+    if (pread(fd, header, MEMO_HEADER_SIZE, 0) == MEMO_HEADER_SIZE &&
+        !memcmp(header, MEMO_MAGIC, strlen(MEMO_MAGIC)) && fstat(fd, &st) == 0 &&
+        memo_inputs_match(fd, header, key)) {
+        memcpy(&status, header + strlen(MEMO_MAGIC), sizeof(int));
+        // The mtime is the last use of the entry for the eviction
+        futimens(fd, NULL);
+        memo_replay(fd, MEMO_HEADER_SIZE + (off_t) key->inputs_len, st.st_size, out_fd);
+    }
+    close(fd);
+    return status;
+}
+
+/*
+ * Runs the command writing its output both to out_fd and to the cache file,
+ * with the here-doc as stdin unless it's -1. Returns its wait status, or -1
+ * when it couldn't be started. cached is cleared when writing the cache file
+ * failed, closing it is left to the caller.
+ */
+int memo_run(char **argv, int here_doc, int out_fd, int cache_fd, bool *cached) {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) == -1) {
+        perror("memo: pipe failed");
+        return -1;
+    }
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+    int stdin_fd = here_doc != -1 ? open_here_doc(here_doc) : -1;
+    if (stdin_fd != -1) {
+        posix_spawn_file_actions_adddup2(&actions, stdin_fd, STDIN_FILENO);
+    }
+    char *path = resolve_command_path(argv[0]);
+    pid_t pid;
+    fflush(stdout);
+    int error = path != NULL ? posix_spawn(&pid, path, &actions, NULL, argv, environ)
+                             : posix_spawnp(&pid, argv[0], &actions, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(fds[1]);
+    if (stdin_fd != -1) {
+        close(stdin_fd);
+    }
+    if (error) {
+        fprintf(stderr, "memo: %s: %s\n", argv[0], strerror(error));
+        close(fds[0]);
+        return -1;
+    }
+    char buf[MEMO_COPY_SIZE];
+    ssize_t amount;
+    while ((amount = read(fds[0], buf, sizeof(buf))) != 0) {
+        if (amount == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        write_all(out_fd, buf, amount);
+        if (*cached && write(cache_fd, buf, amount) != amount) {
+            // A full disk only costs the entry, the output is still shown
+            *cached = false;
+        }
+    }
+    close(fds[0]);
+    int wait_status;
+    struct rusage usage;
+    if (wait_child_usage(pid, &wait_status, &usage) == -1) {
+        return -1;
+    }
+    return wait_status;
+}
+
+int compare_memo_entries(const void *a, const void *b) {
+    const MemoEntry *x = a, *y = b;
+    if (x->mtime.tv_sec != y->mtime.tv_sec) {
+        return x->mtime.tv_sec < y->mtime.tv_sec ? -1 : 1;
+    }
+    return (x->mtime.tv_nsec > y->mtime.tv_nsec) - (x->mtime.tv_nsec < y->mtime.tv_nsec);
+}
+
+/*
+ * Removes the least recently used entries until the directory fits its limit.
+ */
+void memo_evict(char *dir) {
+    char *max_env = getenv("VSH_MEMO_MAX_SIZE");
+    off_t max_size = max_env != NULL ? strtoll(max_env, NULL, 10) : MEMO_DEFAULT_MAX_SIZE;
+    DIR *dir_stream = opendir(dir);
+    if (dir_stream == NULL) {
+        return;
+    }
+    int dir_fd = dirfd(dir_stream);
+    MemoEntry *entries = NULL;
+    unsigned int len = 0, cap = 0, i;
+    off_t total = 0;
+    struct dirent *dirent;
+    while ((dirent = readdir(dir_stream)) != NULL) {
+        struct stat st;
+        if (dirent->d_name[0] == '.' || fstatat(dir_fd, dirent->d_name, &st, 0) == -1 ||
+            !S_ISREG(st.st_mode)) {
+            continue;
+        }
+        if (len == cap) {
+            cap = cap ? cap * 2 : 64;
+            entries = realloc(entries, sizeof(MemoEntry) * cap);
+        }
+        entries[len++] = (MemoEntry) {strdup(dirent->d_name), st.st_size, st.st_mtim};
+        total += st.st_size;
+    }
+    if (total > max_size) {
+        qsort(entries, len, sizeof(MemoEntry), compare_memo_entries);
+        for (i = 0; i < len && total > max_size; i++) {
+            if (unlinkat(dir_fd, entries[i].name, 0) == 0) {
+                total -= entries[i].size;
+            }
+        }
+    }
+    for (i = 0; i < len; i++) {
+        free(entries[i].name);
+    }
+    free(entries);
+    closedir(dir_stream);
+}
+
+void memo_usage() { fprintf(stderr, "usage: memo [--inputs files... --] cmd args...\n"); }
+
+int memo_builtin(ShellState *state, ExecArgs *exec_args) {
+    (void) state;
+    char **argv = exec_args->argv;
+    unsigned int argc = exec_args->argc, i = 1, inputs_start = 0, inputs_end = 0;
+    if (argc > 1 && str_equals(argv[1], "--inputs")) {
+        inputs_start = 2;
+        for (i = 2; i < argc && !str_equals(argv[i], "--"); i++);
+        inputs_end = i;
+        i += 1;
+    }
+    if (i >= argc) {
+        memo_usage();
+        return 2;
+    }
+    MemoKey key = {14695981039346656037ULL, 0x6c62272e07bb0142ULL, NULL, 0, 0};
+    unsigned int j;
+    for (j = i; j < argc; j++) {
+        memo_hash_str(&key, argv[j]);
+    }
+    memo_hash_env(&key);
+    for (j = inputs_start; j < inputs_end; j++) {
+        memo_hash_input(&key, argv[j]);
+    }
+    if (exec_args->stdin_fd != -1) {
+        memo_hash_here_doc(&key, exec_args->stdin_fd);
+    }
+    int out_fd = exec_args->stdout_fd != -1 ? exec_args->stdout_fd : STDOUT_FILENO;
+    char *dir = memo_dir();
+    if (dir == NULL) {
+        free(key.inputs);
+        return 1;
+    }
+    char path[PATH_MAX], tmp_path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%016llx%016llx", dir, (unsigned long long) key.high,
+             (unsigned long long) key.low);
+    int status = memo_lookup(path, &key, out_fd);
+    if (status != -1) {
+        free(key.inputs);
+        free(dir);
+        return status;
+    }
+    snprintf(tmp_path, sizeof(tmp_path), "%s/.tmp.%d", dir, getpid());
+    int cache_fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    char header[MEMO_HEADER_SIZE] = {0};
+    bool cached = cache_fd != -1 && write(cache_fd, header, MEMO_HEADER_SIZE) == MEMO_HEADER_SIZE &&
+                  write(cache_fd, key.inputs, key.inputs_len) == (ssize_t) key.inputs_len;
+    int wait_status = memo_run(argv + i, exec_args->stdin_fd, out_fd, cache_fd, &cached);
+    status = wait_status == -1 ? 127 : exit_code_from_wait_status(wait_status);
+    // Runs ended by a signal (an interrupt most likely) aren't kept
+    bool keep = cached && wait_status != -1 && WIFEXITED(wait_status);
+    if (keep) {
+        memcpy(header, MEMO_MAGIC, strlen(MEMO_MAGIC));
+        memcpy(header + strlen(MEMO_MAGIC), &status, sizeof(int));
+        uint32_t inputs_len = key.inputs_len;
+        memcpy(header + strlen(MEMO_MAGIC) + sizeof(int), &inputs_len, sizeof(uint32_t));
+        keep = pwrite(cache_fd, header, MEMO_HEADER_SIZE, 0) == MEMO_HEADER_SIZE &&
+               rename(tmp_path, path) == 0;
+    }
+    if (cache_fd != -1) {
+        close(cache_fd);
+    }
+    if (!keep) {
+        unlink(tmp_path);
+    } else {
+        memo_evict(dir);
+    }
+    free(key.inputs);
+    free(dir);
+    return status;
+}
@@ -0,0 +1,42 @@
+#ifndef LIB_MEMO_H
+#define LIB_MEMO_H
+
+#include <stdint.h>
+#include "lib.h"
+
+#define MEMO_MAGIC "VSHMEMO2"
+#define MEMO_HEADER_SIZE 16
+#define MEMO_DEFAULT_MAX_SIZE (256L * 1024 * 1024)
+#define MEMO_COPY_SIZE (64 * 1024)
+
+/*
+ * `memo [--inputs files... --] cmd args...` replays the stdout and the exit
+ * status of a previous run of the command while nothing it depends on changed:
+ * its argv, the working directory, PATH, the variables named in VSH_MEMO_ENV,
+ * the size, mtime and inode of the input files and the here-doc given as stdin.
+ *
+ * Entries live in VSH_MEMO_DIR (~/.cache/vsh/memo by default), named by the
+ * hash of those inputs. Each one is a MEMO_HEADER_SIZE header (magic, exit
+ * status and length of the inputs), the inputs themselves, compared on lookup
+ * so a hash collision is only a miss, and then the output. Their mtime is
+ * updated on each hit and the least recently used ones are removed when the
+ * directory exceeds VSH_MEMO_MAX_SIZE bytes.
+ */
+typedef struct memoKey {
+    uint64_t high;
+    uint64_t low;
+    // Everything hashed, each field followed by its length
+    char *inputs;
+    size_t inputs_len;
+    size_t inputs_cap;
+} MemoKey;
+
+typedef struct memoEntry {
+    char *name;
+    off_t size;
+    struct timespec mtime;
+} MemoEntry;
+
+int memo_builtin(ShellState *state, ExecArgs *exec_args);
+
+#endif
@@ -0,0 +1,273 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "alloc_stats.h"
+#include "handlers.h"
+#include "on_change.h"
+#include "process.h"
+#include "util/string_util/string_util.h"
+
+#define ALLOC_TAG ExecAlloc
+
+void on_change_usage() {
+    fprintf(stderr, "usage: on-change [--debounce MS] [-r] paths... -- cmd [args...]\n");
+}
+
+/*
+ * The command of several words, already expanded by the parser, runs as they
+ * were given each time.
+ */
+CallGroup *command_group(char **words, unsigned int len) {
+    Vec *vec_string = new_vec_string();
+    unsigned int i;
+    for (i = 0; i < len; i++) {
+        vec_string->push(vec_string, strdup(words[i]));
+    }
+    Vec *vec_exec_args = new_vec_exec_args();
+    vec_exec_args->push(vec_exec_args, exec_args_from_vec_str(vec_string, -1));
+    return call_group_from_vec_exec_args(vec_exec_args, Basic);
+}
+
+long monotonic_ms() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+bool add_watch(ChangeWatcher *watcher, const char *path) {
+    int wd = inotify_add_watch(watcher->fd, path, ON_CHANGE_EVENT_MASK | IN_DONT_FOLLOW);
+    if (wd == -1) {
+        if (errno == ENOSPC) {
+            fprintf(stderr, "on-change: out of inotify watches, raise "
+                            "fs.inotify.max_user_watches\n");
+        } else if (errno != ENOENT) {
+            fprintf(stderr, "on-change: %s: %s\n", path, strerror(errno));
+        }
+        return false;
+    }
+    if ((unsigned int) wd >= watcher->paths_cap) {
+        unsigned int cap = watcher->paths_cap ? watcher->paths_cap : 64;
+        while (cap <= (unsigned int) wd) {
+            cap *= 2;
+        }
+        watcher->paths = realloc(watcher->paths, sizeof(char *) * cap);
+        memset(watcher->paths + watcher->paths_cap, 0,
+               sizeof(char *) * (cap - watcher->paths_cap));
+        watcher->paths_cap = cap;
+    }
+    if (watcher->paths[wd] == NULL) {
+        watcher->watches++;
+    }
+    free(watcher->paths[wd]);
+    watcher->paths[wd] = strdup(path);
+    return true;
+}
+
+// nftw has no user data argument
+ChangeWatcher *walked_watcher;
+
+int watch_tree_entry(const char *path, const struct stat *stat_buf, int type,
+                     struct FTW *ftw_buf) {
+    (void) stat_buf;
+    (void) ftw_buf;
+    if (type == FTW_D) {
+        // Running out of watches stops the walk, the error is already reported
+        return add_watch(walked_watcher, path) || errno != ENOSPC ? FTW_CONTINUE : FTW_STOP;
+    }
+    return FTW_CONTINUE;
+}
+
+bool watch_path(ChangeWatcher *watcher, const char *path) {
+    struct stat stat_buf;
+    if (stat(path, &stat_buf) == -1) {
+        fprintf(stderr, "on-change: %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    if (!watcher->recursive || !S_ISDIR(stat_buf.st_mode)) {
+        return add_watch(watcher, path);
+    }
+    walked_watcher = watcher;
+    // Only directories are watched, so a tree of files costs its directories
+    return nftw(path, watch_tree_entry, 32, FTW_PHYS | FTW_ACTIONRETVAL) == 0;
+}
+
+/*
+ * Reads the pending events, returns whether any of them is a change.
+ */
+bool read_changes(ChangeWatcher *watcher) {
+    char buffer[ON_CHANGE_EVENTS_SIZE]
+            __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool changed = false;
+    ssize_t len;
+    while ((len = read(watcher->fd, buffer, sizeof(buffer))) > 0) {
+        char *ptr;
+        for (ptr = buffer; ptr < buffer + len;) {
+            struct inotify_event *event = (struct inotify_event *) ptr;
+            ptr += sizeof(struct inotify_event) + event->len;
+            if (event->mask & IN_Q_OVERFLOW) {
+                changed = true;
+                continue;
+            }
+            char *dir = event->wd < (int) watcher->paths_cap ? watcher->paths[event->wd] : NULL;
+            if (event->mask & IN_IGNORED) {
+                if (dir != NULL) {
+                    free(dir);
+                    watcher->paths[event->wd] = NULL;
+                    watcher->watches--;
+                }
+                continue;
+            }
+            changed = true;
+            if (watcher->recursive && dir != NULL && (event->mask & IN_ISDIR) &&
+                (event->mask & (IN_CREATE | IN_MOVED_TO)) && event->len) {
+                char *path = malloc(strlen(dir) + strlen(event->name) + 2);
+                sprintf(path, "%s/%s", dir, event->name);
+                watch_path(watcher, path);
+                free(path);
+            }
+        }
+    }
+    return changed;
+}
+
+/*
+ * Stops the whole group of the run, killing it when it ignores SIGTERM.
+ */
+int cancel_run(pid_t run) {
+    int wait_status;
+    killpg(run, SIGTERM);
+    long deadline = monotonic_ms() + ON_CHANGE_KILL_GRACE_MS;
+    while (waitpid(run, &wait_status, WNOHANG) == 0) {
+        if (monotonic_ms() >= deadline) {
+            struct rusage usage;
+            killpg(run, SIGKILL);
+            wait_child_usage(run, &wait_status, &usage);
+            break;
+        }
+        usleep(10000);
+    }
+    // Whatever the leader left behind goes too
+    killpg(run, SIGKILL);
+    return exit_code_from_wait_status(wait_status);
+}
+
+int on_change_builtin(ShellState *state, ExecArgs *exec_args) {
+    char **argv = exec_args->argv;
+    unsigned int argc = exec_args->argc, i = 1, paths_start, paths_end;
+    long debounce = ON_CHANGE_DEFAULT_DEBOUNCE_MS;
+    ChangeWatcher watcher = {0};
+    for (; i < argc; i++) {
+        if (str_equals(argv[i], "-r")) {
+            watcher.recursive = true;
+        } else if (str_equals(argv[i], "--debounce") && i + 1 < argc) {
+            char *end;
+            debounce = strtol(argv[++i], &end, 10);
+            if (*end || debounce < 0) {
+                on_change_usage();
+                return 2;
+            }
+        } else {
+            break;
+        }
+    }
+    paths_start = i;
+    for (; i < argc && !str_equals(argv[i], "--"); i++);
+    paths_end = i;
+    if (paths_start == paths_end || i + 1 >= argc) {
+        on_change_usage();
+        return 2;
+    }
+    watcher.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watcher.fd == -1) {
+        perror("on-change: inotify_init1 failed");
+        return 1;
+    }
+    int status = 0;
+    for (i = paths_start; i < paths_end; i++) {
+        if (!watch_path(&watcher, argv[i])) {
+            status = 1;
+            break;
+        }
+    }
+    // A single word is a line of its own, as `-- "make && ./test"`
+    unsigned int words = argc - paths_end - 1;
+    char *line = words == 1 ? strdup(argv[paths_end + 1]) : NULL;
+    CallGroup *call_group = words > 1 ? command_group(argv + paths_end + 1, words) : NULL;
+    pid_t run = -1;
+    int run_fd = -1;
+    long changed_at = -1;
+    sig_atomic_t interrupts = sig_int_count;
+    bool has_run = false;
+    while (!status && sig_int_count == interrupts) {
+        if (!has_run || (changed_at != -1 && monotonic_ms() - changed_at >= debounce)) {
+            if (run != -1) {
+                fprintf(stderr, "on-change: restarting\n");
+                cancel_run(run);
+                close(run_fd);
+            }
+            changed_at = -1;
+            has_run = true;
+            run = line != NULL ? spawn_line_group(state, line) : spawn_call_group(state, call_group);
+            if (run == -1) {
+                status = 1;
+                break;
+            }
+            // The pidfd turns the end of the run into one more event to poll
+            run_fd = open_pidfd(run);
+            child_pgid = run;
+        }
+        struct pollfd fds[2] = {{watcher.fd, POLLIN, 0}, {run_fd, POLLIN, 0}};
+        int timeout = -1;
+        if (changed_at != -1) {
+            long left = debounce - (monotonic_ms() - changed_at);
+            timeout = left > 0 ? (int) left : 0;
+        } else if (run != -1 && run_fd == -1) {
+            timeout = 100;
+        }
+        if (poll(fds, run != -1 ? 2 : 1, timeout) == -1 && errno != EINTR) {
+            perror("on-change: poll failed");
+            status = 1;
+            break;
+        }
+        if (read_changes(&watcher)) {
+            changed_at = monotonic_ms();
+        }
+        int wait_status;
+        if (run != -1 && waitpid(run, &wait_status, WNOHANG) == run) {
+            int code = exit_code_from_wait_status(wait_status);
+            fprintf(stderr, "on-change: exited %d, waiting for changes\n", code);
+            // The group may have left background children behind
+            killpg(run, SIGKILL);
+            close(run_fd);
+            run = run_fd = -1;
+            child_pgid = 0;
+            state->last_status = code;
+        }
+    }
+    if (run != -1) {
+        state->last_status = cancel_run(run);
+        close(run_fd);
+        child_pgid = 0;
+    }
+    for (i = 0; i < watcher.paths_cap; i++) {
+        free(watcher.paths[i]);
+    }
+    free(watcher.paths);
+    free(line);
+    if (call_group != NULL) {
+        call_group->drop(call_group);
+    }
+    close(watcher.fd);
+    return status ? status : 128 + SIGINT;
+}
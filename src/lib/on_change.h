@@ -0,0 +1,36 @@
+#ifndef LIB_ON_CHANGE_H
+#define LIB_ON_CHANGE_H
+
+#include <stdbool.h>
+#include "lib.h"
+
+#define ON_CHANGE_DEFAULT_DEBOUNCE_MS 100
+#define ON_CHANGE_EVENTS_SIZE (64 * 1024)
+// Time a cancelled run gets to exit after SIGTERM before it's killed
+#define ON_CHANGE_KILL_GRACE_MS 2000
+#define ON_CHANGE_EVENT_MASK                                                                      \
+    (IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB |           \
+     IN_DELETE_SELF | IN_MOVE_SELF)
+
+/*
+ * `on-change [--debounce MS] [-r] paths... -- cmd` runs the command line once
+ * and again after the watched paths change, until interrupted.
+ *
+ * Watches are inotify ones, with -r one per directory of the trees (inotify
+ * reports the changes of the files of a directory on its own watch), new
+ * directories being watched as they appear. A burst of events restarts the
+ * command once, MS milliseconds after the last of them, and a run still going
+ * on then is stopped with killpg first.
+ */
+typedef struct changeWatcher {
+    int fd;
+    bool recursive;
+    // Watched path of each watch descriptor, indexed by it
+    char **paths;
+    unsigned int paths_cap;
+    unsigned int watches;
+} ChangeWatcher;
+
+int on_change_builtin(ShellState *state, ExecArgs *exec_args);
+
+#endif
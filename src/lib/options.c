@@ -0,0 +1,94 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc_stats.h"
+#include "options.h"
+#include "util/string_util/string_util.h"
+
+#define ALLOC_TAG StateAlloc
+
+bool is_valid_cpu_list(char *value) {
+    cpu_set_t cpus;
+    return parse_cpu_list(value, &cpus);
+}
+
+ShellOption SHELL_OPTIONS[] = {
+        {"failfast",   offsetof(ShellOptions, failfast),      NULL},
+        {"linebuffer", offsetof(ShellOptions, line_buffered), NULL},
+        {"tagged",     offsetof(ShellOptions, tagged),        NULL},
+        {"spread",     offsetof(ShellOptions, spread),        is_valid_cpu_list},
+};
+
+#define SHELL_OPTIONS_LEN (sizeof(SHELL_OPTIONS) / sizeof(ShellOption))
+
+void *option_field(ShellState *state, ShellOption *option) {
+    return (char *) &state->options + option->offset;
+}
+
+void print_options(ShellState *state) {
+    unsigned int i;
+    for (i = 0; i < SHELL_OPTIONS_LEN; i++) {
+        void *field = option_field(state, &SHELL_OPTIONS[i]);
+        char *value;
+        if (SHELL_OPTIONS[i].is_valid != NULL) {
+            value = *(char **) field != NULL ? *(char **) field : "off";
+        } else {
+            value = *(bool *) field ? "on" : "off";
+        }
+        printf("%-12s %s\n", SHELL_OPTIONS[i].name, value);
+    }
+}
+
+int set_option(ShellState *state, char *name, bool enable) {
+    char *value = strchr(name, '=');
+    size_t name_len = value != NULL ? (size_t) (value - name) : strlen(name);
+    unsigned int i;
+    for (i = 0; i < SHELL_OPTIONS_LEN; i++) {
+        if (strlen(SHELL_OPTIONS[i].name) == name_len &&
+            !strncmp(SHELL_OPTIONS[i].name, name, name_len)) {
+            break;
+        }
+    }
+    if (i == SHELL_OPTIONS_LEN) {
+        fprintf(stderr, "set: unknown option %.*s\n", (int) name_len, name);
+        return 2;
+    }
+    ShellOption *option = &SHELL_OPTIONS[i];
+    void *field = option_field(state, option);
+    if (option->is_valid == NULL) {
+        if (value != NULL) {
+            fprintf(stderr, "set: %s doesn't take a value\n", option->name);
+            return 2;
+        }
+        *(bool *) field = enable;
+        return 0;
+    }
+    if (enable && (value == NULL || !option->is_valid(value + 1))) {
+        fprintf(stderr, "set: invalid value for %s\n", option->name);
+        return 2;
+    }
+    free(*(char **) field);
+    *(char **) field = enable ? strdup(value + 1) : NULL;
+    return 0;
+}
+
+int set_builtin(ShellState *state, ExecArgs *exec_args) {
+    if (exec_args->argc == 1 || (exec_args->argc == 2 && str_equals(exec_args->argv[1], "-o"))) {
+        print_options(state);
+        return 0;
+    }
+    unsigned int i;
+    for (i = 1; i < exec_args->argc; i += 2) {
+        char *flag = exec_args->argv[i];
+        if ((!str_equals(flag, "-o") && !str_equals(flag, "+o")) || i + 1 >= exec_args->argc) {
+            fprintf(stderr, "usage: set [-o|+o] option...\n");
+            return 2;
+        }
+        int status = set_option(state, exec_args->argv[i + 1], flag[0] == '-');
+        if (status) {
+            return status;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,25 @@
+#ifndef LIB_OPTIONS_H
+#define LIB_OPTIONS_H
+
+#include <stddef.h>
+#include "lib.h"
+
+/*
+ * A field of ShellOptions that `set` can change by name, a bool unless the
+ * option takes a value (`set -o name=value`), which is then validated by
+ * `is_valid` and stored as an owned string.
+ */
+typedef struct shellOption {
+    char *name;
+    size_t offset;
+
+    bool (*is_valid)(char *value);
+} ShellOption;
+
+/*
+ * `set -o name` enables an option, `set +o name` disables it and `set -o`
+ * lists them all.
+ */
+int set_builtin(ShellState *state, ExecArgs *exec_args);
+
+#endif
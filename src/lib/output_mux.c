@@ -0,0 +1,149 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include "alloc_stats.h"
+#include "line_editor.h"
+#include "output_mux.h"
+
+#define ALLOC_TAG ExecAlloc
+
+typedef struct muxWriter {
+    char *data;
+    size_t len;
+} MuxWriter;
+
+void mux_flush(MuxWriter *writer) {
+    write_all(STDOUT_FILENO, writer->data, writer->len);
+    writer->len = 0;
+}
+
+void mux_write(MuxWriter *writer, const char *data, size_t len) {
+    if (writer->len + len > MUX_WRITER_SIZE) {
+        mux_flush(writer);
+    }
+    if (len > MUX_WRITER_SIZE) {
+        write_all(STDOUT_FILENO, data, len);
+        return;
+    }
+    memcpy(writer->data + writer->len, data, len);
+    writer->len += len;
+}
+
+void mux_write_line(MuxWriter *writer, MuxSource *source, const char *head,
+                    size_t head_len, const char *line, size_t len) {
+    mux_write(writer, source->tag, source->tag_len);
+    mux_write(writer, head, head_len);
+    mux_write(writer, line, len);
+    mux_write(writer, "\n", 1);
+}
+
+/*
+ * Writes the complete lines of the chunk, keeping its unterminated tail as
+ * pending for the next read.
+ */
+void mux_consume(MuxWriter *writer, MuxSource *source, char *chunk, size_t len) {
+    char *end = chunk + len;
+    while (chunk < end) {
+        char *newline = memchr(chunk, '\n', end - chunk);
+        if (newline == NULL) {
+            break;
+        }
+        mux_write_line(writer, source, source->pending, source->pending_len, chunk,
+                       newline - chunk);
+        source->pending_len = 0;
+        chunk = newline + 1;
+    }
+    while (chunk < end) {
+        if (source->pending == NULL) {
+            source->pending = malloc(MUX_LINE_MAX);
+        }
+        size_t amount = end - chunk;
+        if (amount > MUX_LINE_MAX - source->pending_len) {
+            amount = MUX_LINE_MAX - source->pending_len;
+        }
+        memcpy(source->pending + source->pending_len, chunk, amount);
+        source->pending_len += amount;
+        chunk += amount;
+        if (source->pending_len == MUX_LINE_MAX) {
+            mux_write_line(writer, source, source->pending, source->pending_len, NULL, 0);
+            source->pending_len = 0;
+        }
+    }
+}
+
+void mux_close(MuxWriter *writer, MuxSource *source, int epoll_fd) {
+    if (source->pending_len) {
+        mux_write_line(writer, source, source->pending, source->pending_len, NULL, 0);
+    }
+    free(source->pending);
+    source->pending = NULL;
+    source->pending_len = 0;
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, source->fd, NULL);
+    close(source->fd);
+    source->fd = -1;
+}
+
+void multiplex_output(int *fds, unsigned int len, bool tagged) {
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1) {
+        perror("epoll_create1 failed");
+        exit(1);
+    }
+    MuxSource *sources = calloc(len, sizeof(MuxSource));
+    unsigned int open_sources = 0, i;
+    fflush(stdout);
+    for (i = 0; i < len; i++) {
+        sources[i].fd = fds[i];
+        if (tagged) {
+            sources[i].tag_len = snprintf(sources[i].tag, MUX_TAG_MAX, "[job %u] ", i + 1);
+        }
+        struct epoll_event event = {.events = EPOLLIN, .data.u32 = i};
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fds[i], &event) == -1) {
+            perror("epoll_ctl failed");
+            close(fds[i]);
+            sources[i].fd = -1;
+            continue;
+        }
+        open_sources++;
+    }
+    MuxWriter writer = {malloc(MUX_WRITER_SIZE), 0};
+    char *chunk = malloc(MUX_READ_SIZE);
+    struct epoll_event events[64];
+    while (open_sources) {
+        // The buffered lines are only written once every ready source was read
+        int ready = epoll_wait(epoll_fd, events, 64, writer.len ? 0 : -1);
+        if (ready == -1 && errno != EINTR) {
+            perror("epoll_wait failed");
+            break;
+        }
+        if (ready <= 0) {
+            mux_flush(&writer);
+            continue;
+        }
+        int j;
+        for (j = 0; j < ready; j++) {
+            MuxSource *source = &sources[events[j].data.u32];
+            ssize_t amount = read(source->fd, chunk, MUX_READ_SIZE);
+            if (amount > 0) {
+                mux_consume(&writer, source, chunk, amount);
+            } else if (amount == 0 || errno != EINTR) {
+                mux_close(&writer, source, epoll_fd);
+                open_sources--;
+            }
+        }
+    }
+    for (i = 0; i < len; i++) {
+        if (sources[i].fd != -1) {
+            mux_close(&writer, &sources[i], epoll_fd);
+        }
+    }
+    mux_flush(&writer);
+    free(writer.data);
+    free(chunk);
+    free(sources);
+    close(epoll_fd);
+}
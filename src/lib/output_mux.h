@@ -0,0 +1,33 @@
+#ifndef LIB_OUTPUT_MUX_H
+#define LIB_OUTPUT_MUX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define MUX_READ_SIZE (64 * 1024)
+#define MUX_WRITER_SIZE (256 * 1024)
+// A longer line is written in pieces of this size
+#define MUX_LINE_MAX (64 * 1024)
+#define MUX_TAG_MAX 24
+
+/*
+ * The partial last line of a single source, allocated when the first
+ * unterminated line arrives and released once the source is closed.
+ */
+typedef struct muxSource {
+    int fd;
+    char tag[MUX_TAG_MAX];
+    unsigned int tag_len;
+    char *pending;
+    size_t pending_len;
+} MuxSource;
+
+/*
+ * Reads every fd with a single epoll loop until all of them are closed and
+ * writes their output to stdout whole lines at a time, prefixed with
+ * `[job n] ` when tagged. Lines are gathered in one buffer so the terminal
+ * gets a few large writes instead of one per line.
+ */
+void multiplex_output(int *fds, unsigned int len, bool tagged);
+
+#endif
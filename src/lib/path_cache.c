@@ -0,0 +1,104 @@
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "alloc_stats.h"
+#include "path_cache.h"
+#include "util/string_util/string_util.h"
+
+#define ALLOC_TAG ExecAlloc
+
+PathCacheEntry path_cache[PATH_CACHE_SIZE];
+unsigned int path_cache_len = 0;
+char *path_cache_env = NULL;
+
+uint32_t hash_str(char *str) {
+    uint32_t hash = 2166136261u;
+    for (; *str; str++) {
+        hash = (hash ^ (unsigned char) *str) * 16777619u;
+    }
+    return hash;
+}
+
+void drop_path_cache() {
+    unsigned int i;
+    for (i = 0; i < PATH_CACHE_SIZE; i++) {
+        free(path_cache[i].name);
+        free(path_cache[i].path);
+        path_cache[i].name = NULL;
+        path_cache[i].path = NULL;
+    }
+    path_cache_len = 0;
+    free(path_cache_env);
+    path_cache_env = NULL;
+}
+
+bool is_executable_file(char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISREG(st.st_mode) && access(path, X_OK) == 0;
+}
+
+char *search_command_path(char *name, char *path_env) {
+    char path[PATH_MAX];
+    while (*path_env) {
+        size_t dir_len = strcspn(path_env, ":");
+        // An empty PATH entry means the current directory
+        if (snprintf(path, sizeof(path), "%.*s/%s", (int) (dir_len ? dir_len : 1),
+                     dir_len ? path_env : ".", name) < (int) sizeof(path) &&
+            is_executable_file(path)) {
+            return strdup(path);
+        }
+        path_env += dir_len + (path_env[dir_len] == ':');
+    }
+    return NULL;
+}
+
+char *resolve_command_path(char *name) {
+    if (strchr(name, '/') != NULL || !*name) {
+        return NULL;
+    }
+    char *path_env = getenv("PATH");
+    if (path_env == NULL) {
+        return NULL;
+    }
+    if (path_cache_env == NULL || !str_equals(path_cache_env, path_env)) {
+        drop_path_cache();
+        path_cache_env = strdup(path_env);
+    }
+    unsigned int mask = PATH_CACHE_SIZE - 1;
+    unsigned int idx = hash_str(name) & mask;
+    while (path_cache[idx].name != NULL) {
+        if (str_equals(path_cache[idx].name, name)) {
+            if (is_executable_file(path_cache[idx].path)) {
+                return path_cache[idx].path;
+            }
+            // The command was removed, it's searched again
+            free(path_cache[idx].path);
+            path_cache[idx].path = search_command_path(name, path_env);
+            if (path_cache[idx].path == NULL) {
+                path_cache[idx].path = strdup("");
+            }
+            return *path_cache[idx].path ? path_cache[idx].path : NULL;
+        }
+        idx = (idx + 1) & mask;
+    }
+    char *path = search_command_path(name, path_env);
+    if (path == NULL) {
+        return NULL;
+    }
+    if (path_cache_len + 1 > (PATH_CACHE_SIZE >> 1) + (PATH_CACHE_SIZE >> 2)) {
+        // Full enough, starting over keeps the probing short
+        char *env = strdup(path_env);
+        drop_path_cache();
+        path_cache_env = env;
+        idx = hash_str(name) & mask;
+    }
+    path_cache[idx].name = strdup(name);
+    path_cache[idx].path = path;
+    path_cache_len += 1;
+    return path;
+}
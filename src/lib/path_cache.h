@@ -0,0 +1,25 @@
+#ifndef LIB_PATH_CACHE_H
+#define LIB_PATH_CACHE_H
+
+// Must be a power of two
+#define PATH_CACHE_SIZE 256
+
+/*
+ * Remembers where each command was found on PATH (like the `hash` of other
+ * shells), so launching it again is a single execv instead of execvp trying
+ * every PATH directory. The cache is cleared when PATH changes.
+ */
+typedef struct pathCacheEntry {
+    char *name;
+    char *path;
+} PathCacheEntry;
+
+/*
+ * Returns the full path of the command (owned by the cache) or NULL when it
+ * isn't found or has a '/' in its name.
+ */
+char *resolve_command_path(char *name);
+
+void drop_path_cache();
+
+#endif
@@ -0,0 +1,106 @@
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "alloc_stats.h"
+#include "process.h"
+
+#define ALLOC_TAG ExecAlloc
+
+int open_pidfd(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return (int) syscall(SYS_pidfd_open, pid, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+// Largest ru_maxrss of the children waited since the last take_waited_max_rss
+long waited_max_rss = 0;
+
+void record_waited_usage(struct rusage *usage) {
+    if (usage->ru_maxrss > waited_max_rss) {
+        waited_max_rss = usage->ru_maxrss;
+    }
+}
+
+long take_waited_max_rss() {
+    long max_rss = waited_max_rss;
+    waited_max_rss = 0;
+    return max_rss;
+}
+
+pid_t wait_any_child(pid_t *pids, unsigned int len, int *wait_status) {
+    unsigned int i, count = 0;
+    for (i = 0; i < len; i++) {
+        count += pids[i] > 0;
+    }
+    if (!count) {
+        return -1;
+    }
+    struct pollfd *fds = malloc(sizeof(struct pollfd) * count);
+    pid_t *fd_pids = malloc(sizeof(pid_t) * count);
+    unsigned int nfds = 0;
+    pid_t finished = 0;
+    for (i = 0; i < len && !finished; i++) {
+        if (pids[i] <= 0) {
+            continue;
+        }
+        int fd = open_pidfd(pids[i]);
+        if (fd < 0) {
+            // Without pidfd (or if it's already a zombie) it's waited directly
+            finished = pids[i];
+            break;
+        }
+        fds[nfds].fd = fd;
+        fds[nfds].events = POLLIN;
+        fds[nfds].revents = 0;
+        fd_pids[nfds++] = pids[i];
+    }
+    while (!finished) {
+        if (poll(fds, nfds, -1) < 0 && errno != EINTR) {
+            finished = fd_pids[0];
+            break;
+        }
+        for (i = 0; i < nfds; i++) {
+            if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+                finished = fd_pids[i];
+                break;
+            }
+        }
+    }
+    for (i = 0; i < nfds; i++) {
+        close(fds[i].fd);
+    }
+    free(fds);
+    free(fd_pids);
+    struct rusage usage;
+    while (wait4(finished, wait_status, 0, &usage) == -1) {
+        if (errno != EINTR) {
+            // Its status is lost (reaped elsewhere), it can't count as a success
+            *wait_status = W_EXITCODE(LOST_CHILD_EXIT_STATUS, 0);
+            break;
+        }
+    }
+    record_waited_usage(&usage);
+    for (i = 0; i < len; i++) {
+        if (pids[i] == finished) {
+            pids[i] = 0;
+            break;
+        }
+    }
+    return finished;
+}
+
+pid_t wait_child_usage(pid_t pid, int *wait_status, struct rusage *usage) {
+    pid_t finished;
+    while ((finished = wait4(pid, wait_status, WUNTRACED, usage)) == -1 && errno == EINTR);
+    if (finished != -1) {
+        record_waited_usage(usage);
+    }
+    return finished;
+}
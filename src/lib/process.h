@@ -0,0 +1,42 @@
+#ifndef LIB_PROCESS_H
+#define LIB_PROCESS_H
+
+#include <stdbool.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+
+/*
+ * Helpers to wait on a specific set of children without touching the others
+ * (the background ones are reaped by the SIGCHLD handler).
+ */
+
+int open_pidfd(pid_t pid);
+
+// Exit code reported for a child whose wait status couldn't be read
+#define LOST_CHILD_EXIT_STATUS 1
+
+/*
+ * Waits until one of the `len` children in `pids` exits, returning its pid
+ * (and its wait status) or -1 when there is nothing left to wait. A child
+ * that can't be waited exits LOST_CHILD_EXIT_STATUS.
+ */
+pid_t wait_any_child(pid_t *pids, unsigned int len, int *wait_status);
+
+/*
+ * waitpid (with WUNTRACED) that also fills the resource usage of the child,
+ * retrying when interrupted by a signal.
+ */
+pid_t wait_child_usage(pid_t pid, int *wait_status, struct rusage *usage);
+
+/*
+ * The waits above keep the peak RSS of the children they reaped (each one
+ * including its own waited children), unlike RUSAGE_CHILDREN it can be reset.
+ */
+void record_waited_usage(struct rusage *usage);
+
+/*
+ * Returns the peak RSS, in KiB, since the last call.
+ */
+long take_waited_max_rss();
+
+#endif
@@ -0,0 +1,391 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "alloc_stats.h"
+#include "handlers.h"
+#include "lib.h"
+#include "prompt.h"
+#include "stats.h"
+
+#define ALLOC_TAG StateAlloc
+
+extern char **environ;
+
+VcsInfo *vcs_cache[VCS_CACHE_SIZE];
+unsigned long vcs_cache_clock = 0;
+
+pthread_mutex_t vcs_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t vcs_cond = PTHREAD_COND_INITIALIZER;
+pthread_t vcs_thread;
+bool has_vcs_thread = false;
+bool vcs_should_stop = false;
+// Directory waiting to be checked by the worker, only the latest one matters
+char *vcs_pending_dir = NULL;
+int vcs_notify_pipe[2] = {-1, -1};
+
+char *prompt_config_str = NULL;
+enum PromptSegment prompt_segments[PROMPT_MAX_SEGMENTS];
+unsigned int prompt_segments_len = 0;
+
+void parse_prompt_config(char *config) {
+    if (prompt_config_str != NULL && str_equals(prompt_config_str, config)) {
+        return;
+    }
+    free(prompt_config_str);
+    prompt_config_str = strdup(config);
+    prompt_segments_len = 0;
+    char *config_copy = strdup(config);
+    char *save_ptr = NULL;
+    char *name = strtok_r(config_copy, ", ", &save_ptr);
+    while (name != NULL && prompt_segments_len < PROMPT_MAX_SEGMENTS) {
+        if (str_equals(name, "pwd")) {
+            prompt_segments[prompt_segments_len++] = PwdSegment;
+        } else if (str_equals(name, "status")) {
+            prompt_segments[prompt_segments_len++] = StatusSegment;
+        } else if (str_equals(name, "jobs")) {
+            prompt_segments[prompt_segments_len++] = JobsSegment;
+        } else if (str_equals(name, "vcs")) {
+            prompt_segments[prompt_segments_len++] = VcsSegment;
+        }
+        name = strtok_r(NULL, ", ", &save_ptr);
+    }
+    free(config_copy);
+}
+
+void drop_vcs_info(VcsInfo *self) {
+    free(self->dir);
+    free(self->git_dir);
+    free(self->branch);
+    free(self);
+}
+
+// Must be called with vcs_mutex held
+VcsInfo *vcs_cache_get(char *dir) {
+    int i;
+    for (i = 0; i < VCS_CACHE_SIZE; i++) {
+        if (vcs_cache[i] != NULL && str_equals(vcs_cache[i]->dir, dir)) {
+            vcs_cache[i]->last_use = ++vcs_cache_clock;
+            return vcs_cache[i];
+        }
+    }
+    return NULL;
+}
+
+// Must be called with vcs_mutex held, the cache takes ownership of the info
+void vcs_cache_put(VcsInfo *info) {
+    int i, slot = -1;
+    for (i = 0; i < VCS_CACHE_SIZE; i++) {
+        if (vcs_cache[i] == NULL || str_equals(vcs_cache[i]->dir, info->dir)) {
+            slot = i;
+            break;
+        }
+        if (slot < 0 || vcs_cache[i]->last_use < vcs_cache[slot]->last_use) {
+            slot = i;
+        }
+    }
+    if (vcs_cache[slot] != NULL) {
+        drop_vcs_info(vcs_cache[slot]);
+    }
+    info->last_use = ++vcs_cache_clock;
+    vcs_cache[slot] = info;
+}
+
+bool timespec_equals(struct timespec a, struct timespec b) {
+    return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+struct timespec file_mtime(char *dir, char *name) {
+    char path[PATH_MAX];
+    struct stat st;
+    struct timespec mtime = {0, 0};
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    if (stat(path, &st) == 0) {
+        mtime = st.st_mtim;
+    }
+    return mtime;
+}
+
+/*
+ * Walks up from `dir` looking for the .git directory (or the .git file of a
+ * worktree pointing to it).
+ */
+char *find_git_dir(char *dir) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s", dir);
+    while (true) {
+        char candidate[PATH_MAX + 8];
+        struct stat st;
+        snprintf(candidate, sizeof(candidate), "%s/.git", path);
+        if (stat(candidate, &st) == 0) {
+            if (S_ISDIR(st.st_mode)) {
+                return strdup(candidate);
+            }
+            FILE *file = fopen(candidate, "r");
+            if (file != NULL) {
+                char line[PATH_MAX];
+                char *git_dir = NULL;
+                if (fgets(line, sizeof(line), file) && !strncmp(line, "gitdir: ", 8)) {
+                    line[strcspn(line, "\n")] = '\0';
+                    git_dir = line[8] == '/' ? strdup(line + 8) : NULL;
+                    if (git_dir == NULL) {
+                        snprintf(candidate, sizeof(candidate), "%s/%s", path, line + 8);
+                        git_dir = strdup(candidate);
+                    }
+                }
+                fclose(file);
+                return git_dir;
+            }
+        }
+        char *slash = strrchr(path, '/');
+        if (slash == NULL || slash == path) {
+            return NULL;
+        }
+        *slash = '\0';
+    }
+}
+
+char *read_git_branch(char *git_dir) {
+    char path[PATH_MAX], head[256];
+    snprintf(path, sizeof(path), "%s/HEAD", git_dir);
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return NULL;
+    }
+    char *branch = NULL;
+    if (fgets(head, sizeof(head), file)) {
+        head[strcspn(head, "\n")] = '\0';
+        if (!strncmp(head, "ref: refs/heads/", 16)) {
+            branch = strdup(head + 16);
+        } else {
+            // Detached HEAD, showing the abbreviated commit
+            head[7] = '\0';
+            branch = strdup(head);
+        }
+    }
+    fclose(file);
+    return branch;
+}
+
+/*
+ * Runs `git status` on the directory, this is the slow part that must never
+ * happen on the prompt path.
+ */
+bool is_git_dirty(char *dir) {
+    int out_pipe[2];
+    if (pipe2(out_pipe, O_CLOEXEC) < 0) {
+        return false;
+    }
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, out_pipe[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    char *argv[] = {"git", "--no-optional-locks", "-C", dir, "status", "--porcelain",
+                    "--untracked-files=no", "--ignore-submodules", NULL};
+    pid_t pid;
+    int spawn_res = posix_spawnp(&pid, "git", &actions, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(out_pipe[1]);
+    bool dirty = false;
+    if (spawn_res == 0) {
+        char buffer[4096];
+        ssize_t len;
+        while ((len = read(out_pipe[0], buffer, sizeof(buffer))) != 0) {
+            if (len < 0 && errno != EINTR) {
+                break;
+            }
+            dirty = dirty || len > 0;
+        }
+        waitpid(pid, NULL, 0);
+    }
+    close(out_pipe[0]);
+    return dirty;
+}
+
+void notify_prompt() {
+    if (vcs_notify_pipe[1] >= 0) {
+        write(vcs_notify_pipe[1], "", 1);
+    }
+}
+
+void refresh_vcs_info(char *dir) {
+    pthread_mutex_lock(&vcs_mutex);
+    VcsInfo *cached = vcs_cache_get(dir);
+    char *git_dir = cached != NULL && cached->git_dir != NULL ? strdup(cached->git_dir) : NULL;
+    pthread_mutex_unlock(&vcs_mutex);
+    if (git_dir == NULL) {
+        git_dir = find_git_dir(dir);
+    }
+    VcsInfo *info = malloc(sizeof(VcsInfo));
+    info->dir = strdup(dir);
+    info->git_dir = git_dir;
+    info->is_repo = git_dir != NULL;
+    info->branch = NULL;
+    info->dirty = false;
+    info->checked_at = time(NULL);
+    info->head_mtime = git_dir != NULL ? file_mtime(git_dir, "HEAD") : (struct timespec) {0, 0};
+    info->index_mtime = git_dir != NULL ? file_mtime(git_dir, "index") : (struct timespec) {0, 0};
+    pthread_mutex_lock(&vcs_mutex);
+    cached = vcs_cache_get(dir);
+    bool is_fresh = cached != NULL && cached->is_repo == info->is_repo &&
+                    timespec_equals(cached->head_mtime, info->head_mtime) &&
+                    timespec_equals(cached->index_mtime, info->index_mtime) &&
+                    info->checked_at - cached->checked_at < VCS_DIRTY_TTL;
+    pthread_mutex_unlock(&vcs_mutex);
+    if (is_fresh) {
+        drop_vcs_info(info);
+        return;
+    }
+    if (info->is_repo) {
+        info->branch = read_git_branch(git_dir);
+        info->dirty = is_git_dirty(dir);
+    }
+    pthread_mutex_lock(&vcs_mutex);
+    cached = vcs_cache_get(dir);
+    bool changed = cached == NULL || cached->is_repo != info->is_repo ||
+                   cached->dirty != info->dirty ||
+                   (cached->branch == NULL) != (info->branch == NULL) ||
+                   (cached->branch != NULL && !str_equals(cached->branch, info->branch));
+    vcs_cache_put(info);
+    pthread_mutex_unlock(&vcs_mutex);
+    if (changed) {
+        notify_prompt();
+    }
+}
+
+void *vcs_worker_func(void *arg) {
+    (void) arg;
+    pthread_mutex_lock(&vcs_mutex);
+    while (!vcs_should_stop) {
+        if (vcs_pending_dir == NULL) {
+            pthread_cond_wait(&vcs_cond, &vcs_mutex);
+            continue;
+        }
+        char *dir = vcs_pending_dir;
+        vcs_pending_dir = NULL;
+        pthread_mutex_unlock(&vcs_mutex);
+        refresh_vcs_info(dir);
+        free(dir);
+        pthread_mutex_lock(&vcs_mutex);
+    }
+    pthread_mutex_unlock(&vcs_mutex);
+    return NULL;
+}
+
+int prompt_notify_fd() {
+    if (vcs_notify_pipe[0] < 0 && pipe2(vcs_notify_pipe, O_CLOEXEC | O_NONBLOCK) < 0) {
+        vcs_notify_pipe[0] = vcs_notify_pipe[1] = -1;
+    }
+    return vcs_notify_pipe[0];
+}
+
+void start_prompt_worker() {
+    if (has_vcs_thread) {
+        return;
+    }
+    prompt_notify_fd();
+    vcs_should_stop = false;
+    has_vcs_thread = pthread_create(&vcs_thread, NULL, vcs_worker_func, NULL) == 0;
+}
+
+void drop_prompt_worker() {
+    if (has_vcs_thread) {
+        pthread_mutex_lock(&vcs_mutex);
+        vcs_should_stop = true;
+        pthread_cond_signal(&vcs_cond);
+        pthread_mutex_unlock(&vcs_mutex);
+        pthread_join(vcs_thread, NULL);
+        has_vcs_thread = false;
+    }
+    int i;
+    for (i = 0; i < VCS_CACHE_SIZE; i++) {
+        if (vcs_cache[i] != NULL) {
+            drop_vcs_info(vcs_cache[i]);
+            vcs_cache[i] = NULL;
+        }
+    }
+    for (i = 0; i < 2; i++) {
+        if (vcs_notify_pipe[i] >= 0) {
+            close(vcs_notify_pipe[i]);
+            vcs_notify_pipe[i] = -1;
+        }
+    }
+    free(vcs_pending_dir);
+    vcs_pending_dir = NULL;
+    free(prompt_config_str);
+    prompt_config_str = NULL;
+}
+
+/*
+ * Reads the cached vcs info of the directory, queueing a refresh for the
+ * worker without waiting for it.
+ */
+void request_vcs_info(char *dir, char *out, size_t out_len) {
+    start_prompt_worker();
+    out[0] = '\0';
+    pthread_mutex_lock(&vcs_mutex);
+    VcsInfo *info = vcs_cache_get(dir);
+    if (info != NULL && info->is_repo && info->branch != NULL) {
+        snprintf(out, out_len, "%s%s", info->branch, info->dirty ? "*" : "");
+    }
+    if (vcs_pending_dir == NULL || !str_equals(vcs_pending_dir, dir)) {
+        free(vcs_pending_dir);
+        vcs_pending_dir = strdup(dir);
+        pthread_cond_signal(&vcs_cond);
+    }
+    pthread_mutex_unlock(&vcs_mutex);
+}
+
+char *render_prompt(void *data) {
+    uint64_t render_start = stats_now();
+    ShellState *state = data;
+    char *config = getenv("VSH_PROMPT");
+    parse_prompt_config(config != NULL ? config : DEFAULT_PROMPT_SEGMENTS);
+    char prompt[BUFFER_MAX_SIZE];
+    char segment[BUFFER_MAX_SIZE >> 1];
+    size_t len = 0;
+    unsigned int i;
+    prompt[0] = '\0';
+    for (i = 0; i < prompt_segments_len && len < sizeof(prompt); i++) {
+        switch (prompt_segments[i]) {
+            case PwdSegment:
+                len += snprintf(prompt + len, sizeof(prompt) - len, "%s%s > %s", BlueAnsi,
+                                state->pretty_pwd(state), EndAnsi);
+                break;
+            case StatusSegment:
+                if (state->last_status) {
+                    len += snprintf(prompt + len, sizeof(prompt) - len, "%s[%d]%s%s > %s",
+                                    RedAnsi, state->last_status, EndAnsi, BlueAnsi, EndAnsi);
+                }
+                break;
+            case JobsSegment:
+                if (background_jobs_count()) {
+                    len += snprintf(prompt + len, sizeof(prompt) - len, "%sjobs:%d%s%s > %s",
+                                    YellowAnsi, background_jobs_count(), EndAnsi, BlueAnsi,
+                                    EndAnsi);
+                }
+                break;
+            case VcsSegment:
+                request_vcs_info(state->pwd, segment, sizeof(segment));
+                if (strlen(segment)) {
+                    len += snprintf(prompt + len, sizeof(prompt) - len, "%s%s%s%s > %s",
+                                    YellowAnsi, segment, EndAnsi, BlueAnsi, EndAnsi);
+                }
+                break;
+        }
+    }
+    if (len < sizeof(prompt)) {
+        snprintf(prompt + len, sizeof(prompt) - len, "%svsh%s%s > %s", JojoAnsi, EndAnsi,
+                 BlueAnsi, EndAnsi);
+    }
+    stats_record(PromptRender, render_start);
+    return strdup(prompt);
+}
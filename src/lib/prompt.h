@@ -0,0 +1,45 @@
+#ifndef LIB_PROMPT_H
+#define LIB_PROMPT_H
+
+#include <stdbool.h>
+#include <time.h>
+
+/*
+ * The prompt is configured through the VSH_PROMPT environment variable, a comma
+ * separated list of segments rendered in order, e.g. "pwd,vcs,status,jobs".
+ * The vcs segment is computed by a background worker, the prompt is rendered
+ * with the cached value and drawn again once fresher data is available.
+ */
+#define DEFAULT_PROMPT_SEGMENTS "pwd,status,jobs"
+#define PROMPT_MAX_SEGMENTS 8
+#define VCS_CACHE_SIZE 16
+// Seconds after which the worker checks the dirty state again even if the
+// repository mtimes didn't change (edits to tracked files don't touch them)
+#define VCS_DIRTY_TTL 2
+
+enum PromptSegment {
+    PwdSegment,
+    StatusSegment,
+    JobsSegment,
+    VcsSegment,
+};
+
+typedef struct vcsInfo {
+    char *dir;
+    char *git_dir;
+    bool is_repo;
+    char *branch;
+    bool dirty;
+    struct timespec head_mtime;
+    struct timespec index_mtime;
+    time_t checked_at;
+    unsigned long last_use;
+} VcsInfo;
+
+char *render_prompt(void *state);
+
+int prompt_notify_fd();
+
+void drop_prompt_worker();
+
+#endif
@@ -0,0 +1,187 @@
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#include "rlimits.h"
+#include "util/string_util/string_util.h"
+
+RlimitInfo RLIMITS[] = {
+        {'c', RLIMIT_CORE,    512,  "core file size (blocks)"},
+        {'d', RLIMIT_DATA,    1024, "data seg size (kbytes)"},
+        {'f', RLIMIT_FSIZE,   512,  "file size (blocks)"},
+        {'l', RLIMIT_MEMLOCK, 1024, "max locked memory (kbytes)"},
+        {'n', RLIMIT_NOFILE,  1,    "open files"},
+        {'s', RLIMIT_STACK,   1024, "stack size (kbytes)"},
+        {'t', RLIMIT_CPU,     1,    "cpu time (seconds)"},
+        {'u', RLIMIT_NPROC,   1,    "max user processes"},
+        {'v', RLIMIT_AS,      1024, "virtual memory (kbytes)"},
+};
+
+#define RLIMITS_LEN (sizeof(RLIMITS) / sizeof(RlimitInfo))
+
+RlimitInfo *find_rlimit(char flag) {
+    unsigned int i;
+    for (i = 0; i < RLIMITS_LEN; i++) {
+        if (RLIMITS[i].flag == flag) {
+            return &RLIMITS[i];
+        }
+    }
+    return NULL;
+}
+
+bool parse_rlimit_value(RlimitInfo *info, char *str, rlim_t *value) {
+    if (str_equals(str, "unlimited")) {
+        *value = RLIM_INFINITY;
+        return true;
+    }
+    char *end;
+    unsigned long long amount = strtoull(str, &end, 10);
+    if (!*str || *end || str[0] == '-' || amount > RLIM_INFINITY / info->unit) {
+        return false;
+    }
+    *value = amount * info->unit;
+    return true;
+}
+
+void print_rlimit(RlimitInfo *info, bool hard, bool with_description) {
+    struct rlimit limit;
+    getrlimit(info->resource, &limit);
+    rlim_t value = hard ? limit.rlim_max : limit.rlim_cur;
+    if (with_description) {
+        printf("%-28s (-%c) ", info->description, info->flag);
+    }
+    if (value == RLIM_INFINITY) {
+        printf("unlimited\n");
+    } else {
+        printf("%llu\n", (unsigned long long) (value / info->unit));
+    }
+}
+
+int ulimit_builtin(ShellState *state, ExecArgs *exec_args) {
+    (void) state;
+    bool soft = false, hard = false, changed = false;
+    unsigned int i;
+    for (i = 1; i < exec_args->argc; i++) {
+        char *arg = exec_args->argv[i];
+        if (str_equals(arg, "-S")) {
+            soft = true;
+        } else if (str_equals(arg, "-H")) {
+            hard = true;
+        } else if (str_equals(arg, "-a")) {
+            unsigned int j;
+            for (j = 0; j < RLIMITS_LEN; j++) {
+                print_rlimit(&RLIMITS[j], hard && !soft, true);
+            }
+            changed = true;
+        } else {
+            RlimitInfo *info = arg[0] == '-' && strlen(arg) == 2 ? find_rlimit(arg[1]) : NULL;
+            if (info == NULL) {
+                fprintf(stderr, "ulimit: unknown option %s\n", arg);
+                return 2;
+            }
+            changed = true;
+            if (i + 1 >= exec_args->argc || exec_args->argv[i + 1][0] == '-') {
+                print_rlimit(info, hard && !soft, false);
+                continue;
+            }
+            rlim_t value;
+            if (!parse_rlimit_value(info, exec_args->argv[++i], &value)) {
+                fprintf(stderr, "ulimit: invalid limit %s\n", exec_args->argv[i]);
+                return 2;
+            }
+            struct rlimit limit;
+            getrlimit(info->resource, &limit);
+            // Both limits are set unless one of them was asked for
+            if (soft || !hard) {
+                limit.rlim_cur = value;
+            }
+            if (hard || !soft) {
+                limit.rlim_max = value;
+            }
+            if (setrlimit(info->resource, &limit) == -1) {
+                perror("ulimit: setrlimit failed");
+                return 1;
+            }
+        }
+    }
+    if (!changed) {
+        print_rlimit(find_rlimit('f'), hard && !soft, false);
+    }
+    return 0;
+}
+
+LaunchRlimit *launch_rlimit(LaunchAttrs *attrs, int resource) {
+    unsigned int i;
+    for (i = 0; i < attrs->rlimits_len; i++) {
+        if (attrs->rlimits[i].resource == resource) {
+            return &attrs->rlimits[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * The limit that made the command end, when its status tells it for sure.
+ */
+LaunchRlimit *hit_rlimit(LaunchAttrs *attrs, int wait_status, struct rusage *usage) {
+    int signal = 0;
+    if (WIFSIGNALED(wait_status)) {
+        signal = WTERMSIG(wait_status);
+    } else if (WEXITSTATUS(wait_status) > 128) {
+        // A shell reports the signal that killed its own child this way
+        signal = WEXITSTATUS(wait_status) - 128;
+    }
+    LaunchRlimit *cpu = launch_rlimit(attrs, RLIMIT_CPU);
+    switch (signal) {
+        case SIGXCPU:
+            return cpu;
+        case SIGXFSZ:
+            return launch_rlimit(attrs, RLIMIT_FSIZE);
+        case SIGKILL:
+            // Past the hard cpu limit the kernel sends SIGKILL
+            if (cpu != NULL && (rlim_t) (usage->ru_utime.tv_sec + usage->ru_stime.tv_sec) >= cpu->value) {
+                return cpu;
+            }
+            return NULL;
+        case SIGSEGV:
+            return launch_rlimit(attrs, RLIMIT_STACK);
+        default:
+            return NULL;
+    }
+}
+
+void report_limit_exit(ExecArgs *exec_args, int wait_status, struct rusage *usage) {
+    LaunchAttrs *attrs = &exec_args->attrs;
+    if (!attrs->rlimits_len || (WIFEXITED(wait_status) && !WEXITSTATUS(wait_status))) {
+        return;
+    }
+    char *name = exec_args->argc ? exec_args->argv[0] : "";
+    if (WIFSIGNALED(wait_status)) {
+        fprintf(stderr, "vsh: %s: killed by %s", name, strsignal(WTERMSIG(wait_status)));
+    } else {
+        fprintf(stderr, "vsh: %s: exited with %d", name, WEXITSTATUS(wait_status));
+    }
+    LaunchRlimit *hit = hit_rlimit(attrs, wait_status, usage);
+    if (hit != NULL) {
+        RlimitInfo *info = find_rlimit(hit->flag);
+        fprintf(stderr, ", %s limit hit (-%c %llu)", info->description, info->flag,
+                (unsigned long long) (hit->value / info->unit));
+    } else {
+        // The memory and file limits only make calls fail, the program
+        // decides what to do then, so all of them are listed
+        fprintf(stderr, ", limits:");
+        unsigned int i;
+        for (i = 0; i < attrs->rlimits_len; i++) {
+            RlimitInfo *info = find_rlimit(attrs->rlimits[i].flag);
+            if (attrs->rlimits[i].value == RLIM_INFINITY) {
+                fprintf(stderr, " -%c unlimited", info->flag);
+            } else {
+                fprintf(stderr, " -%c %llu", info->flag,
+                        (unsigned long long) (attrs->rlimits[i].value / info->unit));
+            }
+        }
+    }
+    fprintf(stderr, ", peak RSS %ld KB\n", usage->ru_maxrss);
+}
@@ -0,0 +1,38 @@
+#ifndef LIB_RLIMITS_H
+#define LIB_RLIMITS_H
+
+#include <stdbool.h>
+#include <sys/resource.h>
+#include "lib.h"
+
+/*
+ * A resource `ulimit` knows about, values are given in `unit` bytes (or as
+ * plain counts when it's 1) like the ulimit of other shells.
+ */
+typedef struct rlimitInfo {
+    char flag;
+    int resource;
+    rlim_t unit;
+    char *description;
+} RlimitInfo;
+
+RlimitInfo *find_rlimit(char flag);
+
+/*
+ * Parses a ulimit value ("unlimited" or a number of units) into bytes/counts.
+ */
+bool parse_rlimit_value(RlimitInfo *info, char *str, rlim_t *value);
+
+/*
+ * `ulimit [-S|-H] [-a] [-FLAG [value]]...` shows or changes the limits of the
+ * shell itself, which every command launched afterwards inherits.
+ */
+int ulimit_builtin(ShellState *state, ExecArgs *exec_args);
+
+/*
+ * Tells on stderr when a command launched with `ulimit` prefixes failed,
+ * which limit was hit when that can be told from its status and its peak RSS.
+ */
+void report_limit_exit(ExecArgs *exec_args, int wait_status, struct rusage *usage);
+
+#endif
@@ -0,0 +1,238 @@
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "alloc_stats.h"
+#include "handlers.h"
+#include "line_editor.h"
+#include "server.h"
+
+#define ALLOC_TAG ExecAlloc
+
+extern char **environ;
+
+bool socket_address(char *socket_path, struct sockaddr_un *address) {
+    memset(address, 0, sizeof(struct sockaddr_un));
+    address->sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(address->sun_path)) {
+        fprintf(stderr, "vsh: socket path too long: %s\n", socket_path);
+        return false;
+    }
+    strcpy(address->sun_path, socket_path);
+    return true;
+}
+
+bool read_all(int fd, void *data, size_t len) {
+    char *cursor = data;
+    while (len > 0) {
+        ssize_t amount = read(fd, cursor, len);
+        if (amount == -1 && errno == EINTR) {
+            continue;
+        }
+        if (amount <= 0) {
+            return false;
+        }
+        cursor += amount;
+        len -= amount;
+    }
+    return true;
+}
+
+/*
+ * Receives the header with the three stdio fds of the client.
+ */
+bool receive_request(int conn, ServerRequest *request, int *fds) {
+    char control[CMSG_SPACE(sizeof(int) * 3)];
+    struct iovec iov = {request, sizeof(ServerRequest)};
+    struct msghdr message = {0};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    ssize_t amount;
+    while ((amount = recvmsg(conn, &message, MSG_CMSG_CLOEXEC)) == -1 && errno == EINTR);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+    if (amount != sizeof(ServerRequest) || request->magic != SERVER_MAGIC || cmsg == NULL ||
+        cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(int) * 3)) {
+        return false;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * 3);
+    return true;
+}
+
+/*
+ * Runs in the forked copy of the server, it takes the stdio, directory and
+ * environment of the client before running its script.
+ */
+void serve_connection(ShellState *state, int conn) {
+    ServerRequest request;
+    int fds[3], i;
+    if (!receive_request(conn, &request, fds)) {
+        _exit(1);
+    }
+    size_t payload_len = (size_t) request.cwd_len + request.env_len + request.script_len;
+    char *payload = malloc(payload_len + 1);
+    if (!read_all(conn, payload, payload_len)) {
+        _exit(1);
+    }
+    payload[payload_len] = '\0';
+    for (i = 0; i < 3; i++) {
+        dup2(fds[i], i);
+        close(fds[i]);
+    }
+    // The cwd and each variable are sent with their NUL terminators
+    char *cwd = payload, *env = payload + request.cwd_len;
+    char *script = env + request.env_len;
+    clearenv();
+    char *var;
+    for (var = env; var < script; var += strlen(var) + 1) {
+        // The strings stay in the payload, which lives as long as this process
+        putenv(var);
+    }
+    free(state->home);
+    state->home = strdup(getenv("HOME") != NULL ? getenv("HOME") : "");
+    state->change_dir(state, cwd);
+    signal(SIGCHLD, sig_chld_handler);
+    int32_t status = call_script_handler(state, script, false);
+    fflush(stdout);
+    write_all(conn, (char *) &status, sizeof(status));
+    _exit(0);
+}
+
+int serve(ShellState *state, char *socket_path) {
+    struct sockaddr_un address;
+    if (!socket_address(socket_path, &address)) {
+        return 2;
+    }
+    int server_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    unlink(socket_path);
+    if (server_fd == -1 || bind(server_fd, (struct sockaddr *) &address, sizeof(address)) == -1 ||
+        listen(server_fd, SERVER_BACKLOG) == -1) {
+        perror("vsh: the server socket couldn't be opened");
+        return 1;
+    }
+    // The connection children are reaped by the kernel
+    signal(SIGCHLD, SIG_IGN);
+    signal(SIGPIPE, SIG_IGN);
+    fprintf(stderr, "vsh: serving on %s\n", socket_path);
+    while (true) {
+        int conn = accept4(server_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (conn == -1) {
+            if (errno == EINTR || errno == ECONNABORTED || errno == EMFILE) {
+                continue;
+            }
+            perror("vsh: accept failed");
+            break;
+        }
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(server_fd);
+            signal(SIGPIPE, SIG_DFL);
+            serve_connection(state, conn);
+        } else if (pid == -1) {
+            perror("vsh: fork failed");
+        }
+        close(conn);
+    }
+    close(server_fd);
+    unlink(socket_path);
+    return 1;
+}
+
+/*
+ * Reads the whole stdin when the script isn't given as arguments.
+ */
+char *client_script(char **lines, int lines_len, size_t *len) {
+    size_t cap = BUFFER_MAX_SIZE;
+    char *script = malloc(cap);
+    *len = 0;
+    int i;
+    if (lines_len) {
+        for (i = 0; i < lines_len; i++) {
+            size_t line_len = strlen(lines[i]);
+            if (*len + line_len + 1 > cap) {
+                cap = (*len + line_len + 1) * 2;
+                script = realloc(script, cap);
+            }
+            memcpy(script + *len, lines[i], line_len);
+            *len += line_len;
+            script[(*len)++] = '\n';
+        }
+        return script;
+    }
+    ssize_t amount;
+    while ((amount = read(STDIN_FILENO, script + *len, cap - *len)) != 0) {
+        if (amount == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        *len += amount;
+        if (*len == cap) {
+            cap *= 2;
+            script = realloc(script, cap);
+        }
+    }
+    return script;
+}
+
+int run_client(char *socket_path, char **lines, int lines_len) {
+    struct sockaddr_un address;
+    if (!socket_address(socket_path, &address)) {
+        return 2;
+    }
+    int conn = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (conn == -1 || connect(conn, (struct sockaddr *) &address, sizeof(address)) == -1) {
+        fprintf(stderr, "vsh: %s: %s\n", socket_path, strerror(errno));
+        return 1;
+    }
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        strcpy(cwd, "/");
+    }
+    size_t env_len = 0, script_len;
+    char **var;
+    for (var = environ; *var != NULL; var++) {
+        env_len += strlen(*var) + 1;
+    }
+    char *script = client_script(lines, lines_len, &script_len);
+    ServerRequest request = {SERVER_MAGIC, strlen(cwd) + 1, env_len, script_len};
+    int fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+    char control[CMSG_SPACE(sizeof(fds))];
+    memset(control, 0, sizeof(control));
+    struct iovec iov = {&request, sizeof(request)};
+    struct msghdr message = {0};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+    if (sendmsg(conn, &message, 0) != sizeof(request)) {
+        perror("vsh: the request couldn't be sent");
+        return 1;
+    }
+    write_all(conn, cwd, request.cwd_len);
+    for (var = environ; *var != NULL; var++) {
+        write_all(conn, *var, strlen(*var) + 1);
+    }
+    write_all(conn, script, script_len);
+    free(script);
+    int32_t status;
+    if (!read_all(conn, &status, sizeof(status))) {
+        fprintf(stderr, "vsh: the server closed the connection\n");
+        return 1;
+    }
+    close(conn);
+    return status;
+}
@@ -0,0 +1,34 @@
+#ifndef LIB_SERVER_H
+#define LIB_SERVER_H
+
+#include <stdint.h>
+#include "lib.h"
+
+#define SERVER_MAGIC 0x76736831
+#define SERVER_BACKLOG 64
+
+/*
+ * `vsh --serve PATH` keeps a shell resident on a UNIX socket, each connection
+ * is served by a forked copy of it, so the clients run concurrently and none
+ * of them sees the directory or variables changed by another.
+ *
+ * A client sends its stdin, stdout and stderr with SCM_RIGHTS along with this
+ * header, followed by its working directory, its environment (NUL separated)
+ * and the script to run. The server answers with the exit status as an int32.
+ */
+typedef struct serverRequest {
+    uint32_t magic;
+    uint32_t cwd_len;
+    uint32_t env_len;
+    uint32_t script_len;
+} ServerRequest;
+
+int serve(ShellState *state, char *socket_path);
+
+/*
+ * `vsh --client PATH [lines...]` runs the lines (or the script read from
+ * stdin when there are none) on the server, returning its exit status.
+ */
+int run_client(char *socket_path, char **lines, int lines_len);
+
+#endif
@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "alloc_stats.h"
+#include "bench.h"
+#include "stats.h"
+#include "util/string_util/string_util.h"
+
+#define ALLOC_TAG StateAlloc
+
+ShellStats *shell_stats = NULL;
+
+const char *STATS_COUNTER_NAMES[STATS_COUNTERS] = {
+        "lines_parsed", "commands_launched", "fork_failures", "spawn_failures",
+};
+
+const char *STATS_HISTOGRAM_NAMES[STATS_HISTOGRAMS] = {
+        "parse", "fork_to_exec", "exec_to_reap", "prompt_render",
+};
+
+const double STATS_PERCENTILES[] = {50, 90, 99};
+
+void init_stats() {
+    void *mapping = mmap(NULL, sizeof(ShellStats), PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) {
+        perror("vsh: stats are disabled, mmap failed");
+        return;
+    }
+    shell_stats = mapping;
+}
+
+uint64_t stats_now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void stats_count(enum StatsCounter counter) {
+    if (shell_stats != NULL) {
+        __atomic_fetch_add(&shell_stats->counters[counter], 1, __ATOMIC_RELAXED);
+    }
+}
+
+unsigned int stats_bucket(uint64_t value) {
+    if (value < STATS_SUB_BUCKETS) {
+        return value;
+    }
+    unsigned int exponent = 63 - __builtin_clzll(value);
+    unsigned int sub = (value >> (exponent - STATS_SUB_BUCKET_BITS)) & (STATS_SUB_BUCKETS - 1);
+    return (exponent - STATS_SUB_BUCKET_BITS + 1) * STATS_SUB_BUCKETS + sub;
+}
+
+/*
+ * The largest value falling in the bucket.
+ */
+uint64_t stats_bucket_value(unsigned int bucket) {
+    if (bucket < STATS_SUB_BUCKETS) {
+        return bucket;
+    }
+    unsigned int shift = bucket / STATS_SUB_BUCKETS - 1;
+    uint64_t low = (uint64_t) (STATS_SUB_BUCKETS + bucket % STATS_SUB_BUCKETS) << shift;
+    return low + ((uint64_t) 1 << shift) - 1;
+}
+
+void stats_record(enum StatsHistogram histogram, uint64_t start) {
+    if (shell_stats == NULL) {
+        return;
+    }
+    uint64_t now = stats_now(), value = now > start ? now - start : 0;
+    StatsHistogram *hist = &shell_stats->histograms[histogram];
+    __atomic_fetch_add(&hist->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->sum, value, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->buckets[stats_bucket(value)], 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * A consistent enough copy of a histogram, the count is the sum of the
+ * buckets copied as they're still updated.
+ */
+void snapshot_histogram(StatsHistogram *hist, StatsHistogram *out) {
+    unsigned int i;
+    out->count = 0;
+    out->sum = __atomic_load_n(&hist->sum, __ATOMIC_RELAXED);
+    for (i = 0; i < STATS_BUCKETS; i++) {
+        out->buckets[i] = __atomic_load_n(&hist->buckets[i], __ATOMIC_RELAXED);
+        out->count += out->buckets[i];
+    }
+}
+
+uint64_t histogram_percentile(StatsHistogram *hist, double percentile) {
+    uint64_t rank = (uint64_t) (hist->count * percentile / 100 + 0.5), seen = 0;
+    unsigned int i;
+    if (!rank) {
+        rank = 1;
+    }
+    for (i = 0; i < STATS_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if (seen >= rank) {
+            return stats_bucket_value(i);
+        }
+    }
+    return 0;
+}
+
+uint64_t histogram_max(StatsHistogram *hist) {
+    int i;
+    for (i = STATS_BUCKETS - 1; i >= 0 && !hist->buckets[i]; i--);
+    return i >= 0 ? stats_bucket_value(i) : 0;
+}
+
+void print_stats_json(ShellStats *stats) {
+    unsigned int i, j;
+    printf("{\"counters\": {");
+    for (i = 0; i < STATS_COUNTERS; i++) {
+        printf("%s\"%s\": %lu", i ? ", " : "", STATS_COUNTER_NAMES[i],
+               (unsigned long) stats->counters[i]);
+    }
+    printf("}, \"histograms\": {");
+    for (i = 0; i < STATS_HISTOGRAMS; i++) {
+        StatsHistogram *hist = &stats->histograms[i];
+        printf("%s\"%s\": {\"count\": %lu, \"mean_ns\": %lu", i ? ", " : "",
+               STATS_HISTOGRAM_NAMES[i], (unsigned long) hist->count,
+               (unsigned long) (hist->count ? hist->sum / hist->count : 0));
+        for (j = 0; j < sizeof(STATS_PERCENTILES) / sizeof(double); j++) {
+            printf(", \"p%g_ns\": %lu", STATS_PERCENTILES[j],
+                   (unsigned long) (hist->count ? histogram_percentile(hist, STATS_PERCENTILES[j])
+                                                : 0));
+        }
+        printf(", \"max_ns\": %lu}", (unsigned long) histogram_max(hist));
+    }
+    printf("}}\n");
+}
+
+void print_stats(ShellStats *stats) {
+    unsigned int i, j;
+    char buffer[32];
+    for (i = 0; i < STATS_COUNTERS; i++) {
+        printf("%-18s %lu\n", STATS_COUNTER_NAMES[i], (unsigned long) stats->counters[i]);
+    }
+    printf("\n%-18s %8s %10s %10s %10s %10s %10s\n", "latency", "count", "mean", "p50", "p90",
+           "p99", "max");
+    for (i = 0; i < STATS_HISTOGRAMS; i++) {
+        StatsHistogram *hist = &stats->histograms[i];
+        printf("%-18s %8lu", STATS_HISTOGRAM_NAMES[i], (unsigned long) hist->count);
+        if (!hist->count) {
+            printf("\n");
+            continue;
+        }
+        printf(" %10s", format_ns(hist->sum / hist->count, buffer, sizeof(buffer)));
+        for (j = 0; j < sizeof(STATS_PERCENTILES) / sizeof(double); j++) {
+            printf(" %10s", format_ns(histogram_percentile(hist, STATS_PERCENTILES[j]), buffer,
+                                     sizeof(buffer)));
+        }
+        printf(" %10s\n", format_ns(histogram_max(hist), buffer, sizeof(buffer)));
+    }
+}
+
+void reset_stats() {
+    uint64_t *values = (uint64_t *) shell_stats;
+    size_t i;
+    for (i = 0; i < sizeof(ShellStats) / sizeof(uint64_t); i++) {
+        __atomic_store_n(&values[i], 0, __ATOMIC_RELAXED);
+    }
+}
+
+int stats_builtin(ShellState *state, ExecArgs *exec_args) {
+    (void) state;
+    bool json = false, reset = false;
+    unsigned int i;
+    for (i = 1; i < exec_args->argc; i++) {
+        if (str_equals(exec_args->argv[i], "--json")) {
+            json = true;
+        } else if (str_equals(exec_args->argv[i], "--reset")) {
+            reset = true;
+        } else {
+            fprintf(stderr, "usage: stats [--json] [--reset]\n");
+            return 2;
+        }
+    }
+    if (shell_stats == NULL) {
+        fprintf(stderr, "stats: the stats are disabled\n");
+        return 1;
+    }
+    // `--reset` alone only resets them
+    if (json || !reset) {
+        ShellStats *stats = malloc(sizeof(ShellStats));
+        for (i = 0; i < STATS_COUNTERS; i++) {
+            stats->counters[i] = __atomic_load_n(&shell_stats->counters[i], __ATOMIC_RELAXED);
+        }
+        for (i = 0; i < STATS_HISTOGRAMS; i++) {
+            snapshot_histogram(&shell_stats->histograms[i], &stats->histograms[i]);
+        }
+        if (json) {
+            print_stats_json(stats);
+        } else {
+            print_stats(stats);
+        }
+        free(stats);
+    }
+    if (reset) {
+        reset_stats();
+    }
+    return 0;
+}
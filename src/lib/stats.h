@@ -0,0 +1,70 @@
+#ifndef LIB_STATS_H
+#define LIB_STATS_H
+
+#include <stdint.h>
+#include "lib.h"
+
+/*
+ * Always on counters and latency histograms of the shell's own overhead, read
+ * back with `stats [--json] [--reset]`.
+ *
+ * They live in a MAP_SHARED mapping created at startup, so the forked copies
+ * of the shell and the children recording the fork to exec time update the
+ * same ones. Recording is a handful of relaxed atomic additions.
+ *
+ * Histograms are log-linear (HDR style): values below 2^STATS_SUB_BUCKET_BITS
+ * nanoseconds get a bucket each, above that every power of two is split into
+ * 2^STATS_SUB_BUCKET_BITS buckets, so a percentile is within about 6% of the
+ * real value up to 2^64 ns.
+ */
+#define STATS_SUB_BUCKET_BITS 4
+#define STATS_SUB_BUCKETS (1 << STATS_SUB_BUCKET_BITS)
+#define STATS_BUCKETS ((64 - STATS_SUB_BUCKET_BITS + 1) * STATS_SUB_BUCKETS)
+
+enum StatsCounter {
+    LinesParsed,
+    CommandsLaunched,
+    ForkFailures,
+    SpawnFailures,
+    STATS_COUNTERS,
+};
+
+enum StatsHistogram {
+    // process_call_arg and call_groups, with the substitutions they run
+    ParseLatency,
+    // From before fork (or the launcher's fork) to right before exec, in the child
+    ForkToExec,
+    // From the fork of a foreground command (or pipeline member) until it's reaped
+    ExecToReap,
+    PromptRender,
+    STATS_HISTOGRAMS,
+};
+
+typedef struct statsHistogram {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t buckets[STATS_BUCKETS];
+} StatsHistogram;
+
+typedef struct shellStats {
+    uint64_t counters[STATS_COUNTERS];
+    StatsHistogram histograms[STATS_HISTOGRAMS];
+} ShellStats;
+
+/*
+ * Maps the shared stats, before anything forks so every process shares them.
+ */
+void init_stats();
+
+uint64_t stats_now();
+
+void stats_count(enum StatsCounter counter);
+
+/*
+ * Records the time elapsed since `start`, a stats_now() value.
+ */
+void stats_record(enum StatsHistogram histogram, uint64_t start);
+
+int stats_builtin(ShellState *state, ExecArgs *exec_args);
+
+#endif
@@ -0,0 +1,97 @@
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "alloc_stats.h"
+#include "timeout.h"
+#include "util/string_util/string_util.h"
+
+#define ALLOC_TAG ExecAlloc
+
+typedef struct signalName {
+    char *name;
+    int signal;
+} SignalName;
+
+SignalName SIGNAL_NAMES[] = {
+        {"HUP",  SIGHUP},
+        {"INT",  SIGINT},
+        {"QUIT", SIGQUIT},
+        {"KILL", SIGKILL},
+        {"USR1", SIGUSR1},
+        {"USR2", SIGUSR2},
+        {"ALRM", SIGALRM},
+        {"TERM", SIGTERM},
+};
+
+int parse_signal_name(char *str) {
+    char *end;
+    long number = strtol(str, &end, 10);
+    if (*str && !*end) {
+        return number > 0 && number < NSIG ? (int) number : -1;
+    }
+    if (!strncasecmp(str, "SIG", 3)) {
+        str += 3;
+    }
+    unsigned int i;
+    for (i = 0; i < sizeof(SIGNAL_NAMES) / sizeof(SignalName); i++) {
+        if (!strcasecmp(SIGNAL_NAMES[i].name, str)) {
+            return SIGNAL_NAMES[i].signal;
+        }
+    }
+    return -1;
+}
+
+bool parse_duration(char *str, double *seconds) {
+    char *end;
+    double value = strtod(str, &end);
+    if (end == str || value < 0) {
+        return false;
+    }
+    if (str_equals(end, "ms")) {
+        value /= 1000;
+    } else if (str_equals(end, "m")) {
+        value *= 60;
+    } else if (str_equals(end, "h")) {
+        value *= 60 * 60;
+    } else if (str_equals(end, "d")) {
+        value *= 24 * 60 * 60;
+    } else if (*end && !str_equals(end, "s")) {
+        return false;
+    }
+    *seconds = value;
+    return true;
+}
+
+bool take_timeout_prefix(ExecArgs *exec_args, TimeoutSpec *spec) {
+    char **argv = exec_args->argv;
+    unsigned int argc = exec_args->argc, i = 1;
+    if (!argc || !str_equals(argv[0], "timeout")) {
+        return false;
+    }
+    TimeoutSpec parsed = {0, SIGTERM, TIMEOUT_DEFAULT_GRACE};
+    for (; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+        if (str_equals(argv[i], "-s")) {
+            parsed.signal = parse_signal_name(argv[i + 1]);
+            if (parsed.signal == -1) {
+                return false;
+            }
+        } else if (!str_equals(argv[i], "-k") || !parse_duration(argv[i + 1], &parsed.grace)) {
+            return false;
+        }
+    }
+    if (i + 1 >= argc || !parse_duration(argv[i], &parsed.seconds)) {
+        return false;
+    }
+    *spec = parsed;
+    unsigned int taken = i + 1, j;
+    for (j = 0; j < taken; j++) {
+        free(argv[j]);
+    }
+    memmove(argv, argv + taken, sizeof(char *) * (argc - taken + 1));
+    exec_args->argc -= taken;
+    // The launch prefixes were looked for before `timeout` was taken off
+    take_launch_prefixes(&exec_args->attrs, exec_args->argv, &exec_args->argc);
+    return true;
+}
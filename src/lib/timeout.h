@@ -0,0 +1,35 @@
+#ifndef LIB_TIMEOUT_H
+#define LIB_TIMEOUT_H
+
+#include <stdbool.h>
+#include "lib.h"
+
+#define TIMEOUT_DEFAULT_GRACE 5
+// Exit statuses of a group that was timed out, as the ones of timeout(1)
+#define TIMEOUT_EXIT_STATUS 124
+#define TIMEOUT_KILLED_EXIT_STATUS 137
+
+/*
+ * `timeout [-s SIGNAL] [-k GRACE] DURATION` before the first command of a
+ * group (a command, a pipeline or a `;`/`&` group) limits the whole group.
+ */
+typedef struct timeoutSpec {
+    double seconds;
+    int signal;
+    double grace;
+} TimeoutSpec;
+
+/*
+ * Parses durations like "1.5", "200ms", "3m", "1h" or "1d" into seconds.
+ */
+bool parse_duration(char *str, double *seconds);
+
+int parse_signal_name(char *str);
+
+/*
+ * Removes the timeout prefix from argv filling the spec, argv is left as is
+ * when it's malformed or nothing follows it.
+ */
+bool take_timeout_prefix(ExecArgs *exec_args, TimeoutSpec *spec);
+
+#endif
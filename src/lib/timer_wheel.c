@@ -0,0 +1,261 @@
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "alloc_stats.h"
+#include "timer_wheel.h"
+
+#define ALLOC_TAG ExecAlloc
+
+TimerWheel timer_wheel;
+pthread_mutex_t timer_wheel_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_t timer_wheel_thread;
+bool has_timer_wheel_thread = false;
+bool has_registered_atfork = false;
+
+uint64_t timer_wheel_clock_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// The tick the clock is at, counted from the start of the wheel
+unsigned long timer_wheel_now() {
+    return (timer_wheel_clock_ns() - timer_wheel.started_at) / TIMER_WHEEL_TICK_NS;
+}
+
+/*
+ * Sets the timerfd to fire at the earliest deadline, or disarms it without
+ * entries.
+ */
+void timer_wheel_arm() {
+    unsigned long next = 0;
+    TimerEntry *entry;
+    for (entry = timer_wheel.entries; entry != NULL; entry = entry->next_entry) {
+        if (entry->in_wheel && (!next || entry->deadline < next)) {
+            next = entry->deadline;
+        }
+    }
+    if (next == timer_wheel.armed_deadline) {
+        return;
+    }
+    struct itimerspec spec = {{0, 0}, {0, 0}};
+    if (next) {
+        uint64_t at = timer_wheel.started_at + (uint64_t) next * TIMER_WHEEL_TICK_NS;
+        spec.it_value.tv_sec = at / 1000000000ULL;
+        spec.it_value.tv_nsec = at % 1000000000ULL;
+    }
+    timerfd_settime(timer_wheel.timer_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+    timer_wheel.armed_deadline = next;
+}
+
+void timer_wheel_insert(TimerEntry *entry) {
+    TimerEntry **slot = &timer_wheel.slots[entry->deadline % TIMER_WHEEL_SLOTS];
+    entry->next = *slot;
+    *slot = entry;
+    entry->in_wheel = true;
+    timer_wheel.len += 1;
+}
+
+bool is_leader_running(pid_t leader) {
+    siginfo_t info;
+    info.si_pid = 0;
+    // WNOWAIT leaves the status to the handler waiting for it
+    return waitid(P_PID, leader, &info, WEXITED | WNOHANG | WNOWAIT) == 0 && info.si_pid == 0;
+}
+
+void free_detached_entries() {
+    TimerEntry **link = &timer_wheel.entries;
+    while (*link != NULL) {
+        TimerEntry *entry = *link;
+        if (entry->detached && !entry->in_wheel) {
+            *link = entry->next_entry;
+            free(entry);
+        } else {
+            link = &entry->next_entry;
+        }
+    }
+}
+
+/*
+ * Expires the entries of the slot whose deadline has passed, the others in it
+ * belong to later turns of the wheel.
+ */
+void timer_wheel_expire_slot(unsigned int slot) {
+    TimerEntry **link = &timer_wheel.slots[slot];
+    TimerEntry *escalated = NULL;
+    bool has_detached = false;
+    while (*link != NULL) {
+        TimerEntry *entry = *link;
+        if (entry->deadline > timer_wheel.current_tick) {
+            link = &entry->next;
+            continue;
+        }
+        *link = entry->next;
+        entry->in_wheel = false;
+        timer_wheel.len -= 1;
+        has_detached |= entry->detached;
+        if (!is_leader_running(entry->leader)) {
+            continue;
+        }
+        if (entry->state == TimerPending) {
+            killpg(entry->pgid, entry->signal);
+            entry->state = TimerSignalled;
+            if (entry->grace_ticks && entry->signal != SIGKILL) {
+                entry->deadline = timer_wheel.current_tick + entry->grace_ticks;
+                entry->next = escalated;
+                escalated = entry;
+            }
+        } else {
+            killpg(entry->pgid, SIGKILL);
+            entry->state = TimerKilled;
+        }
+    }
+    while (escalated != NULL) {
+        TimerEntry *entry = escalated;
+        escalated = entry->next;
+        timer_wheel_insert(entry);
+    }
+    if (has_detached) {
+        free_detached_entries();
+    }
+}
+
+/*
+ * Moves the wheel to the current tick, a full turn or more at once only
+ * looks at every slot once.
+ */
+void timer_wheel_advance() {
+    unsigned long now = timer_wheel_now();
+    unsigned int i;
+    if (now - timer_wheel.current_tick >= TIMER_WHEEL_SLOTS) {
+        timer_wheel.current_tick = now;
+        for (i = 0; i < TIMER_WHEEL_SLOTS; i++) {
+            timer_wheel_expire_slot(i);
+        }
+        return;
+    }
+    while (timer_wheel.current_tick < now) {
+        timer_wheel.current_tick += 1;
+        timer_wheel_expire_slot(timer_wheel.current_tick % TIMER_WHEEL_SLOTS);
+    }
+}
+
+void *timer_wheel_thread_func(void *arg) {
+    (void) arg;
+    while (true) {
+        uint64_t expirations;
+        if (read(timer_wheel.timer_fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+            continue;
+        }
+        pthread_mutex_lock(&timer_wheel_mutex);
+        // Fired once, it's armed again for the next deadline
+        timer_wheel.armed_deadline = 0;
+        timer_wheel_advance();
+        timer_wheel_arm();
+        pthread_mutex_unlock(&timer_wheel_mutex);
+    }
+    return NULL;
+}
+
+void timer_wheel_lock() { pthread_mutex_lock(&timer_wheel_mutex); }
+
+void timer_wheel_unlock() { pthread_mutex_unlock(&timer_wheel_mutex); }
+
+/*
+ * The thread doesn't exist in a forked child, its copy of the wheel is
+ * discarded and a new thread is started if it ever needs one.
+ */
+void timer_wheel_reset_in_child() {
+    while (timer_wheel.entries != NULL) {
+        TimerEntry *entry = timer_wheel.entries;
+        timer_wheel.entries = entry->next_entry;
+        free(entry);
+    }
+    if (has_timer_wheel_thread) {
+        close(timer_wheel.timer_fd);
+    }
+    timer_wheel = (TimerWheel) {0};
+    has_timer_wheel_thread = false;
+    pthread_mutex_unlock(&timer_wheel_mutex);
+}
+
+unsigned long timer_wheel_add(pid_t pgid, pid_t leader, double seconds, int signal,
+                              double grace_seconds) {
+    pthread_mutex_lock(&timer_wheel_mutex);
+    if (!has_timer_wheel_thread) {
+        timer_wheel.timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+        if (timer_wheel.timer_fd == -1 ||
+            pthread_create(&timer_wheel_thread, NULL, timer_wheel_thread_func, NULL)) {
+            perror("timeout: the timer thread couldn't be started");
+            exit(1);
+        }
+        timer_wheel.started_at = timer_wheel_clock_ns();
+        if (!has_registered_atfork) {
+            pthread_atfork(timer_wheel_lock, timer_wheel_unlock, timer_wheel_reset_in_child);
+            has_registered_atfork = true;
+        }
+        has_timer_wheel_thread = true;
+    }
+    TimerEntry *entry = malloc(sizeof(TimerEntry));
+    unsigned long ticks = (unsigned long) (seconds * 1000 / TIMER_WHEEL_TICK_MS);
+    entry->id = ++timer_wheel.next_id;
+    entry->pgid = pgid;
+    entry->leader = leader;
+    entry->signal = signal;
+    entry->grace_ticks = (unsigned long) (grace_seconds * 1000 / TIMER_WHEEL_TICK_MS);
+    entry->deadline = timer_wheel_now() + (ticks ? ticks : 1);
+    entry->state = TimerPending;
+    entry->detached = false;
+    entry->next_entry = timer_wheel.entries;
+    timer_wheel.entries = entry;
+    timer_wheel_insert(entry);
+    timer_wheel_arm();
+    pthread_mutex_unlock(&timer_wheel_mutex);
+    return entry->id;
+}
+
+enum TimerState timer_wheel_cancel(unsigned long id) {
+    pthread_mutex_lock(&timer_wheel_mutex);
+    enum TimerState state = TimerPending;
+    TimerEntry **link;
+    for (link = &timer_wheel.entries; *link != NULL; link = &(*link)->next_entry) {
+        if ((*link)->id == id) {
+            break;
+        }
+    }
+    if (*link != NULL) {
+        TimerEntry *entry = *link;
+        *link = entry->next_entry;
+        if (entry->in_wheel) {
+            TimerEntry **slot = &timer_wheel.slots[entry->deadline % TIMER_WHEEL_SLOTS];
+            while (*slot != entry) {
+                slot = &(*slot)->next;
+            }
+            *slot = entry->next;
+            timer_wheel.len -= 1;
+        }
+        state = entry->state;
+        free(entry);
+    }
+    pthread_mutex_unlock(&timer_wheel_mutex);
+    return state;
+}
+
+void timer_wheel_detach(unsigned long id) {
+    pthread_mutex_lock(&timer_wheel_mutex);
+    TimerEntry *entry;
+    for (entry = timer_wheel.entries; entry != NULL && entry->id != id; entry = entry->next_entry);
+    if (entry != NULL) {
+        entry->detached = true;
+    }
+    free_detached_entries();
+    pthread_mutex_unlock(&timer_wheel_mutex);
+}
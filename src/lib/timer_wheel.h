@@ -0,0 +1,72 @@
+#ifndef LIB_TIMER_WHEEL_H
+#define LIB_TIMER_WHEEL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define TIMER_WHEEL_SLOTS 256
+#define TIMER_WHEEL_TICK_MS 10
+#define TIMER_WHEEL_TICK_NS (TIMER_WHEEL_TICK_MS * 1000000ULL)
+
+enum TimerState {
+    TimerPending,
+    TimerSignalled,
+    TimerKilled,
+};
+
+/*
+ * A process group deadline. Once it expires `signal` is sent to the group and,
+ * when `grace_ticks` isn't 0, SIGKILL follows after that many more ticks.
+ */
+typedef struct timerEntry {
+    unsigned long id;
+    pid_t pgid;
+    // Only signalled while this process is alive, so a reused pgid is left alone
+    pid_t leader;
+    int signal;
+    unsigned long grace_ticks;
+    unsigned long deadline;
+    enum TimerState state;
+    bool in_wheel;
+    // Nobody will cancel it, it's freed once it's out of the wheel
+    bool detached;
+    // Next entry of the same wheel slot
+    struct timerEntry *next;
+    // Next of all the entries not cancelled yet, expired ones included
+    struct timerEntry *next_entry;
+} TimerEntry;
+
+/*
+ * Every timeout of the shell shares a single thread that sleeps on a timerfd
+ * set for the earliest deadline, the wheel is then moved to the current tick
+ * (of TIMER_WHEEL_TICK_MS) and each tick passed only looks at the entries of
+ * one slot of the wheel.
+ */
+typedef struct timerWheel {
+    TimerEntry *slots[TIMER_WHEEL_SLOTS];
+    TimerEntry *entries;
+    unsigned long current_tick;
+    unsigned long next_id;
+    unsigned int len;
+    int timer_fd;
+    // CLOCK_MONOTONIC ns of tick 0
+    uint64_t started_at;
+    // The tick the timerfd fires at, 0 when disarmed
+    unsigned long armed_deadline;
+} TimerWheel;
+
+unsigned long timer_wheel_add(pid_t pgid, pid_t leader, double seconds, int signal,
+                              double grace_seconds);
+
+/*
+ * Removes the entry returning how far it got.
+ */
+enum TimerState timer_wheel_cancel(unsigned long id);
+
+/*
+ * The entry of a background group, left to fire on its own.
+ */
+void timer_wheel_detach(unsigned long id);
+
+#endif
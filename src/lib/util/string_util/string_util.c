@@ -1,6 +1,9 @@
 #include "string_util.h"
 #include <ctype.h>
 #include <string.h>
+#include "../../alloc_stats.h"
+
+#define ALLOC_TAG ParserAlloc
 
 char *fmt_str(void *data) {
     char *str = malloc(strlen(data) + 1);
@@ -45,4 +48,70 @@ char *str_trim(char *str) {
 
 bool str_equals(char *self, char *other) {
     return strcmp(self, other) == 0;
-}
\ No newline at end of file
+}
+
+void str_swap(char **arr, size_t a, size_t b) {
+    char *aux = arr[a];
+    arr[a] = arr[b];
+    arr[b] = aux;
+}
+
+/*
+ * Multikey quicksort (Bentley & Sedgewick), partitioning on a single character
+ * at a time so shared prefixes are never compared twice.
+ */
+void str_sort_by_depth(char **arr, size_t len, size_t depth) {
+    while (len > 1) {
+        if (len < 8) {
+            size_t i, j;
+            for (i = 1; i < len; i++) {
+                for (j = i; j > 0 && strcmp(arr[j - 1] + depth, arr[j] + depth) > 0; j--) {
+                    str_swap(arr, j - 1, j);
+                }
+            }
+            return;
+        }
+        str_swap(arr, 0, len >> 1);
+        unsigned char pivot = (unsigned char) arr[0][depth];
+        size_t lt = 0, i = 1, gt = len;
+        while (i < gt) {
+            unsigned char c = (unsigned char) arr[i][depth];
+            if (c < pivot) {
+                str_swap(arr, lt++, i++);
+            } else if (c > pivot) {
+                str_swap(arr, i, --gt);
+            } else {
+                i++;
+            }
+        }
+        str_sort_by_depth(arr, lt, depth);
+        str_sort_by_depth(arr + gt, len - gt, depth);
+        if (!pivot) {
+            return;
+        }
+        arr += lt;
+        len = gt - lt;
+        depth += 1;
+    }
+}
+
+void str_sort(char **arr, size_t len) { str_sort_by_depth(arr, len, 0); }
+
+char *str_join(char **arr, size_t len, char *separator) {
+    size_t total = 1, separator_len = strlen(separator), i;
+    for (i = 0; i < len; i++) {
+        total += strlen(arr[i]) + separator_len;
+    }
+    char *str = malloc(total), *cursor = str;
+    for (i = 0; i < len; i++) {
+        if (i) {
+            memcpy(cursor, separator, separator_len);
+            cursor += separator_len;
+        }
+        size_t item_len = strlen(arr[i]);
+        memcpy(cursor, arr[i], item_len);
+        cursor += item_len;
+    }
+    *cursor = '\0';
+    return str;
+}
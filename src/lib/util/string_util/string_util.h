@@ -3,6 +3,7 @@
 
 #include "../vec/vec.h"
 #include <stdbool.h>
+#include <stddef.h>
 
 #define BUFFER_MAX_SIZE 1024
 
@@ -17,4 +18,8 @@ char *fmt_str(void *data);
 
 bool str_equals(char *self, char *other);
 
+void str_sort(char **arr, size_t len);
+
+char *str_join(char **arr, size_t len, char *separator);
+
 #endif
\ No newline at end of file
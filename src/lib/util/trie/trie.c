@@ -0,0 +1,223 @@
+#include "trie.h"
+#include <string.h>
+#include "../../alloc_stats.h"
+
+#define ALLOC_TAG StateAlloc
+
+TrieNode *new_trie_node() {
+    TrieNode *node = malloc(sizeof(TrieNode));
+    node->child_count = 0;
+    node->child_capacity = 0;
+    node->keys = NULL;
+    node->children = NULL;
+    node->source_mask = 0;
+    node->terminal_count = 0;
+    return node;
+}
+
+void drop_trie_node(TrieNode *node) {
+    int i;
+    for (i = 0; i < node->child_count; i++) {
+        drop_trie_node(node->children[i]);
+    }
+    free(node->keys);
+    free(node->children);
+    free(node);
+}
+
+Trie *new_trie() {
+    Trie *self = malloc(sizeof(Trie));
+    self->root = new_trie_node();
+    self->len = 0;
+    self->insert = trie_insert;
+    self->remove = trie_remove;
+    self->find = trie_find;
+    self->drop = drop_trie;
+    return self;
+}
+
+void drop_trie(Trie *self) {
+    drop_trie_node(self->root);
+    free(self);
+}
+
+/*
+ * Children are kept sorted by key so lookups are a binary search and
+ * collecting candidates yields them already in lexical order.
+ */
+int trie_node_child_idx(TrieNode *node, unsigned char key, bool *found) {
+    int low = 0, high = node->child_count;
+    while (low < high) {
+        int mid = (low + high) >> 1;
+        unsigned char mid_key = node->keys[mid];
+        if (mid_key == key) {
+            *found = true;
+            return mid;
+        } else if (mid_key < key) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    *found = false;
+    return low;
+}
+
+TrieNode *trie_node_child(TrieNode *node, unsigned char key) {
+    bool found;
+    int idx = trie_node_child_idx(node, key, &found);
+    return found ? node->children[idx] : NULL;
+}
+
+TrieNode *trie_node_add_child(TrieNode *node, unsigned char key) {
+    bool found;
+    int idx = trie_node_child_idx(node, key, &found);
+    if (found) {
+        return node->children[idx];
+    }
+    if (node->child_count == node->child_capacity) {
+        unsigned short capacity = node->child_capacity ? node->child_capacity << 1 : 2;
+        if (capacity > 256) {
+            capacity = 256;
+        }
+        node->keys = realloc(node->keys, sizeof(char) * capacity);
+        node->children = realloc(node->children, sizeof(TrieNode *) * capacity);
+        if (node->keys == NULL || node->children == NULL) {
+            perror("trie resizing failed!\n");
+            exit(1);
+        }
+        node->child_capacity = capacity;
+    }
+    int moved = node->child_count - idx;
+    memmove(node->keys + idx + 1, node->keys + idx, moved);
+    memmove(node->children + idx + 1, node->children + idx, sizeof(TrieNode *) * moved);
+    TrieNode *child = new_trie_node();
+    node->keys[idx] = (char) key;
+    node->children[idx] = child;
+    node->child_count += 1;
+    return child;
+}
+
+uint64_t trie_source_bit(unsigned int source) {
+    return (uint64_t) 1 << (source > TRIE_MAX_SOURCE ? TRIE_MAX_SOURCE : source);
+}
+
+void trie_insert(Trie *self, char *str, unsigned int source) {
+    size_t len = strlen(str);
+    TrieNode *path[len + 1];
+    TrieNode *node = self->root;
+    size_t i;
+    path[0] = node;
+    for (i = 0; i < len; i++) {
+        node = trie_node_add_child(node, (unsigned char) str[i]);
+        path[i + 1] = node;
+    }
+    bool was_terminal = node->source_mask != 0;
+    node->source_mask |= trie_source_bit(source);
+    if (!was_terminal) {
+        for (i = 0; i <= len; i++) {
+            path[i]->terminal_count += 1;
+        }
+        self->len += 1;
+    }
+}
+
+void trie_remove(Trie *self, char *str, unsigned int source) {
+    size_t len = strlen(str);
+    TrieNode *path[len + 1];
+    TrieNode *node = self->root;
+    size_t i;
+    path[0] = node;
+    for (i = 0; i < len && node != NULL; i++) {
+        node = trie_node_child(node, (unsigned char) str[i]);
+        path[i + 1] = node;
+    }
+    if (node == NULL || !(node->source_mask & trie_source_bit(source))) {
+        return;
+    }
+    node->source_mask &= ~trie_source_bit(source);
+    if (node->source_mask) {
+        return;
+    }
+    for (i = 0; i <= len; i++) {
+        path[i]->terminal_count -= 1;
+    }
+    self->len -= 1;
+    // Pruning the branches that no longer lead to any stored string
+    for (i = len; i > 0 && path[i]->terminal_count == 0; i--) {
+        TrieNode *parent = path[i - 1];
+        bool found;
+        int idx = trie_node_child_idx(parent, (unsigned char) str[i - 1], &found);
+        drop_trie_node(path[i]);
+        int moved = parent->child_count - idx - 1;
+        memmove(parent->keys + idx, parent->keys + idx + 1, moved);
+        memmove(parent->children + idx, parent->children + idx + 1,
+                sizeof(TrieNode *) * moved);
+        parent->child_count -= 1;
+    }
+}
+
+TrieNode *trie_find(Trie *self, char *prefix) {
+    TrieNode *node = self->root;
+    while (*prefix && node != NULL) {
+        node = trie_node_child(node, (unsigned char) *prefix);
+        prefix++;
+    }
+    return node;
+}
+
+/*
+ * The longest extension shared by every string below the node, it's what a
+ * Tab press can safely insert.
+ */
+char *trie_node_common_suffix(TrieNode *node) {
+    Vec *chars = new_vec(sizeof(char));
+    while (node->child_count == 1 && !node->source_mask) {
+        chars->push(chars, (void *) (uintptr_t) (unsigned char) node->keys[0]);
+        node = node->children[0];
+    }
+    char *suffix = malloc(sizeof(char) * (chars->length + 1));
+    unsigned int i;
+    for (i = 0; i < chars->length; i++) {
+        suffix[i] = (char) (uintptr_t) chars->get(chars, i);
+    }
+    suffix[i] = '\0';
+    chars->drop(chars);
+    return suffix;
+}
+
+void trie_node_collect_rec(TrieNode *node, char *buffer, size_t len,
+                           size_t capacity, Vec *out, unsigned int limit) {
+    if (out->length >= limit) {
+        return;
+    }
+    if (node->source_mask) {
+        buffer[len] = '\0';
+        out->push(out, strdup(buffer));
+    }
+    if (len + 1 >= capacity) {
+        return;
+    }
+    int i;
+    for (i = 0; i < node->child_count && out->length < limit; i++) {
+        buffer[len] = node->keys[i];
+        trie_node_collect_rec(node->children[i], buffer, len + 1, capacity, out,
+                              limit);
+    }
+}
+
+/*
+ * Pushes up to `limit` strings (prefixed by `prefix`) stored below the node
+ * into `out`, returning how many strings the node really holds.
+ */
+unsigned int trie_node_collect(TrieNode *node, char *prefix, Vec *out,
+                               unsigned int limit) {
+    char buffer[1024];
+    size_t prefix_len = strlen(prefix);
+    if (prefix_len >= sizeof(buffer)) {
+        return node->terminal_count;
+    }
+    memcpy(buffer, prefix, prefix_len);
+    trie_node_collect_rec(node, buffer, prefix_len, sizeof(buffer), out, limit);
+    return node->terminal_count;
+}
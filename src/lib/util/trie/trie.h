@@ -0,0 +1,54 @@
+#ifndef TRIE_H
+#define TRIE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "../vec/vec.h"
+
+/*
+    Prefix tree of strings where every stored string carries a bitmask of
+    the sources it came from (e.g. the PATH directory index), so the same name
+    can be added and removed independently by each source.
+*/
+
+typedef struct trieNode {
+    unsigned short child_count;
+    unsigned short child_capacity;
+    char *keys;
+    struct trieNode **children;
+    uint64_t source_mask;
+    unsigned int terminal_count;
+} TrieNode;
+
+typedef struct trie {
+    TrieNode *root;
+    unsigned int len;
+
+    void (*insert)(struct trie *self, char *str, unsigned int source);
+
+    void (*remove)(struct trie *self, char *str, unsigned int source);
+
+    TrieNode *(*find)(struct trie *self, char *prefix);
+
+    void (*drop)(struct trie *self);
+} Trie;
+
+#define TRIE_MAX_SOURCE 63
+
+Trie *new_trie();
+
+void trie_insert(Trie *self, char *str, unsigned int source);
+
+void trie_remove(Trie *self, char *str, unsigned int source);
+
+TrieNode *trie_find(Trie *self, char *prefix);
+
+void drop_trie(Trie *self);
+
+char *trie_node_common_suffix(TrieNode *node);
+
+unsigned int trie_node_collect(TrieNode *node, char *prefix, Vec *out,
+                               unsigned int limit);
+
+#endif
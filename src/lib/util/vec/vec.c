@@ -1,4 +1,7 @@
 #include "vec.h"
+#include "../../alloc_stats.h"
+
+#define ALLOC_TAG VecAlloc
 
 Vec *new_vec_with_size(unsigned int elem_size, unsigned int capacity) {
     if (elem_size == 0) {
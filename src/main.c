@@ -1,11 +1,63 @@
+#include <errno.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
 
+#include "lib/alloc_stats.h"
+#include "lib/completion.h"
 #include "lib/handlers.h"
+#include "lib/jobserver.h"
+#include "lib/launcher.h"
 #include "lib/lib.h"
+#include "lib/server.h"
+#include "lib/stats.h"
 
-int main(void) {
+#define ALLOC_TAG StateAlloc
+
+void usage() {
+    fprintf(stderr, "usage: vsh [-c LINE | SCRIPT | --serve SOCKET | --client SOCKET [lines...]]\n");
+}
+
+char *read_script(char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "vsh: %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    size_t len = 0, cap = BUFFER_MAX_SIZE, amount;
+    char *script = malloc(cap);
+    while ((amount = fread(script + len, 1, cap - len - 1, file)) > 0) {
+        len += amount;
+        if (len + 1 == cap) {
+            cap *= 2;
+            script = realloc(script, cap);
+        }
+    }
+    script[len] = '\0';
+    fclose(file);
+    return script;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1 && str_equals(argv[1], "--client")) {
+        if (argc < 3) {
+            usage();
+            return 2;
+        }
+        // The client doesn't need any shell state, it only forwards the script
+        return run_client(argv[2], argv + 3, argc - 3);
+    }
+    // Mapped first, so the launcher shares them too
+    init_stats();
+    init_alloc_stats();
+    // Before the launcher, so it inherits the pool of VSH_JOBSERVER
+    init_jobserver();
+    bool is_script = argc > 1 && (str_equals(argv[1], "-c") || argv[1][0] != '-');
+    if (!is_script) {
+        // Forked while the process is still small, see launcher.h
+        start_launcher();
+    }
     char *debug_env = getenv("DEBUG");
     debug_lib(debug_env != NULL &&
               (str_equals(debug_env, "true") || str_equals(debug_env, "1")));
@@ -16,7 +68,31 @@ int main(void) {
     signal(SIGUSR2, sig_usr_handler);
 
     ShellState *state = initialize_shell_state();
+    state->capture_output = capture_output_handler;
+    if (is_script) {
+        char *script = str_equals(argv[1], "-c") ? (argc > 2 ? strdup(argv[2]) : NULL)
+                                                 : read_script(argv[1]);
+        if (script == NULL) {
+            usage();
+            return 2;
+        }
+        // The last command replaces the shell when possible, unless the
+        // allocations left at exit have to be reported
+        int status = call_script_handler(state, script, !alloc_stats_enabled());
+        free(script);
+        state->drop(state);
+        return report_outstanding_allocs() && !status ? 1 : status;
+    }
+    if (argc > 1) {
+        if (!str_equals(argv[1], "--serve") || argc != 3) {
+            usage();
+            return 2;
+        }
+        return serve(state, argv[2]);
+    }
 
+    // Only the interactive shell completes commands
+    start_path_index();
     bool should_continue = true;
     int status_code = 0;
     while (should_continue) {
@@ -26,32 +102,14 @@ int main(void) {
             CallGroups *call_groups = call_arg->call_groups(call_arg);
             int i;
             for (i = 0; i < call_groups->len; i++) {
-                CallGroup *call_group = call_groups->groups[i];
-                switch (call_group->type) {
-                    case Basic:
-                        if (call_group->exec_amount)
-                            basic_cmd_handler(state, call_group->exec_arr[0], true,
-                                              &should_continue, &status_code);
-                        break;
-                    case Parallel:
-                        parallel_cmd_handler(state, call_group, &should_continue,
-                                             &status_code);
-                        break;
-                    case Sequential:
-                        sequential_cmd_handler(state, call_group, &should_continue,
-                                               &status_code);
-                        break;
-                    case Piped:
-                        piped_cmd_handler(state, call_group, &should_continue, &status_code);
-                        break;
-                    default:
-                        break;
-                }
+                call_group_handler(state, call_groups->groups[i], &should_continue,
+                                   &status_code);
             }
             call_groups->drop(call_groups);
             call_arg->drop(call_arg);
+            report_line_allocs();
         }
     }
     state->drop(state);
-    return status_code;
+    return report_outstanding_allocs() && !status_code ? 1 : status_code;
 }
\ No newline at end of file